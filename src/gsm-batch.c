@@ -0,0 +1,726 @@
+/* gsm-batch.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <string.h>
+
+#include "gsm-batch.h"
+#include "gsm-instance-private.h"
+
+/**
+ * SECTION:gsm-batch
+ * @short_description: Many instances of one definition, stepped together
+ *
+ * A #GsmBatch holds a fixed number of instances of a sealed
+ * #GsmStateMachineDefinition in structure of arrays layout: the state of
+ * all instances, the time they entered it, each word of their active
+ * conditions and each input are stored in separate arrays. A step first
+ * evaluates the conditions of the changed inputs, sorts the instances by
+ * state and then checks the transitions of each state against the
+ * instances in it in one pass, which the compiler can vectorize.
+ *
+ * The instances behave like #GsmInstance: input values are only available
+ * to the conditions, events are handled synchronously and nothing is
+ * reported but the list of instances that changed state. Only boolean,
+ * integer, double and enum inputs can be set.
+ */
+
+#define NO_MATCH G_MAXUINT32
+
+/* The value of an input of one instance, v_int for booleans, integers and
+ * enums. */
+typedef union
+{
+  gint    v_int;
+  gdouble v_double;
+} GsmBatchSlot;
+
+struct _GsmBatch
+{
+  GsmStateMachineDefinition *def;
+  guint       n_instances;
+
+  /* Instances refer to the leaf states by index, see _batch_leaf_index() */
+  GPtrArray  *leaf_states;
+  GHashTable *leaf_indices;
+  /* The leaf index of the target of each entry of the compiled transition
+   * table of leaf state s, starting at entry_offsets[s]. */
+  guint      *entry_offsets;
+  guint32    *entry_targets;
+
+  guint32    *states;
+  gint64     *state_entered;
+
+  /* Word w of the active conditions of instance i is at
+   * conditions[w * n_instances + i], the state of condition c at
+   * condition_states[c * n_instances + i]. */
+  guint       n_words;
+  guint64    *conditions;
+  GsmStateMachineConditionState *condition_states;
+
+  /* Input j of instance i is at slots[j * n_instances + i], the instance
+   * has a bit in dirty[j * n_dirty_words + i / 64] if the conditions of
+   * the input need to be evaluated. */
+  GsmBatchSlot *slots;
+  guint       n_dirty_words;
+  guint64    *dirty;
+  guint      *n_dirty;
+
+  /* Scratch space. A step sorts the instances by state into order, the
+   * instances in leaf state s are at state_starts[s] up to
+   * state_starts[s + 1]. match, ok and the sorted_ arrays are indexed by
+   * the position in order, targets by the instance. */
+  guint      *state_starts;
+  guint32    *order;
+  gint64     *sorted_entered;
+  guint64    *sorted_conditions;
+  guint32    *match;
+  guint8     *ok;
+  guint32    *targets;
+  GsmBitset  *active;
+};
+
+static guint32
+_batch_leaf_index (GsmBatch             *batch,
+                   GsmStateMachineState *state)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (batch->leaf_indices, state)) - 1;
+}
+
+static gint
+_leaf_state_compare (gconstpointer a,
+                     gconstpointer b)
+{
+  const GsmStateMachineState *state_a = *(GsmStateMachineState **) a;
+  const GsmStateMachineState *state_b = *(GsmStateMachineState **) b;
+
+  return state_a->value - state_b->value;
+}
+
+static void
+_slot_from_value (GsmBatchSlot *slot,
+                  const GValue *value)
+{
+  switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value)))
+    {
+    case G_TYPE_BOOLEAN:
+      slot->v_int = g_value_get_boolean (value);
+      break;
+    case G_TYPE_INT:
+      slot->v_int = g_value_get_int (value);
+      break;
+    case G_TYPE_ENUM:
+      slot->v_int = g_value_get_enum (value);
+      break;
+    case G_TYPE_DOUBLE:
+      slot->v_double = g_value_get_double (value);
+      break;
+    default:
+      /* Cannot be set, so it stays at the default */
+      break;
+    }
+}
+
+static void
+_slot_to_value (const GsmBatchSlot *slot,
+                GValue             *value)
+{
+  switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value)))
+    {
+    case G_TYPE_BOOLEAN:
+      g_value_set_boolean (value, slot->v_int);
+      break;
+    case G_TYPE_INT:
+      g_value_set_int (value, slot->v_int);
+      break;
+    case G_TYPE_ENUM:
+      g_value_set_enum (value, slot->v_int);
+      break;
+    case G_TYPE_DOUBLE:
+      g_value_set_double (value, slot->v_double);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/**
+ * gsm_batch_new:
+ * @definition: a sealed #GsmStateMachineDefinition
+ * @n_instances: the number of instances
+ * @now: the current time, used as the time the initial state was entered
+ *
+ * Creates @n_instances instances in the initial state with all inputs at
+ * their default value. Instances are identified by their index.
+ *
+ * Returns: (transfer full): a new #GsmBatch
+ */
+GsmBatch*
+gsm_batch_new (GsmStateMachineDefinition *definition,
+               guint                      n_instances,
+               gint64                     now)
+{
+  GsmInstance *template;
+  GsmBatch *batch;
+  GHashTableIter iter;
+  GsmStateMachineState *state;
+  guint n_entries = 0;
+  guint n_conditions;
+  guint n_inputs;
+  guint32 initial;
+
+  g_return_val_if_fail (definition != NULL, NULL);
+  g_return_val_if_fail (definition->sealed, NULL);
+
+  template = definition->instance_template;
+  n_conditions = definition->input_conditions->len;
+  n_inputs = definition->inputs_by_id->len;
+
+  batch = g_new0 (GsmBatch, 1);
+  batch->def = gsm_state_machine_definition_ref (definition);
+  batch->n_instances = n_instances;
+
+  batch->leaf_states = g_ptr_array_new ();
+  batch->leaf_indices = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  g_hash_table_iter_init (&iter, definition->states);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &state))
+    {
+      if (state->value >= 0)
+        g_ptr_array_add (batch->leaf_states, state);
+    }
+  g_ptr_array_sort (batch->leaf_states, _leaf_state_compare);
+
+  batch->entry_offsets = g_new (guint, batch->leaf_states->len);
+  for (guint s = 0; s < batch->leaf_states->len; s++)
+    {
+      state = g_ptr_array_index (batch->leaf_states, s);
+      g_hash_table_insert (batch->leaf_indices, state, GUINT_TO_POINTER (s + 1));
+      batch->entry_offsets[s] = n_entries;
+      n_entries += state->compiled->len;
+    }
+
+  batch->entry_targets = g_new (guint32, n_entries);
+  for (guint s = 0; s < batch->leaf_states->len; s++)
+    {
+      state = g_ptr_array_index (batch->leaf_states, s);
+
+      for (guint k = 0; k < state->compiled->len; k++)
+        {
+          const GsmStateMachineCompiledTransition *item = &g_array_index (state->compiled, GsmStateMachineCompiledTransition, k);
+
+          batch->entry_targets[batch->entry_offsets[s] + k] = _batch_leaf_index (batch, item->real_target);
+        }
+    }
+
+  initial = _batch_leaf_index (batch, template->current_state);
+  batch->states = g_new (guint32, n_instances);
+  batch->state_entered = g_new (gint64, n_instances);
+  for (guint i = 0; i < n_instances; i++)
+    {
+      batch->states[i] = initial;
+      batch->state_entered[i] = now;
+    }
+
+  batch->n_words = template->active_conditions->n_words;
+  batch->conditions = g_new (guint64, (gsize) batch->n_words * n_instances);
+  for (guint w = 0; w < batch->n_words; w++)
+    for (guint i = 0; i < n_instances; i++)
+      batch->conditions[(gsize) w * n_instances + i] = template->active_conditions->words[w];
+
+  batch->condition_states = g_new (GsmStateMachineConditionState, (gsize) n_conditions * n_instances);
+  for (guint c = 0; c < n_conditions; c++)
+    for (guint i = 0; i < n_instances; i++)
+      batch->condition_states[(gsize) c * n_instances + i] = template->condition_states[c];
+
+  batch->slots = g_new0 (GsmBatchSlot, (gsize) n_inputs * n_instances);
+  for (guint j = 0; j < n_inputs; j++)
+    {
+      GsmStateMachineValue *input_value = g_ptr_array_index (definition->inputs_by_id, j);
+
+      for (guint i = 0; i < n_instances; i++)
+        _slot_from_value (&batch->slots[(gsize) j * n_instances + i], &input_value->value);
+    }
+
+  batch->n_dirty_words = GSM_BITSET_N_WORDS (n_instances);
+  batch->dirty = g_new0 (guint64, (gsize) n_inputs * batch->n_dirty_words);
+  batch->n_dirty = g_new0 (guint, n_inputs);
+
+  batch->state_starts = g_new (guint, batch->leaf_states->len + 1);
+  batch->order = g_new (guint32, n_instances);
+  batch->sorted_entered = g_new (gint64, n_instances);
+  batch->sorted_conditions = g_new (guint64, (gsize) batch->n_words * n_instances);
+  batch->match = g_new (guint32, n_instances);
+  batch->ok = g_new (guint8, n_instances);
+  batch->targets = g_new (guint32, n_instances);
+  batch->active = gsm_bitset_new (batch->n_words * GSM_BITSET_WORD_BITS);
+
+  return batch;
+}
+
+void
+gsm_batch_free (GsmBatch *batch)
+{
+  g_return_if_fail (batch != NULL);
+
+  g_ptr_array_unref (batch->leaf_states);
+  g_hash_table_unref (batch->leaf_indices);
+  g_free (batch->entry_offsets);
+  g_free (batch->entry_targets);
+  g_free (batch->states);
+  g_free (batch->state_entered);
+  g_free (batch->conditions);
+  g_free (batch->condition_states);
+  g_free (batch->slots);
+  g_free (batch->dirty);
+  g_free (batch->n_dirty);
+  g_free (batch->state_starts);
+  g_free (batch->order);
+  g_free (batch->sorted_entered);
+  g_free (batch->sorted_conditions);
+  g_free (batch->match);
+  g_free (batch->ok);
+  g_free (batch->targets);
+  gsm_bitset_free (batch->active);
+  gsm_state_machine_definition_unref (batch->def);
+
+  g_free (batch);
+}
+
+/**
+ * gsm_batch_get_definition:
+ * @batch: a #GsmBatch
+ *
+ * Returns: (transfer none): the definition of the instances
+ */
+GsmStateMachineDefinition*
+gsm_batch_get_definition (GsmBatch *batch)
+{
+  g_return_val_if_fail (batch != NULL, NULL);
+
+  return batch->def;
+}
+
+guint
+gsm_batch_get_n_instances (GsmBatch *batch)
+{
+  g_return_val_if_fail (batch != NULL, 0);
+
+  return batch->n_instances;
+}
+
+gint
+gsm_batch_get_state (GsmBatch *batch,
+                     guint     index)
+{
+  GsmStateMachineState *state;
+
+  g_return_val_if_fail (batch != NULL, 0);
+  g_return_val_if_fail (index < batch->n_instances, 0);
+
+  state = g_ptr_array_index (batch->leaf_states, batch->states[index]);
+
+  return state->value;
+}
+
+/* Evaluates the conditions of one input of one instance, the active set of
+ * the instance is gathered into a bitset for that. */
+static void
+_batch_evaluate (GsmBatch             *batch,
+                 GsmStateMachineValue *input_value,
+                 guint                 index)
+{
+  GValue value = G_VALUE_INIT;
+  guint n = batch->n_instances;
+
+  g_value_init (&value, G_VALUE_TYPE (&input_value->value));
+  _slot_to_value (&batch->slots[(gsize) input_value->idx * n + index], &value);
+
+  for (guint w = 0; w < batch->n_words; w++)
+    batch->active->words[w] = batch->conditions[(gsize) w * n + index];
+
+  for (guint k = 0; k < input_value->conditions->len; k++)
+    {
+      GsmStateMachineCondition *condition = g_ptr_array_index (input_value->conditions, k);
+
+      gsm_instance_internal_evaluate_condition (condition,
+                                                &batch->condition_states[(gsize) condition->idx * n + index],
+                                                &value, batch->active);
+    }
+
+  for (guint w = 0; w < batch->n_words; w++)
+    batch->conditions[(gsize) w * n + index] = batch->active->words[w];
+}
+
+static void
+_batch_evaluate_dirty (GsmBatch *batch)
+{
+  for (guint j = 0; j < batch->def->inputs_by_id->len; j++)
+    {
+      GsmStateMachineValue *input_value;
+      guint64 *dirty;
+
+      if (batch->n_dirty[j] == 0)
+        continue;
+
+      input_value = g_ptr_array_index (batch->def->inputs_by_id, j);
+      dirty = &batch->dirty[(gsize) j * batch->n_dirty_words];
+
+      for (guint w = 0; w < batch->n_dirty_words; w++)
+        {
+          while (dirty[w])
+            {
+              guint bit = __builtin_ctzll (dirty[w]);
+
+              dirty[w] &= dirty[w] - 1;
+              _batch_evaluate (batch, input_value, w * GSM_BITSET_WORD_BITS + bit);
+            }
+        }
+
+      batch->n_dirty[j] = 0;
+    }
+}
+
+static void
+_batch_evaluate_instance (GsmBatch *batch,
+                          guint     index)
+{
+  guint64 bit = G_GUINT64_CONSTANT (1) << (index % GSM_BITSET_WORD_BITS);
+
+  for (guint j = 0; j < batch->def->inputs_by_id->len; j++)
+    {
+      guint64 *dirty = &batch->dirty[(gsize) j * batch->n_dirty_words + index / GSM_BITSET_WORD_BITS];
+
+      if (!(*dirty & bit))
+        continue;
+
+      *dirty &= ~bit;
+      batch->n_dirty[j] -= 1;
+      _batch_evaluate (batch, g_ptr_array_index (batch->def->inputs_by_id, j), index);
+    }
+}
+
+/* Checks the type of the input and that its pspec accepts @value, invalid
+ * values are rejected like for instances. */
+static GsmBatchSlot*
+_batch_input_slot (GsmBatch           *batch,
+                   guint               index,
+                   gint                input,
+                   GType               fundamental,
+                   const GsmBatchSlot *value)
+{
+  GsmStateMachineValue *input_value;
+  gboolean valid;
+
+  input_value = gsm_instance_internal_typed_input (batch->def, input, fundamental);
+  if (!input_value)
+    return NULL;
+
+  if (fundamental == G_TYPE_DOUBLE)
+    valid = gsm_state_machine_value_validate_double (input_value->pspec, value->v_double);
+  else
+    valid = gsm_state_machine_value_validate_integer (input_value->pspec, value->v_int);
+
+  if (!valid)
+    return NULL;
+
+  return &batch->slots[(gsize) input * batch->n_instances + index];
+}
+
+static void
+_batch_mark_dirty (GsmBatch *batch,
+                   guint     index,
+                   gint      input)
+{
+  GsmStateMachineValue *input_value = g_ptr_array_index (batch->def->inputs_by_id, input);
+  guint64 *dirty = &batch->dirty[(gsize) input * batch->n_dirty_words + index / GSM_BITSET_WORD_BITS];
+  guint64 bit = G_GUINT64_CONSTANT (1) << (index % GSM_BITSET_WORD_BITS);
+
+  if (input_value->conditions->len == 0 || (*dirty & bit))
+    return;
+
+  *dirty |= bit;
+  batch->n_dirty[input] += 1;
+}
+
+void
+gsm_batch_set_input_boolean (GsmBatch *batch,
+                             guint     index,
+                             gint      input,
+                             gboolean  value)
+{
+  GsmBatchSlot new_value = { .v_int = !!value };
+  GsmBatchSlot *slot;
+
+  g_return_if_fail (batch != NULL);
+  g_return_if_fail (index < batch->n_instances);
+
+  slot = _batch_input_slot (batch, index, input, G_TYPE_BOOLEAN, &new_value);
+  if (!slot || slot->v_int == new_value.v_int)
+    return;
+
+  *slot = new_value;
+  _batch_mark_dirty (batch, index, input);
+}
+
+void
+gsm_batch_set_input_int (GsmBatch *batch,
+                         guint     index,
+                         gint      input,
+                         gint      value)
+{
+  GsmBatchSlot new_value = { .v_int = value };
+  GsmBatchSlot *slot;
+
+  g_return_if_fail (batch != NULL);
+  g_return_if_fail (index < batch->n_instances);
+
+  slot = _batch_input_slot (batch, index, input, G_TYPE_INT, &new_value);
+  if (!slot || slot->v_int == new_value.v_int)
+    return;
+
+  *slot = new_value;
+  _batch_mark_dirty (batch, index, input);
+}
+
+void
+gsm_batch_set_input_double (GsmBatch *batch,
+                            guint     index,
+                            gint      input,
+                            gdouble   value)
+{
+  GsmBatchSlot new_value = { .v_double = value };
+  GsmBatchSlot *slot;
+
+  g_return_if_fail (batch != NULL);
+  g_return_if_fail (index < batch->n_instances);
+
+  slot = _batch_input_slot (batch, index, input, G_TYPE_DOUBLE, &new_value);
+  if (!slot || slot->v_double == new_value.v_double)
+    return;
+
+  *slot = new_value;
+  _batch_mark_dirty (batch, index, input);
+}
+
+void
+gsm_batch_set_input_enum (GsmBatch *batch,
+                          guint     index,
+                          gint      input,
+                          gint      value)
+{
+  GsmBatchSlot new_value = { .v_int = value };
+  GsmBatchSlot *slot;
+
+  g_return_if_fail (batch != NULL);
+  g_return_if_fail (index < batch->n_instances);
+
+  slot = _batch_input_slot (batch, index, input, G_TYPE_ENUM, &new_value);
+  if (!slot || slot->v_int == new_value.v_int)
+    return;
+
+  *slot = new_value;
+  _batch_mark_dirty (batch, index, input);
+}
+
+/**
+ * gsm_batch_step:
+ * @batch: a #GsmBatch
+ * @now: the current time
+ * @changed: (nullable) (element-type guint): array to append the index of
+ *   every instance that changed state to
+ *
+ * Does a single transition for every instance for which one applies to its
+ * inputs and the time its state has been active, in the same way as
+ * gsm_instance_step(). Call it again until it returns 0 to settle all
+ * instances.
+ *
+ * The instances are sorted by their state first, so each transition is
+ * only tested against the instances that are in its state and did not
+ * match an earlier transition yet. The loops over those instances are free
+ * of branches and work on condition words gathered next to each other.
+ *
+ * Returns: the number of instances that changed state
+ */
+guint
+gsm_batch_step (GsmBatch *batch,
+                gint64    now,
+                GArray   *changed)
+{
+  guint32 *restrict match;
+  guint8 *restrict ok;
+  guint32 *restrict order;
+  gint64 *restrict sorted_entered;
+  const guint32 *states;
+  guint *state_starts;
+  guint n_states;
+  guint n;
+  guint n_changed = 0;
+
+  g_return_val_if_fail (batch != NULL, 0);
+
+  _batch_evaluate_dirty (batch);
+
+  n = batch->n_instances;
+  n_states = batch->leaf_states->len;
+  match = batch->match;
+  ok = batch->ok;
+  order = batch->order;
+  sorted_entered = batch->sorted_entered;
+  states = batch->states;
+  state_starts = batch->state_starts;
+
+  /* Counting sort by state. Placing the instances advances each start to
+   * the start of the next state, so they are shifted back afterwards. */
+  memset (state_starts, 0, (n_states + 1) * sizeof (guint));
+  for (guint i = 0; i < n; i++)
+    state_starts[states[i] + 1] += 1;
+
+  for (guint s = 0; s < n_states; s++)
+    state_starts[s + 1] += state_starts[s];
+
+  for (guint i = 0; i < n; i++)
+    order[state_starts[states[i]]++] = i;
+
+  memmove (state_starts + 1, state_starts, n_states * sizeof (guint));
+  state_starts[0] = 0;
+
+  for (guint p = 0; p < n; p++)
+    {
+      sorted_entered[p] = batch->state_entered[order[p]];
+      match[p] = NO_MATCH;
+    }
+
+  for (guint w = 0; w < batch->n_words; w++)
+    {
+      const guint64 *words = &batch->conditions[(gsize) w * n];
+      guint64 *sorted_words = &batch->sorted_conditions[(gsize) w * n];
+
+      for (guint p = 0; p < n; p++)
+        sorted_words[p] = words[order[p]];
+    }
+
+  for (guint s = 0; s < n_states; s++)
+    {
+      GsmStateMachineState *state = g_ptr_array_index (batch->leaf_states, s);
+      guint first = state_starts[s];
+      guint last = state_starts[s + 1];
+
+      if (first == last)
+        continue;
+
+      /* Bucket 0, the transitions without an event in the order they are
+       * checked. Timed transitions are at the end, so comparing the
+       * timeout of each one is the same as stopping at the first one that
+       * did not elapse. */
+      for (guint k = state->compiled_offsets[0]; k < state->compiled_offsets[1]; k++)
+        {
+          const GsmStateMachineCompiledTransition *item = &g_array_index (state->compiled, GsmStateMachineCompiledTransition, k);
+          guint32 target = batch->entry_targets[batch->entry_offsets[s] + k];
+          gint64 timeout = (gint64) item->timeout * 1000;
+
+          for (guint p = first; p < last; p++)
+            ok[p] = (match[p] == NO_MATCH) & (now - sorted_entered[p] >= timeout);
+
+          for (guint w = 0; w < item->conditions->n_words; w++)
+            {
+              const guint64 *restrict words = &batch->sorted_conditions[(gsize) w * n];
+              guint64 mask = item->conditions->words[w];
+
+              if (mask == 0)
+                continue;
+
+              for (guint p = first; p < last; p++)
+                ok[p] &= (words[p] & mask) == mask;
+            }
+
+          for (guint p = first; p < last; p++)
+            match[p] = ok[p] ? target : match[p];
+        }
+    }
+
+  /* Back in instance order, so changed is sorted */
+  for (guint p = 0; p < n; p++)
+    batch->targets[order[p]] = match[p];
+
+  /* Matching a transition back into the current state is stable */
+  for (guint i = 0; i < n; i++)
+    {
+      guint32 target = batch->targets[i];
+
+      if (target == NO_MATCH || target == states[i])
+        continue;
+
+      batch->states[i] = target;
+      batch->state_entered[i] = now;
+      n_changed += 1;
+
+      if (changed)
+        g_array_append_val (changed, i);
+    }
+
+  return n_changed;
+}
+
+/**
+ * gsm_batch_handle_event:
+ * @batch: a #GsmBatch
+ * @index: the index of the instance
+ * @event: the id of the event, see gsm_state_machine_lookup_event()
+ * @now: the current time
+ *
+ * Does the transition for the event for one instance if one applies, see
+ * gsm_instance_handle_event(). The instance should be settled first.
+ *
+ * Returns: %GSM_STEP_RESULT_TRANSITION if a transition was done, otherwise
+ *   %GSM_STEP_RESULT_EVENT_DROPPED.
+ */
+GsmStepResult
+gsm_batch_handle_event (GsmBatch *batch,
+                        guint     index,
+                        gint      event,
+                        gint64    now)
+{
+  const GsmStateMachineCompiledTransition *transition;
+  guint32 target;
+
+  g_return_val_if_fail (batch != NULL, GSM_STEP_RESULT_EVENT_DROPPED);
+  g_return_val_if_fail (index < batch->n_instances, GSM_STEP_RESULT_EVENT_DROPPED);
+  g_return_val_if_fail (event >= 0 && event < batch->def->events->len, GSM_STEP_RESULT_EVENT_DROPPED);
+
+  _batch_evaluate_instance (batch, index);
+
+  for (guint w = 0; w < batch->n_words; w++)
+    batch->active->words[w] = batch->conditions[(gsize) w * batch->n_instances + index];
+
+  transition = gsm_instance_internal_find_transition (batch->active,
+                                                      g_ptr_array_index (batch->leaf_states, batch->states[index]),
+                                                      event + 1, now - batch->state_entered[index]);
+  if (!transition)
+    return GSM_STEP_RESULT_EVENT_DROPPED;
+
+  target = _batch_leaf_index (batch, transition->real_target);
+  if (target == batch->states[index])
+    return GSM_STEP_RESULT_EVENT_DROPPED;
+
+  batch->states[index] = target;
+  batch->state_entered[index] = now;
+
+  return GSM_STEP_RESULT_TRANSITION;
+}
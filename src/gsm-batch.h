@@ -0,0 +1,66 @@
+/* gsm-batch.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-state-machine.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsmBatch GsmBatch;
+
+GsmBatch        *gsm_batch_new                         (GsmStateMachineDefinition *definition,
+                                                        guint                      n_instances,
+                                                        gint64                     now);
+void             gsm_batch_free                        (GsmBatch         *batch);
+
+GsmStateMachineDefinition *gsm_batch_get_definition    (GsmBatch         *batch);
+guint            gsm_batch_get_n_instances             (GsmBatch         *batch);
+gint             gsm_batch_get_state                   (GsmBatch         *batch,
+                                                        guint             index);
+
+void             gsm_batch_set_input_boolean           (GsmBatch         *batch,
+                                                        guint             index,
+                                                        gint              input,
+                                                        gboolean          value);
+void             gsm_batch_set_input_int               (GsmBatch         *batch,
+                                                        guint             index,
+                                                        gint              input,
+                                                        gint              value);
+void             gsm_batch_set_input_double            (GsmBatch         *batch,
+                                                        guint             index,
+                                                        gint              input,
+                                                        gdouble           value);
+void             gsm_batch_set_input_enum              (GsmBatch         *batch,
+                                                        guint             index,
+                                                        gint              input,
+                                                        gint              value);
+
+guint            gsm_batch_step                        (GsmBatch         *batch,
+                                                        gint64            now,
+                                                        GArray           *changed);
+GsmStepResult    gsm_batch_handle_event                (GsmBatch         *batch,
+                                                        guint             index,
+                                                        gint              event,
+                                                        gint64            now);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsmBatch, gsm_batch_free)
+
+G_END_DECLS
@@ -0,0 +1,160 @@
+/* gsm-bitset.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Private helper, a fixed width set of dense indices (e.g. conditions).
+ * The width is decided on allocation; operations between two sets of
+ * different width treat the missing words as zero. */
+typedef struct
+{
+  guint   n_words;
+  guint64 words[];
+} GsmBitset;
+
+#define GSM_BITSET_WORD_BITS 64
+#define GSM_BITSET_N_WORDS(n_bits) (((n_bits) + GSM_BITSET_WORD_BITS - 1) / GSM_BITSET_WORD_BITS)
+
+static inline GsmBitset*
+gsm_bitset_new (guint n_bits)
+{
+  guint n_words = GSM_BITSET_N_WORDS (n_bits);
+  GsmBitset *res;
+
+  res = g_malloc0 (sizeof (GsmBitset) + n_words * sizeof (guint64));
+  res->n_words = n_words;
+
+  return res;
+}
+
+static inline void
+gsm_bitset_free (GsmBitset *bitset)
+{
+  g_free (bitset);
+}
+
+static inline GsmBitset*
+gsm_bitset_copy (const GsmBitset *bitset)
+{
+  gsize size = sizeof (GsmBitset) + bitset->n_words * sizeof (guint64);
+
+  return memcpy (g_malloc (size), bitset, size);
+}
+
+/* Grows the set if needed, new bits are cleared. */
+static inline GsmBitset*
+gsm_bitset_resize (GsmBitset *bitset, guint n_bits)
+{
+  guint n_words = GSM_BITSET_N_WORDS (n_bits);
+
+  if (n_words <= bitset->n_words)
+    return bitset;
+
+  bitset = g_realloc (bitset, sizeof (GsmBitset) + n_words * sizeof (guint64));
+  memset (&bitset->words[bitset->n_words], 0, (n_words - bitset->n_words) * sizeof (guint64));
+  bitset->n_words = n_words;
+
+  return bitset;
+}
+
+static inline void
+gsm_bitset_set (GsmBitset *bitset, guint bit)
+{
+  bitset->words[bit / GSM_BITSET_WORD_BITS] |= G_GUINT64_CONSTANT (1) << (bit % GSM_BITSET_WORD_BITS);
+}
+
+static inline void
+gsm_bitset_unset (GsmBitset *bitset, guint bit)
+{
+  bitset->words[bit / GSM_BITSET_WORD_BITS] &= ~(G_GUINT64_CONSTANT (1) << (bit % GSM_BITSET_WORD_BITS));
+}
+
+static inline gboolean
+gsm_bitset_get (const GsmBitset *bitset, guint bit)
+{
+  if (bit / GSM_BITSET_WORD_BITS >= bitset->n_words)
+    return FALSE;
+
+  return (bitset->words[bit / GSM_BITSET_WORD_BITS] >> (bit % GSM_BITSET_WORD_BITS)) & 1;
+}
+
+static inline void
+gsm_bitset_clear (GsmBitset *bitset)
+{
+  memset (bitset->words, 0, bitset->n_words * sizeof (guint64));
+}
+
+/* Returns the next set bit starting at @bit, or -1 */
+static inline gint
+gsm_bitset_next (const GsmBitset *bitset, guint bit)
+{
+  guint w = bit / GSM_BITSET_WORD_BITS;
+  guint64 word;
+
+  if (w >= bitset->n_words)
+    return -1;
+
+  word = bitset->words[w] & (G_MAXUINT64 << (bit % GSM_BITSET_WORD_BITS));
+  while (TRUE)
+    {
+      if (word)
+        return w * GSM_BITSET_WORD_BITS + __builtin_ctzll (word);
+
+      w++;
+      if (w >= bitset->n_words)
+        return -1;
+      word = bitset->words[w];
+    }
+}
+
+/* Checks whether all bits of @subset are also set in @set. @set must be
+ * at least as wide as @subset. */
+static inline gboolean
+gsm_bitset_is_subset (const GsmBitset *set, const GsmBitset *subset)
+{
+  guint64 missing = 0;
+
+  /* No early exit, the sets are a few words at most and this way the
+   * loop can be vectorized. */
+  for (guint i = 0; i < subset->n_words; i++)
+    missing |= subset->words[i] & ~set->words[i];
+
+  return missing == 0;
+}
+
+static inline gboolean
+gsm_bitset_is_disjunct (const GsmBitset *a, const GsmBitset *b)
+{
+  guint n_words = MIN (a->n_words, b->n_words);
+  guint64 common = 0;
+
+  for (guint i = 0; i < n_words; i++)
+    common |= a->words[i] & b->words[i];
+
+  return common == 0;
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsmBitset, gsm_bitset_free)
+
+G_END_DECLS
@@ -0,0 +1,37 @@
+/* gsm-clock-private.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-clock.h"
+#include "gsm-timer-wheel.h"
+
+G_BEGIN_DECLS
+
+/* Only for virtual clocks. The deadline is in microseconds of the clock's
+ * time, timers have a resolution of one millisecond and fire from
+ * gsm_clock_advance_to() with the clock set to their expiry. */
+void             gsm_clock_add_timer                   (GsmClock         *clock,
+                                                        GsmTimer         *timer,
+                                                        gint64            deadline);
+void             gsm_clock_remove_timer                (GsmClock         *clock,
+                                                        GsmTimer         *timer);
+
+G_END_DECLS
@@ -0,0 +1,300 @@
+/* gsm-clock.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gsm-clock-private.h"
+
+/**
+ * SECTION:gsm-clock
+ * @short_description: Time source for timed transitions
+ *
+ * A #GsmClock provides the time that #GsmStateMachine uses for timeout
+ * edges. By default machines use the monotonic clock and wait for their
+ * timers in the main loop.
+ *
+ * A virtual clock only moves when gsm_clock_advance() or
+ * gsm_clock_advance_to() is called. All timers that expire in the advanced
+ * range fire in order of their expiry, with the clock set to the expiry
+ * time, and the machine is updated synchronously at that point. This allows
+ * simulating long periods of operation as fast as possible and yields the
+ * same results independent of how the clock is advanced.
+ *
+ * Times are in microseconds, timers have a resolution of one millisecond.
+ */
+
+struct _GsmClock
+{
+  GObject       parent_instance;
+
+  gboolean      virtual;
+  gint64        time;
+
+  /* Ticks are milliseconds of the virtual time */
+  GsmTimerWheel timers;
+};
+
+G_DEFINE_TYPE (GsmClock, gsm_clock, G_TYPE_OBJECT)
+
+enum {
+  PROP_0,
+  PROP_VIRTUAL,
+  PROP_TIME,
+  N_PROPS
+};
+
+static GParamSpec *properties [N_PROPS];
+
+/**
+ * gsm_clock_new:
+ *
+ * Create a new #GsmClock using the monotonic time.
+ *
+ * Returns: (transfer full): a newly created #GsmClock
+ */
+GsmClock *
+gsm_clock_new (void)
+{
+  return g_object_new (GSM_TYPE_CLOCK, NULL);
+}
+
+/**
+ * gsm_clock_new_virtual:
+ * @start_time: the initial time in microseconds
+ *
+ * Create a new virtual #GsmClock that only moves when advanced.
+ *
+ * Returns: (transfer full): a newly created #GsmClock
+ */
+GsmClock *
+gsm_clock_new_virtual (gint64 start_time)
+{
+  GsmClock *clock;
+
+  g_return_val_if_fail (start_time >= 0, NULL);
+
+  clock = g_object_new (GSM_TYPE_CLOCK,
+                        "virtual", TRUE,
+                        NULL);
+  clock->time = start_time;
+  gsm_timer_wheel_init (&clock->timers, start_time / 1000);
+
+  return clock;
+}
+
+static void
+gsm_clock_finalize (GObject *object)
+{
+  GsmClock *self = (GsmClock *)object;
+
+  /* Machines hold a reference, so no timer can be armed anymore. */
+  g_assert (self->timers.n_timers == 0);
+
+  G_OBJECT_CLASS (gsm_clock_parent_class)->finalize (object);
+}
+
+static void
+gsm_clock_get_property (GObject    *object,
+                        guint       prop_id,
+                        GValue     *value,
+                        GParamSpec *pspec)
+{
+  GsmClock *self = GSM_CLOCK (object);
+
+  switch (prop_id)
+    {
+    case PROP_VIRTUAL:
+      g_value_set_boolean (value, self->virtual);
+      break;
+
+    case PROP_TIME:
+      g_value_set_int64 (value, gsm_clock_get_time (self));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gsm_clock_set_property (GObject      *object,
+                        guint         prop_id,
+                        const GValue *value,
+                        GParamSpec   *pspec)
+{
+  GsmClock *self = GSM_CLOCK (object);
+
+  switch (prop_id)
+    {
+    case PROP_VIRTUAL:
+      self->virtual = g_value_get_boolean (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gsm_clock_class_init (GsmClockClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gsm_clock_finalize;
+  object_class->get_property = gsm_clock_get_property;
+  object_class->set_property = gsm_clock_set_property;
+
+  properties[PROP_VIRTUAL] =
+    g_param_spec_boolean ("virtual", "Virtual",
+                          "Whether the clock only moves when advanced",
+                          FALSE,
+                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /* Changes continuously, so there is no notification */
+  properties[PROP_TIME] =
+    g_param_spec_int64 ("time", "Time",
+                        "The current time in microseconds",
+                        0,
+                        G_MAXINT64,
+                        0,
+                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+gsm_clock_init (GsmClock *self)
+{
+  gsm_timer_wheel_init (&self->timers, 0);
+}
+
+gboolean
+gsm_clock_is_virtual (GsmClock *clock)
+{
+  g_return_val_if_fail (GSM_IS_CLOCK (clock), FALSE);
+
+  return clock->virtual;
+}
+
+/**
+ * gsm_clock_get_time:
+ * @clock: a #GsmClock
+ *
+ * Returns: the current time in microseconds, for a non-virtual clock this is
+ *   g_get_monotonic_time().
+ */
+gint64
+gsm_clock_get_time (GsmClock *clock)
+{
+  g_return_val_if_fail (GSM_IS_CLOCK (clock), 0);
+
+  if (!clock->virtual)
+    return g_get_monotonic_time ();
+
+  return clock->time;
+}
+
+/**
+ * gsm_clock_get_next_deadline:
+ * @clock: a virtual #GsmClock
+ *
+ * Returns the time up to which the clock can be advanced without any timer
+ * firing. Advancing to exactly this time fires the next timer(s), so a
+ * simulation can run by repeatedly advancing to the next deadline.
+ *
+ * Returns: the time in microseconds, or -1 if no timer is armed
+ */
+gint64
+gsm_clock_get_next_deadline (GsmClock *clock)
+{
+  gint64 next;
+
+  g_return_val_if_fail (GSM_IS_CLOCK (clock), -1);
+  g_return_val_if_fail (clock->virtual, -1);
+
+  next = gsm_timer_wheel_next_expiry (&clock->timers);
+
+  return next >= 0 ? MAX (next * 1000, clock->time) : -1;
+}
+
+/**
+ * gsm_clock_advance_to:
+ * @clock: a virtual #GsmClock
+ * @time: the new time in microseconds, must not be in the past
+ *
+ * Moves the clock forward, firing all timers that expire up to and
+ * including @time in order.
+ */
+void
+gsm_clock_advance_to (GsmClock *clock,
+                      gint64    time)
+{
+  g_autoptr(GsmClock) self = NULL;
+  gint64 next;
+
+  g_return_if_fail (GSM_IS_CLOCK (clock));
+  g_return_if_fail (clock->virtual);
+  g_return_if_fail (time >= clock->time);
+
+  self = g_object_ref (clock);
+
+  /* One expiry at a time, so that machines are updated at the expiry time
+   * and timers armed from there are taken into account. */
+  while ((next = gsm_timer_wheel_next_event (&self->timers)) >= 0 && next <= time / 1000)
+    {
+      self->time = MAX (self->time, next * 1000);
+      gsm_timer_wheel_advance (&self->timers, next);
+    }
+
+  self->time = time;
+  gsm_timer_wheel_advance (&self->timers, time / 1000);
+}
+
+/**
+ * gsm_clock_advance:
+ * @clock: a virtual #GsmClock
+ * @delta: the time in microseconds to move forward
+ *
+ * See gsm_clock_advance_to().
+ */
+void
+gsm_clock_advance (GsmClock *clock,
+                   gint64    delta)
+{
+  g_return_if_fail (GSM_IS_CLOCK (clock));
+  g_return_if_fail (delta >= 0);
+
+  gsm_clock_advance_to (clock, clock->time + delta);
+}
+
+void
+gsm_clock_add_timer (GsmClock *clock,
+                     GsmTimer *timer,
+                     gint64    deadline)
+{
+  g_assert (clock->virtual);
+
+  gsm_timer_wheel_add (&clock->timers, timer, (deadline + 999) / 1000);
+}
+
+void
+gsm_clock_remove_timer (GsmClock *clock,
+                        GsmTimer *timer)
+{
+  gsm_timer_wheel_remove (&clock->timers, timer);
+}
@@ -0,0 +1,43 @@
+/* gsm-clock.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GSM_TYPE_CLOCK (gsm_clock_get_type())
+
+G_DECLARE_FINAL_TYPE (GsmClock, gsm_clock, GSM, CLOCK, GObject)
+
+GsmClock        *gsm_clock_new                         (void);
+GsmClock        *gsm_clock_new_virtual                 (gint64            start_time);
+
+gboolean         gsm_clock_is_virtual                  (GsmClock         *clock);
+gint64           gsm_clock_get_time                    (GsmClock         *clock);
+gint64           gsm_clock_get_next_deadline           (GsmClock         *clock);
+
+void             gsm_clock_advance                     (GsmClock         *clock,
+                                                        gint64            delta);
+void             gsm_clock_advance_to                  (GsmClock         *clock,
+                                                        gint64            time);
+
+G_END_DECLS
@@ -0,0 +1,244 @@
+/* gsm-definition-private.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-state-machine.h"
+#include "gsm-instance.h"
+#include "gsm-bitset.h"
+
+G_BEGIN_DECLS
+
+/* The internals of GsmStateMachineDefinition, shared by the GObject
+ * wrapper (which also builds definitions) and GsmInstance. */
+
+typedef struct _GsmStateMachineState GsmStateMachineState;
+
+/* Everything that describes the machine, it is shared between all
+ * machines created from the same definition and must not be modified
+ * once sealed (the compiled transition tables included). */
+struct _GsmStateMachineDefinition
+{
+  gint        ref_count;
+  gboolean    sealed;
+
+  GType       state_type;
+
+  GArray     *events;
+  GHashTable *event_indices;
+  GPtrArray  *input_conditions;
+
+  GArray     *condition_quarks;
+  GHashTable *condition_indices;
+
+  GHashTable *inputs;
+  GPtrArray  *inputs_by_id;
+  GHashTable *outputs;
+  GPtrArray  *outputs_by_id;
+  GArray     *outputs_quark;
+
+  GHashTable *states;
+  GsmStateMachineState *all_state;
+  gint        last_group;
+  gboolean    compiled;
+
+  /* Created when sealing, copied by gsm_instance_new() */
+  GsmInstance *instance_template;
+};
+
+/* An input condition with one or more virtual conditions */
+typedef struct
+{
+  GsmConditionType type;
+  GsmConditionFunc getter;
+
+  /* Position in the definition's input_conditions */
+  guint  idx;
+  GQuark input;
+  guint  input_idx;
+  GArray *conditions;
+  GArray *conditions_neg;
+
+  /* Dense index of conditions[0]; conditions[j] has the index
+   * first_index + 2 * j and conditions_neg[j] the one following it. */
+  guint    first_index;
+
+  /* For default enum conditions, maps enum value - enum_min to the index
+   * into conditions (or -1 for holes); replaces the getter. */
+  gint    *enum_table;
+  gint     enum_min;
+  guint    enum_table_len;
+
+  /* For threshold conditions, the sorted threshold of each condition;
+   * replaces the getter. */
+  gdouble *thresholds;
+  gdouble  hysteresis;
+} GsmStateMachineCondition;
+
+/* The per machine state of a GsmStateMachineCondition */
+typedef struct
+{
+  /* Result of the last getter call, its expansion is in active_conditions */
+  gboolean evaluated;
+  GQuark   active;
+
+  /* For threshold conditions, the number of thresholds that the value is
+   * above (GEQ: or equal to) after applying the hysteresis. */
+  guint    level;
+} GsmStateMachineConditionState;
+
+/* A value in the inputs/outputs dictionaries. The definition holds one
+ * with the default value for each input and output; each machine has a
+ * copy for every input that borrows the pspec and conditions. */
+typedef struct
+{
+  guint         idx;
+  GQuark        name;
+  GParamSpec   *pspec;
+  GValue        value;
+
+  /* Only used for inputs; the conditions that need to be re-evaluated
+   * when the value changes (the conditions are not owned). */
+  GPtrArray    *conditions;
+  gboolean      dirty;
+
+  /* Only used for inputs; changes up to the tolerance are ignored. */
+  gdouble       tolerance;
+  guint64       n_suppressed;
+
+  /* Only used for inputs; changed within the current batched update. */
+  gboolean      changed;
+} GsmStateMachineValue;
+
+/* An output value of a state, either a constant or mapped to an input
+ * (if input is not -1). */
+typedef struct
+{
+  GValue        value;
+  gint          input;
+} GsmStateMachineOutputValue;
+
+static inline gboolean
+_value_type_is_numeric (GType type)
+{
+  switch (G_TYPE_FUNDAMENTAL (type))
+    {
+    case G_TYPE_INT:
+    case G_TYPE_UINT:
+    case G_TYPE_LONG:
+    case G_TYPE_ULONG:
+    case G_TYPE_INT64:
+    case G_TYPE_UINT64:
+    case G_TYPE_FLOAT:
+    case G_TYPE_DOUBLE:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static inline gdouble
+_value_get_number (const GValue *value)
+{
+  switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value)))
+    {
+    case G_TYPE_INT:
+      return g_value_get_int (value);
+    case G_TYPE_UINT:
+      return g_value_get_uint (value);
+    case G_TYPE_LONG:
+      return g_value_get_long (value);
+    case G_TYPE_ULONG:
+      return g_value_get_ulong (value);
+    case G_TYPE_INT64:
+      return g_value_get_int64 (value);
+    case G_TYPE_UINT64:
+      return g_value_get_uint64 (value);
+    case G_TYPE_FLOAT:
+      return g_value_get_float (value);
+    case G_TYPE_DOUBLE:
+      return g_value_get_double (value);
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+typedef struct
+{
+  gint    target_state;
+
+  GQuark event;
+  GsmBitset *conditions;
+
+  /* Time in milliseconds the state needs to be active, 0 if not timed */
+  guint  timeout;
+} GsmStateMachineTransition;
+
+struct _GsmStateMachineState
+{
+  GsmStateMachineState *parent;
+  GsmStateMachineState *leader;
+  GPtrArray            *all_children;
+
+  gint          value;
+  GQuark        nick;
+
+  /* GsmStateMachineOutputValue per output (or NULL if unset), owned by
+   * owned_values. */
+  GPtrArray    *outputs;
+  GPtrArray    *owned_values;
+
+  GPtrArray    *transitions;
+
+  /* Filled in by gsm_state_machine_definition_compile (). The leaf state that
+   * is entered in place of this one, and for leaf states, the transitions
+   * of the state and all its parents in the order they are checked. */
+  GsmStateMachineState *real;
+  GArray               *compiled;
+
+  /* The table is bucketed by event, bucket 0 has the transitions without
+   * an event and bucket i + 1 the ones for event i. Bucket b is the range
+   * compiled_offsets[b] up to compiled_offsets[b + 1]. */
+  guint                *compiled_offsets;
+
+  /* The inputs used by any of the compiled transitions; changes to other
+   * inputs cannot cause a transition while in this state. */
+  GsmBitset            *sensitive_inputs;
+};
+
+/* An entry of the flattened transition table of a leaf state */
+typedef struct
+{
+  const GsmBitset      *conditions;
+
+  GsmStateMachineState *target;
+  GsmStateMachineState *real_target;
+  guint                 timeout;
+} GsmStateMachineCompiledTransition;
+
+void             gsm_state_machine_definition_compile  (GsmStateMachineDefinition *definition);
+gboolean         gsm_state_machine_value_validate      (GParamSpec                *pspec,
+                                                        const GValue              *value);
+gboolean         gsm_state_machine_value_validate_integer (GParamSpec             *pspec,
+                                                           gint64                  value);
+gboolean         gsm_state_machine_value_validate_double (GParamSpec              *pspec,
+                                                          gdouble                  value);
+
+G_END_DECLS
@@ -0,0 +1,513 @@
+/* gsm-executor.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gsm-executor.h"
+#include "gsm-timer-wheel.h"
+
+/**
+ * SECTION:gsm-executor
+ * @short_description: Settles many instances on a pool of threads
+ *
+ * A #GsmExecutor owns a pool of worker threads and a set of #GsmInstance
+ * objects. Every instance belongs to the shard of one worker, which keeps
+ * the run queue and the timers of its instances. gsm_executor_run() settles
+ * all queued instances and all instances with an expired timeout edge; a
+ * worker that runs out of work steals half of the remaining queue of
+ * another one.
+ *
+ * An instance is only ever in one run queue and is stepped by a single
+ * thread at a time, but not always by the same thread. The callbacks of the
+ * instances are invoked from the worker threads while gsm_executor_run()
+ * blocks. In between runs the instances belong to the thread that calls
+ * gsm_executor_run(): it may set inputs, handle events and then use
+ * gsm_executor_queue() to have them settled in the next run.
+ */
+
+/* Number of instances a worker takes from its queue at once */
+#define CHUNK_SIZE 32
+
+typedef struct _GsmExecutorWorker GsmExecutorWorker;
+
+typedef struct
+{
+  GsmExecutor *executor;
+  GsmInstance *instance;
+  guint        shard;
+  /* Protected by the mutex of the shard */
+  gboolean     queued;
+  GsmTimer     timer;
+} GsmExecutorEntry;
+
+struct _GsmExecutorWorker
+{
+  GsmExecutor  *executor;
+  guint         index;
+  GThread      *thread;
+  guint         generation;
+
+  /* Protects the queue and the timers; the instances of other shards are
+   * added to the queue when stolen. Queued entries are at pdata[head] up to
+   * the end, the owner takes them from the front and thieves from the back. */
+  GMutex        mutex;
+  GPtrArray    *queue;
+  guint         head;
+  GsmTimerWheel timers;
+
+  /* Only used by the worker itself during a run */
+  GPtrArray    *stolen;
+  guint         n_settled;
+  guint64       n_stolen;
+};
+
+struct _GsmExecutor
+{
+  guint              n_workers;
+  GsmExecutorWorker *workers;
+  GPtrArray         *entries;
+  gboolean           running;
+
+  /* Hands runs to the workers and waits for them to finish */
+  GMutex             mutex;
+  GCond              wake;
+  GCond              done;
+  guint              generation;
+  guint              n_busy;
+  gint64             now;
+  gboolean           quit;
+};
+
+static void
+_executor_queue_entry (GsmExecutor      *executor,
+                       GsmExecutorEntry *entry)
+{
+  GsmExecutorWorker *worker = &executor->workers[entry->shard];
+
+  g_mutex_lock (&worker->mutex);
+  if (!entry->queued)
+    {
+      entry->queued = TRUE;
+      g_ptr_array_add (worker->queue, entry);
+    }
+  g_mutex_unlock (&worker->mutex);
+}
+
+static void
+_entry_timeout_cb (gpointer user_data)
+{
+  GsmExecutorEntry *entry = user_data;
+
+  _executor_queue_entry (entry->executor, entry);
+}
+
+static guint
+_worker_pop (GsmExecutorWorker  *worker,
+             GsmExecutorEntry  **chunk)
+{
+  guint n;
+
+  g_mutex_lock (&worker->mutex);
+
+  n = MIN (worker->queue->len - worker->head, CHUNK_SIZE);
+  for (guint i = 0; i < n; i++)
+    chunk[i] = g_ptr_array_index (worker->queue, worker->head + i);
+  worker->head += n;
+
+  if (worker->head == worker->queue->len)
+    {
+      g_ptr_array_set_size (worker->queue, 0);
+      worker->head = 0;
+    }
+
+  g_mutex_unlock (&worker->mutex);
+
+  return n;
+}
+
+/* Moves half of the queue of the first other worker that has one into the
+ * own (empty) queue. The locks are never held at the same time. */
+static gboolean
+_worker_steal (GsmExecutorWorker *worker)
+{
+  GsmExecutor *executor = worker->executor;
+
+  for (guint offset = 1; offset < executor->n_workers; offset++)
+    {
+      GsmExecutorWorker *victim = &executor->workers[(worker->index + offset) % executor->n_workers];
+      guint n;
+
+      g_mutex_lock (&victim->mutex);
+      n = (victim->queue->len - victim->head + 1) / 2;
+      for (guint i = victim->queue->len - n; i < victim->queue->len; i++)
+        g_ptr_array_add (worker->stolen, g_ptr_array_index (victim->queue, i));
+      g_ptr_array_set_size (victim->queue, victim->queue->len - n);
+      g_mutex_unlock (&victim->mutex);
+
+      if (n == 0)
+        continue;
+
+      g_mutex_lock (&worker->mutex);
+      for (guint i = 0; i < worker->stolen->len; i++)
+        g_ptr_array_add (worker->queue, g_ptr_array_index (worker->stolen, i));
+      g_mutex_unlock (&worker->mutex);
+
+      g_ptr_array_set_size (worker->stolen, 0);
+      worker->n_stolen += n;
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+_worker_settle (GsmExecutorWorker *worker,
+                GsmExecutorEntry  *entry,
+                gint64             now)
+{
+  GsmExecutorWorker *home = &worker->executor->workers[entry->shard];
+  gint64 deadline;
+
+  /* Instances that did not settle within the step budget are continued in
+   * the next run, just like GsmStateMachine does in the next update. */
+  if (gsm_instance_settle (entry->instance, now, 0))
+    deadline = gsm_instance_get_next_deadline (entry->instance, now);
+  else
+    deadline = now;
+
+  g_mutex_lock (&home->mutex);
+
+  gsm_timer_wheel_remove (&home->timers, &entry->timer);
+  if (deadline != G_MAXINT64)
+    gsm_timer_wheel_add (&home->timers, &entry->timer, (deadline + 999) / 1000);
+  entry->queued = FALSE;
+
+  g_mutex_unlock (&home->mutex);
+}
+
+static void
+_worker_run (GsmExecutorWorker *worker,
+             gint64             now)
+{
+  GsmExecutorEntry *chunk[CHUNK_SIZE];
+
+  while (TRUE)
+    {
+      guint n = _worker_pop (worker, chunk);
+
+      if (n == 0)
+        {
+          /* Nothing is queued while running, so once stealing fails too
+           * all remaining work is in progress on other workers. */
+          if (_worker_steal (worker))
+            continue;
+
+          break;
+        }
+
+      for (guint i = 0; i < n; i++)
+        _worker_settle (worker, chunk[i], now);
+
+      worker->n_settled += n;
+    }
+}
+
+static gpointer
+_worker_thread (gpointer user_data)
+{
+  GsmExecutorWorker *worker = user_data;
+  GsmExecutor *executor = worker->executor;
+
+  g_mutex_lock (&executor->mutex);
+
+  while (TRUE)
+    {
+      gint64 now;
+
+      while (worker->generation == executor->generation && !executor->quit)
+        g_cond_wait (&executor->wake, &executor->mutex);
+
+      if (executor->quit)
+        break;
+
+      worker->generation = executor->generation;
+      now = executor->now;
+
+      g_mutex_unlock (&executor->mutex);
+      _worker_run (worker, now);
+      g_mutex_lock (&executor->mutex);
+
+      executor->n_busy -= 1;
+      if (executor->n_busy == 0)
+        g_cond_signal (&executor->done);
+    }
+
+  g_mutex_unlock (&executor->mutex);
+
+  return NULL;
+}
+
+/**
+ * gsm_executor_new:
+ * @n_threads: the number of worker threads, or 0 for one per processor
+ * @now: the current time, in the same time base as gsm_executor_run()
+ *
+ * Returns: (transfer full): a new #GsmExecutor
+ */
+GsmExecutor*
+gsm_executor_new (guint  n_threads,
+                  gint64 now)
+{
+  GsmExecutor *executor;
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  executor = g_new0 (GsmExecutor, 1);
+  executor->n_workers = n_threads;
+  executor->workers = g_new0 (GsmExecutorWorker, n_threads);
+  executor->entries = g_ptr_array_new ();
+
+  g_mutex_init (&executor->mutex);
+  g_cond_init (&executor->wake);
+  g_cond_init (&executor->done);
+
+  for (guint i = 0; i < n_threads; i++)
+    {
+      GsmExecutorWorker *worker = &executor->workers[i];
+      g_autofree gchar *name = g_strdup_printf ("gsm-executor-%u", i);
+
+      worker->executor = executor;
+      worker->index = i;
+      g_mutex_init (&worker->mutex);
+      worker->queue = g_ptr_array_new ();
+      worker->stolen = g_ptr_array_new ();
+      gsm_timer_wheel_init (&worker->timers, now / 1000);
+
+      worker->thread = g_thread_new (name, _worker_thread, worker);
+    }
+
+  return executor;
+}
+
+/**
+ * gsm_executor_free:
+ * @executor: a #GsmExecutor
+ *
+ * Stops the worker threads and frees the executor and all its instances.
+ */
+void
+gsm_executor_free (GsmExecutor *executor)
+{
+  g_return_if_fail (executor != NULL);
+  g_return_if_fail (!executor->running);
+
+  g_mutex_lock (&executor->mutex);
+  executor->quit = TRUE;
+  g_cond_broadcast (&executor->wake);
+  g_mutex_unlock (&executor->mutex);
+
+  for (guint i = 0; i < executor->n_workers; i++)
+    {
+      GsmExecutorWorker *worker = &executor->workers[i];
+
+      g_thread_join (worker->thread);
+      gsm_timer_wheel_clear (&worker->timers);
+      g_ptr_array_unref (worker->queue);
+      g_ptr_array_unref (worker->stolen);
+      g_mutex_clear (&worker->mutex);
+    }
+
+  for (guint i = 0; i < executor->entries->len; i++)
+    {
+      GsmExecutorEntry *entry = g_ptr_array_index (executor->entries, i);
+
+      gsm_instance_free (entry->instance);
+      g_free (entry);
+    }
+  g_ptr_array_unref (executor->entries);
+
+  g_cond_clear (&executor->done);
+  g_cond_clear (&executor->wake);
+  g_mutex_clear (&executor->mutex);
+  g_free (executor->workers);
+
+  g_free (executor);
+}
+
+guint
+gsm_executor_get_n_threads (GsmExecutor *executor)
+{
+  g_return_val_if_fail (executor != NULL, 0);
+
+  return executor->n_workers;
+}
+
+guint
+gsm_executor_get_n_instances (GsmExecutor *executor)
+{
+  g_return_val_if_fail (executor != NULL, 0);
+
+  return executor->entries->len;
+}
+
+/**
+ * gsm_executor_add:
+ * @executor: a #GsmExecutor
+ * @instance: (transfer full): the instance to add
+ *
+ * Adds the instance to the shard of one of the workers and queues it, so it
+ * is settled in the next run.
+ *
+ * Returns: the id of the instance within the executor
+ */
+guint
+gsm_executor_add (GsmExecutor *executor,
+                  GsmInstance *instance)
+{
+  GsmExecutorEntry *entry;
+  guint id;
+
+  g_return_val_if_fail (executor != NULL, 0);
+  g_return_val_if_fail (instance != NULL, 0);
+  g_return_val_if_fail (!executor->running, 0);
+
+  id = executor->entries->len;
+
+  entry = g_new0 (GsmExecutorEntry, 1);
+  entry->executor = executor;
+  entry->instance = instance;
+  entry->shard = id % executor->n_workers;
+  gsm_timer_init (&entry->timer, _entry_timeout_cb, entry);
+  g_ptr_array_add (executor->entries, entry);
+
+  _executor_queue_entry (executor, entry);
+
+  return id;
+}
+
+/**
+ * gsm_executor_get_instance:
+ * @executor: a #GsmExecutor
+ * @id: the id returned by gsm_executor_add()
+ *
+ * The instance must not be used while gsm_executor_run() is running.
+ *
+ * Returns: (transfer none): the instance
+ */
+GsmInstance*
+gsm_executor_get_instance (GsmExecutor *executor,
+                           guint        id)
+{
+  GsmExecutorEntry *entry;
+
+  g_return_val_if_fail (executor != NULL, NULL);
+  g_return_val_if_fail (id < executor->entries->len, NULL);
+
+  entry = g_ptr_array_index (executor->entries, id);
+
+  return entry->instance;
+}
+
+/**
+ * gsm_executor_queue:
+ * @executor: a #GsmExecutor
+ * @id: the id returned by gsm_executor_add()
+ *
+ * Queues the instance to be settled in the next run, after its inputs were
+ * changed or an event was handled. Queuing it again does nothing.
+ */
+void
+gsm_executor_queue (GsmExecutor *executor,
+                    guint        id)
+{
+  g_return_if_fail (executor != NULL);
+  g_return_if_fail (id < executor->entries->len);
+  g_return_if_fail (!executor->running);
+
+  _executor_queue_entry (executor, g_ptr_array_index (executor->entries, id));
+}
+
+/**
+ * gsm_executor_run:
+ * @executor: a #GsmExecutor
+ * @now: the current time
+ *
+ * Settles the queued instances and the ones with an expired timeout edge on
+ * the worker threads and waits for all of them to be done.
+ *
+ * Returns: the number of instances that were settled
+ */
+guint
+gsm_executor_run (GsmExecutor *executor,
+                  gint64       now)
+{
+  guint n_settled = 0;
+
+  g_return_val_if_fail (executor != NULL, 0);
+  g_return_val_if_fail (!executor->running, 0);
+
+  executor->running = TRUE;
+
+  /* The workers are idle, so the expired timers of all shards can be
+   * queued from here. */
+  for (guint i = 0; i < executor->n_workers; i++)
+    gsm_timer_wheel_advance (&executor->workers[i].timers, now / 1000);
+
+  g_mutex_lock (&executor->mutex);
+  executor->now = now;
+  executor->generation += 1;
+  executor->n_busy = executor->n_workers;
+  g_cond_broadcast (&executor->wake);
+
+  while (executor->n_busy > 0)
+    g_cond_wait (&executor->done, &executor->mutex);
+  g_mutex_unlock (&executor->mutex);
+
+  for (guint i = 0; i < executor->n_workers; i++)
+    {
+      n_settled += executor->workers[i].n_settled;
+      executor->workers[i].n_settled = 0;
+    }
+
+  executor->running = FALSE;
+
+  return n_settled;
+}
+
+/**
+ * gsm_executor_get_n_stolen:
+ * @executor: a #GsmExecutor
+ *
+ * Returns: the number of instances that were moved to the queue of another
+ *   worker by stealing so far
+ */
+guint64
+gsm_executor_get_n_stolen (GsmExecutor *executor)
+{
+  guint64 n_stolen = 0;
+
+  g_return_val_if_fail (executor != NULL, 0);
+  g_return_val_if_fail (!executor->running, 0);
+
+  for (guint i = 0; i < executor->n_workers; i++)
+    n_stolen += executor->workers[i].n_stolen;
+
+  return n_stolen;
+}
@@ -0,0 +1,50 @@
+/* gsm-executor.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-instance.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsmExecutor GsmExecutor;
+
+GsmExecutor     *gsm_executor_new                      (guint             n_threads,
+                                                        gint64            now);
+void             gsm_executor_free                     (GsmExecutor      *executor);
+
+guint            gsm_executor_get_n_threads            (GsmExecutor      *executor);
+guint            gsm_executor_get_n_instances          (GsmExecutor      *executor);
+
+guint            gsm_executor_add                      (GsmExecutor      *executor,
+                                                        GsmInstance      *instance);
+GsmInstance     *gsm_executor_get_instance             (GsmExecutor      *executor,
+                                                        guint             id);
+void             gsm_executor_queue                    (GsmExecutor      *executor,
+                                                        guint             id);
+
+guint            gsm_executor_run                      (GsmExecutor      *executor,
+                                                        gint64            now);
+
+guint64          gsm_executor_get_n_stolen             (GsmExecutor      *executor);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsmExecutor, gsm_executor_free)
+
+G_END_DECLS
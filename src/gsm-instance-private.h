@@ -0,0 +1,77 @@
+/* gsm-instance-private.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-instance.h"
+#include "gsm-definition-private.h"
+
+G_BEGIN_DECLS
+
+struct _GsmInstance
+{
+  GsmStateMachineDefinition  *def;
+  const GsmInstanceCallbacks *callbacks;
+  gpointer                    user_data;
+
+  GsmStateMachineState       *current_state;
+  /* Time at which the current state was entered */
+  gint64                      state_entered;
+
+  /* Both point into the same allocation, right behind the struct */
+  GsmStateMachineConditionState *condition_states;
+  GsmBitset                  *active_conditions;
+};
+
+/* Used by GsmStateMachine, which keeps the input values, events and
+ * outputs and emits signals instead of calling the callbacks. Unlike the
+ * public constructor these work on definitions that are not sealed yet
+ * and nothing is evaluated initially. */
+GsmInstance     *gsm_instance_internal_new             (GsmStateMachineDefinition *definition);
+GsmInstance     *gsm_instance_internal_resize          (GsmInstance      *instance);
+GsmInstance     *gsm_instance_internal_new_template    (GsmStateMachineDefinition *definition);
+
+GsmStateMachineValue *
+                 gsm_instance_internal_typed_input     (GsmStateMachineDefinition *definition,
+                                                        gint                       input,
+                                                        GType                      fundamental);
+
+void             gsm_instance_internal_evaluate        (GsmInstance              *instance,
+                                                        GsmStateMachineCondition *condition,
+                                                        const GValue             *value);
+void             gsm_instance_internal_evaluate_condition (GsmStateMachineCondition      *condition,
+                                                           GsmStateMachineConditionState *state,
+                                                           const GValue                  *value,
+                                                           GsmBitset                     *active_conditions);
+
+/* @event is the bucket, i.e. 0 or the event id plus one. @elapsed is the
+ * time in microseconds the state has been active. */
+const GsmStateMachineCompiledTransition *
+                 gsm_instance_internal_find_transition (const GsmBitset      *active_conditions,
+                                                        GsmStateMachineState *state,
+                                                        guint                 event,
+                                                        gint64                elapsed);
+gboolean         gsm_instance_internal_is_transient    (const GsmBitset      *active_conditions,
+                                                        GsmStateMachineState *state);
+gboolean         gsm_instance_internal_next_deadline   (GsmInstance          *instance,
+                                                        gint64                elapsed,
+                                                        gint64               *deadline);
+
+G_END_DECLS
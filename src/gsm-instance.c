@@ -0,0 +1,786 @@
+/* gsm-instance.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <string.h>
+
+#include "gsm-instance-private.h"
+
+/**
+ * SECTION:gsm-instance
+ * @short_description: Lightweight execution of a machine definition
+ *
+ * A #GsmInstance executes a sealed #GsmStateMachineDefinition (see
+ * gsm_state_machine_get_definition()) without any of the GObject
+ * machinery. It is a single allocation holding the current state, the time
+ * it was entered and the result of each condition, so millions of them can
+ * be kept alive at once. #GsmStateMachine uses the same engine internally.
+ *
+ * Instances are driven synchronously by the caller: inputs are evaluated
+ * when they are set, transitions are only done by gsm_instance_step(),
+ * gsm_instance_settle() and gsm_instance_handle_event(), and state changes
+ * are reported through a #GsmInstanceCallbacks table. Input values are not
+ * stored, so there is no tolerance, no change suppression and no outputs;
+ * events are not queued and timers are left to the caller, see
+ * gsm_instance_get_next_deadline(). All times are in microseconds in a time
+ * base of the caller's choosing.
+ *
+ * An instance must not be used from multiple threads at the same time.
+ */
+
+#define DEFAULT_MAX_STEPS 32
+
+static inline void
+_condition_set_state (GsmStateMachineCondition *condition, guint j, gboolean state, GsmBitset *target)
+{
+  guint index = condition->first_index + 2 * j;
+
+  if (state)
+    {
+      gsm_bitset_set (target, index);
+      gsm_bitset_unset (target, index + 1);
+    }
+  else
+    {
+      gsm_bitset_unset (target, index);
+      gsm_bitset_set (target, index + 1);
+    }
+}
+
+/* active_idx may be -1 or the number of conditions if no condition is
+ * active, which is only possible for threshold conditions. */
+static void
+_condition_expand_positive_index (gint active_idx, GsmStateMachineCondition *condition, GsmBitset *target)
+{
+  gboolean lesser, greater;
+
+  switch (condition->type)
+    {
+    case GSM_CONDITION_TYPE_EQ:
+      lesser = FALSE;
+      greater = FALSE;
+      break;
+    case GSM_CONDITION_TYPE_GEQ:
+      lesser = TRUE;
+      greater = FALSE;
+      break;
+    case GSM_CONDITION_TYPE_LEQ:
+      lesser = FALSE;
+      greater = TRUE;
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  g_assert (active_idx >= -1 && active_idx <= (gint) condition->conditions->len);
+
+  for (gint j = 0; j < condition->conditions->len; j++)
+    {
+      gboolean cond_state;
+
+      if (j == active_idx)
+        cond_state = TRUE;
+      else if (j > active_idx)
+        cond_state = greater;
+      else
+        cond_state = lesser;
+
+      _condition_set_state (condition, j, cond_state, target);
+    }
+}
+
+/* Used for invalid values, none of the conditions is active */
+static void
+_condition_expand_none (GsmStateMachineCondition *condition, GsmBitset *target)
+{
+  for (guint j = 0; j < condition->conditions->len; j++)
+    _condition_set_state (condition, j, FALSE, target);
+}
+
+static void
+_condition_expand_positive (GQuark active, GsmStateMachineCondition *condition, GsmBitset *target)
+{
+  /* Active may be 0 if this is a boolean (i.e. only one value), in which case it means
+   * it is the negated value, or if the value is invalid; do a direct exit */
+  if (active == 0)
+    {
+      _condition_expand_none (condition, target);
+      return;
+    }
+
+  for (guint j = 0; j < condition->conditions->len; j++)
+    {
+      if (g_array_index (condition->conditions, GQuark, j) == active)
+        {
+          _condition_expand_positive_index (j, condition, target);
+          return;
+        }
+    }
+
+  g_assert_not_reached ();
+}
+
+/* Number of thresholds below @value (GEQ: or equal to it) */
+static guint
+_condition_threshold_count (GsmStateMachineCondition *condition, gdouble value)
+{
+  guint lo = 0;
+  guint hi = condition->conditions->len;
+
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+      gdouble threshold = condition->thresholds[mid];
+
+      if (threshold < value || (condition->type == GSM_CONDITION_TYPE_GEQ && threshold == value))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/* Levels go up as soon as a threshold is crossed, but only go down again
+ * once the value is below the threshold by more than the hysteresis. */
+static guint
+_condition_threshold_level (GsmStateMachineCondition      *condition,
+                            GsmStateMachineConditionState *state,
+                            gdouble                        value)
+{
+  guint level = _condition_threshold_count (condition, value);
+
+  if (!state->evaluated || level >= state->level || condition->hysteresis <= 0.0)
+    return level;
+
+  return MIN (state->level, _condition_threshold_count (condition, value + condition->hysteresis));
+}
+
+/* The condition states and the active set follow the struct, the size of
+ * the condition states is rounded up to keep the bitset aligned. */
+static gsize
+_instance_size (GsmStateMachineDefinition *def,
+                gsize                     *states_size)
+{
+  guint n_words = GSM_BITSET_N_WORDS (def->condition_quarks->len);
+
+  *states_size = def->input_conditions->len * sizeof (GsmStateMachineConditionState);
+  *states_size = (*states_size + sizeof (guint64) - 1) & ~(sizeof (guint64) - 1);
+
+  return sizeof (GsmInstance) + *states_size + sizeof (GsmBitset) + n_words * sizeof (guint64);
+}
+
+static void
+_instance_layout (GsmInstance *instance,
+                  gsize        states_size)
+{
+  instance->condition_states = (GsmStateMachineConditionState *) (instance + 1);
+  instance->active_conditions = (GsmBitset *) ((guint8 *) instance->condition_states + states_size);
+}
+
+/* Does not take a reference on the definition */
+static GsmInstance*
+_instance_alloc (GsmStateMachineDefinition *def)
+{
+  GsmInstance *res;
+  gsize states_size;
+
+  res = g_malloc0 (_instance_size (def, &states_size));
+  _instance_layout (res, states_size);
+  res->active_conditions->n_words = GSM_BITSET_N_WORDS (def->condition_quarks->len);
+  res->def = def;
+  res->current_state = def->all_state->leader;
+
+  return res;
+}
+
+GsmInstance*
+gsm_instance_internal_new (GsmStateMachineDefinition *definition)
+{
+  GsmInstance *res = _instance_alloc (definition);
+
+  gsm_state_machine_definition_ref (definition);
+
+  return res;
+}
+
+/* Conditions were added to the definition, new conditions are not
+ * evaluated yet. */
+GsmInstance*
+gsm_instance_internal_resize (GsmInstance *instance)
+{
+  GsmInstance *res = _instance_alloc (instance->def);
+
+  res->callbacks = instance->callbacks;
+  res->user_data = instance->user_data;
+  res->current_state = instance->current_state;
+  res->state_entered = instance->state_entered;
+
+  memcpy (res->condition_states, instance->condition_states,
+          (guint8 *) instance->active_conditions - (guint8 *) instance->condition_states);
+  memcpy (res->active_conditions->words, instance->active_conditions->words,
+          instance->active_conditions->n_words * sizeof (guint64));
+
+  g_free (instance);
+
+  return res;
+}
+
+/* The instance that gsm_instance_new() copies, i.e. with all conditions
+ * evaluated for the default input values. Owned by the definition, so it
+ * does not hold a reference and is freed using g_free(). */
+GsmInstance*
+gsm_instance_internal_new_template (GsmStateMachineDefinition *definition)
+{
+  GsmInstance *res = _instance_alloc (definition);
+
+  for (guint i = 0; i < definition->input_conditions->len; i++)
+    {
+      GsmStateMachineCondition *condition = g_ptr_array_index (definition->input_conditions, i);
+      GsmStateMachineValue *input_value = g_ptr_array_index (definition->inputs_by_id, condition->input_idx);
+
+      gsm_instance_internal_evaluate (res, condition, &input_value->value);
+    }
+
+  return res;
+}
+
+/* Each condition only touches its own bits in the active set */
+void
+gsm_instance_internal_evaluate_condition (GsmStateMachineCondition      *condition,
+                                          GsmStateMachineConditionState *state,
+                                          const GValue                  *value,
+                                          GsmBitset                     *active_conditions)
+{
+  GQuark active;
+
+  if (condition->thresholds)
+    {
+      guint level;
+
+      level = _condition_threshold_level (condition, state, _value_get_number (value));
+      if (state->evaluated && state->level == level)
+        return;
+
+      state->evaluated = TRUE;
+      state->level = level;
+      /* GEQ: highest threshold <= value, LEQ: lowest threshold >= value */
+      _condition_expand_positive_index (condition->type == GSM_CONDITION_TYPE_GEQ ? (gint) level - 1 : (gint) level,
+                                        condition, active_conditions);
+      return;
+    }
+
+  if (condition->enum_table)
+    {
+      guint offset = (guint) g_value_get_enum (value) - (guint) condition->enum_min;
+      gint idx = offset < condition->enum_table_len ? condition->enum_table[offset] : -1;
+
+      /* Values outside of the enum are not valid for the pspec */
+      if (idx < 0)
+        {
+          g_critical ("Value %d is not part of the enum of input \"%s\"",
+                      g_value_get_enum (value), g_quark_to_string (condition->input));
+
+          if (state->evaluated && state->active == 0)
+            return;
+
+          state->evaluated = TRUE;
+          state->active = 0;
+          _condition_expand_none (condition, active_conditions);
+          return;
+        }
+
+      active = g_array_index (condition->conditions, GQuark, idx);
+      if (state->evaluated && state->active == active)
+        return;
+
+      state->evaluated = TRUE;
+      state->active = active;
+      _condition_expand_positive_index (idx, condition, active_conditions);
+      return;
+    }
+
+  active = condition->getter (condition->input, condition->type, value);
+  if (state->evaluated && state->active == active)
+    return;
+
+  state->evaluated = TRUE;
+  state->active = active;
+  _condition_expand_positive (active, condition, active_conditions);
+}
+
+void
+gsm_instance_internal_evaluate (GsmInstance              *instance,
+                                GsmStateMachineCondition *condition,
+                                const GValue             *value)
+{
+  gsm_instance_internal_evaluate_condition (condition, &instance->condition_states[condition->idx],
+                                            value, instance->active_conditions);
+}
+
+const GsmStateMachineCompiledTransition*
+gsm_instance_internal_find_transition (const GsmBitset      *active_conditions,
+                                       GsmStateMachineState *state,
+                                       guint                 event,
+                                       gint64                elapsed)
+{
+  guint end = state->compiled_offsets[event + 1];
+
+  /* Only the bucket of the event is relevant */
+  for (guint i = state->compiled_offsets[event]; i < end; i++)
+    {
+      const GsmStateMachineCompiledTransition *item = &g_array_index (state->compiled, GsmStateMachineCompiledTransition, i);
+
+      /* Timed transitions are sorted, so none of the others can match */
+      if ((gint64) item->timeout * 1000 > elapsed)
+        break;
+
+      /* The active set is always at least as wide as any transition */
+      if (gsm_bitset_is_subset (active_conditions, item->conditions))
+        return item;
+    }
+
+  return NULL;
+}
+
+/* Whether the state will be left again right away with the current
+ * conditions. Events are only processed once the machine is stable, so
+ * they are not relevant here. */
+gboolean
+gsm_instance_internal_is_transient (const GsmBitset      *active_conditions,
+                                    GsmStateMachineState *state)
+{
+  const GsmStateMachineCompiledTransition *transition;
+
+  transition = gsm_instance_internal_find_transition (active_conditions, state, 0, 0);
+
+  return transition && transition->real_target != state;
+}
+
+/* Gets the expiry of the shortest timed transition of the current state
+ * that has not elapsed yet (they are at the end of bucket 0). Any time can
+ * be a deadline, so this returns FALSE if there is none. */
+gboolean
+gsm_instance_internal_next_deadline (GsmInstance *instance,
+                                     gint64       elapsed,
+                                     gint64      *deadline)
+{
+  GsmStateMachineState *state = instance->current_state;
+
+  for (guint i = state->compiled_offsets[0]; i < state->compiled_offsets[1]; i++)
+    {
+      const GsmStateMachineCompiledTransition *item = &g_array_index (state->compiled, GsmStateMachineCompiledTransition, i);
+
+      if ((gint64) item->timeout * 1000 > elapsed)
+        {
+          *deadline = instance->state_entered + (gint64) item->timeout * 1000;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/**
+ * gsm_instance_new:
+ * @definition: a sealed #GsmStateMachineDefinition
+ * @callbacks: (nullable): the callbacks, must stay valid for the lifetime
+ *   of the instance
+ * @user_data: data passed to the callbacks
+ * @now: the current time, used as the time the initial state was entered
+ *
+ * Creates an instance in the initial state with all inputs at their default
+ * value. Nothing is reported for the initial state and the instance may not
+ * be stable yet, see gsm_instance_settle().
+ *
+ * Returns: (transfer full): a new #GsmInstance
+ */
+GsmInstance*
+gsm_instance_new (GsmStateMachineDefinition  *definition,
+                  const GsmInstanceCallbacks *callbacks,
+                  gpointer                    user_data,
+                  gint64                      now)
+{
+  GsmInstance *res;
+  gsize states_size;
+  gsize size;
+
+  g_return_val_if_fail (definition != NULL, NULL);
+  g_return_val_if_fail (definition->sealed, NULL);
+
+  size = _instance_size (definition, &states_size);
+  res = memcpy (g_malloc (size), definition->instance_template, size);
+  _instance_layout (res, states_size);
+
+  res->def = gsm_state_machine_definition_ref (definition);
+  res->callbacks = callbacks;
+  res->user_data = user_data;
+  res->state_entered = now;
+
+  return res;
+}
+
+void
+gsm_instance_free (GsmInstance *instance)
+{
+  g_return_if_fail (instance != NULL);
+
+  gsm_state_machine_definition_unref (instance->def);
+  g_free (instance);
+}
+
+/**
+ * gsm_instance_get_definition:
+ * @instance: a #GsmInstance
+ *
+ * Returns: (transfer none): the definition executed by @instance
+ */
+GsmStateMachineDefinition*
+gsm_instance_get_definition (GsmInstance *instance)
+{
+  g_return_val_if_fail (instance != NULL, NULL);
+
+  return instance->def;
+}
+
+gpointer
+gsm_instance_get_user_data (GsmInstance *instance)
+{
+  g_return_val_if_fail (instance != NULL, NULL);
+
+  return instance->user_data;
+}
+
+gint
+gsm_instance_get_state (GsmInstance *instance)
+{
+  g_return_val_if_fail (instance != NULL, 0);
+
+  return instance->current_state->value;
+}
+
+/* Checks that the input exists and is of the given fundamental type (if
+ * not G_TYPE_INVALID) */
+GsmStateMachineValue*
+gsm_instance_internal_typed_input (GsmStateMachineDefinition *definition,
+                                   gint                       input,
+                                   GType                      fundamental)
+{
+  GsmStateMachineValue *input_value;
+
+  if (input < 0 || input >= definition->inputs_by_id->len)
+    {
+      g_critical ("Input %d does not exist", input);
+      return NULL;
+    }
+
+  input_value = g_ptr_array_index (definition->inputs_by_id, input);
+  if (fundamental != G_TYPE_INVALID && G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (&input_value->value)) != fundamental)
+    {
+      g_critical ("Input %s is of type %s, not %s",
+                  g_quark_to_string (input_value->name),
+                  G_VALUE_TYPE_NAME (&input_value->value),
+                  g_type_name (fundamental));
+      return NULL;
+    }
+
+  return input_value;
+}
+
+/* The value has to be validated already */
+static void
+_instance_evaluate_input (GsmInstance          *instance,
+                          GsmStateMachineValue *input_value,
+                          const GValue         *value)
+{
+  for (guint i = 0; i < input_value->conditions->len; i++)
+    gsm_instance_internal_evaluate (instance, g_ptr_array_index (input_value->conditions, i), value);
+}
+
+/**
+ * gsm_instance_set_input_value:
+ * @instance: a #GsmInstance
+ * @input: the id of the input, see gsm_state_machine_lookup_input()
+ * @value: the new value
+ *
+ * Evaluates the conditions of the input for the new value. The value itself
+ * is not stored, so setting the same value again is cheap but not free.
+ */
+void
+gsm_instance_set_input_value (GsmInstance  *instance,
+                              gint          input,
+                              const GValue *value)
+{
+  GsmStateMachineValue *input_value;
+
+  g_return_if_fail (instance != NULL);
+
+  input_value = gsm_instance_internal_typed_input (instance->def, input, G_TYPE_INVALID);
+  if (!input_value)
+    return;
+
+  g_return_if_fail (G_VALUE_TYPE (value) == G_VALUE_TYPE (&input_value->value));
+
+  if (!gsm_state_machine_value_validate (input_value->pspec, value))
+    return;
+
+  _instance_evaluate_input (instance, input_value, value);
+}
+
+void
+gsm_instance_set_input_boolean (GsmInstance *instance,
+                                gint         input,
+                                gboolean     value)
+{
+  GsmStateMachineValue *input_value;
+  GValue gvalue = G_VALUE_INIT;
+
+  g_return_if_fail (instance != NULL);
+
+  input_value = gsm_instance_internal_typed_input (instance->def, input, G_TYPE_BOOLEAN);
+  if (!input_value)
+    return;
+
+  /* Checked without a GValue, which is only needed for the conditions */
+  if (!gsm_state_machine_value_validate_integer (input_value->pspec, !!value))
+    return;
+
+  if (input_value->conditions->len == 0)
+    return;
+
+  g_value_init (&gvalue, G_TYPE_BOOLEAN);
+  g_value_set_boolean (&gvalue, value);
+  _instance_evaluate_input (instance, input_value, &gvalue);
+}
+
+void
+gsm_instance_set_input_int (GsmInstance *instance,
+                            gint         input,
+                            gint         value)
+{
+  GsmStateMachineValue *input_value;
+  GValue gvalue = G_VALUE_INIT;
+
+  g_return_if_fail (instance != NULL);
+
+  input_value = gsm_instance_internal_typed_input (instance->def, input, G_TYPE_INT);
+  if (!input_value)
+    return;
+
+  if (!gsm_state_machine_value_validate_integer (input_value->pspec, value))
+    return;
+
+  if (input_value->conditions->len == 0)
+    return;
+
+  g_value_init (&gvalue, G_TYPE_INT);
+  g_value_set_int (&gvalue, value);
+  _instance_evaluate_input (instance, input_value, &gvalue);
+}
+
+void
+gsm_instance_set_input_double (GsmInstance *instance,
+                               gint         input,
+                               gdouble      value)
+{
+  GsmStateMachineValue *input_value;
+  GValue gvalue = G_VALUE_INIT;
+
+  g_return_if_fail (instance != NULL);
+
+  input_value = gsm_instance_internal_typed_input (instance->def, input, G_TYPE_DOUBLE);
+  if (!input_value)
+    return;
+
+  if (!gsm_state_machine_value_validate_double (input_value->pspec, value))
+    return;
+
+  if (input_value->conditions->len == 0)
+    return;
+
+  g_value_init (&gvalue, G_TYPE_DOUBLE);
+  g_value_set_double (&gvalue, value);
+  _instance_evaluate_input (instance, input_value, &gvalue);
+}
+
+void
+gsm_instance_set_input_enum (GsmInstance *instance,
+                             gint         input,
+                             gint         value)
+{
+  GsmStateMachineValue *input_value;
+  GValue gvalue = G_VALUE_INIT;
+
+  g_return_if_fail (instance != NULL);
+
+  input_value = gsm_instance_internal_typed_input (instance->def, input, G_TYPE_ENUM);
+  if (!input_value)
+    return;
+
+  if (!gsm_state_machine_value_validate_integer (input_value->pspec, value))
+    return;
+
+  if (input_value->conditions->len == 0)
+    return;
+
+  g_value_init (&gvalue, G_VALUE_TYPE (&input_value->value));
+  g_value_set_enum (&gvalue, value);
+  _instance_evaluate_input (instance, input_value, &gvalue);
+}
+
+static gboolean
+_instance_set_state (GsmInstance                             *instance,
+                     const GsmStateMachineCompiledTransition *transition,
+                     gint64                                   now)
+{
+  const GsmInstanceCallbacks *callbacks = instance->callbacks;
+  GsmStateMachineState *sm_state_old = instance->current_state;
+  GsmStateMachineState *sm_state_real = transition->real_target;
+  gboolean intermediate;
+
+  if (sm_state_old == sm_state_real)
+    return FALSE;
+
+  intermediate = gsm_instance_internal_is_transient (instance->active_conditions, sm_state_real);
+
+  if (callbacks && callbacks->state_exit)
+    callbacks->state_exit (instance, sm_state_old->value, sm_state_real->value, intermediate, instance->user_data);
+
+  instance->current_state = sm_state_real;
+  instance->state_entered = now;
+
+  if (callbacks && callbacks->state_enter)
+    callbacks->state_enter (instance, sm_state_real->value, sm_state_old->value, intermediate, instance->user_data);
+
+  return TRUE;
+}
+
+/**
+ * gsm_instance_step:
+ * @instance: a #GsmInstance
+ * @now: the current time
+ *
+ * Does a single transition if one applies to the current inputs and the
+ * time the state has been active.
+ *
+ * Returns: %GSM_STEP_RESULT_TRANSITION if a transition was done, otherwise
+ *   %GSM_STEP_RESULT_STABLE.
+ */
+GsmStepResult
+gsm_instance_step (GsmInstance *instance,
+                   gint64       now)
+{
+  const GsmStateMachineCompiledTransition *transition;
+
+  g_return_val_if_fail (instance != NULL, GSM_STEP_RESULT_STABLE);
+
+  transition = gsm_instance_internal_find_transition (instance->active_conditions, instance->current_state, 0,
+                                                      now - instance->state_entered);
+  if (transition && _instance_set_state (instance, transition, now))
+    return GSM_STEP_RESULT_TRANSITION;
+
+  return GSM_STEP_RESULT_STABLE;
+}
+
+/**
+ * gsm_instance_settle:
+ * @instance: a #GsmInstance
+ * @now: the current time
+ * @max_steps: the maximum number of transitions, or 0 for the default of 32
+ *
+ * Steps the instance until it is stable.
+ *
+ * Returns: %TRUE if the instance is stable, %FALSE if the step budget was
+ *   used up first.
+ */
+gboolean
+gsm_instance_settle (GsmInstance *instance,
+                     gint64       now,
+                     guint        max_steps)
+{
+  g_return_val_if_fail (instance != NULL, FALSE);
+
+  if (max_steps == 0)
+    max_steps = DEFAULT_MAX_STEPS;
+
+  for (guint steps = 0; steps < max_steps; steps++)
+    {
+      if (gsm_instance_step (instance, now) == GSM_STEP_RESULT_STABLE)
+        return TRUE;
+    }
+
+  /* The last step may have reached a stable state */
+  return !gsm_instance_internal_is_transient (instance->active_conditions, instance->current_state);
+}
+
+/**
+ * gsm_instance_handle_event:
+ * @instance: a #GsmInstance
+ * @event: the id of the event, see gsm_state_machine_lookup_event()
+ * @now: the current time
+ *
+ * Does the transition for the event if one applies. Just like
+ * #GsmStateMachine processes events only once it is stable, the instance
+ * should be settled first; the event is not queued.
+ *
+ * Returns: %GSM_STEP_RESULT_TRANSITION if a transition was done, otherwise
+ *   %GSM_STEP_RESULT_EVENT_DROPPED.
+ */
+GsmStepResult
+gsm_instance_handle_event (GsmInstance *instance,
+                           gint         event,
+                           gint64       now)
+{
+  const GsmStateMachineCompiledTransition *transition;
+
+  g_return_val_if_fail (instance != NULL, GSM_STEP_RESULT_EVENT_DROPPED);
+  g_return_val_if_fail (event >= 0 && event < instance->def->events->len, GSM_STEP_RESULT_EVENT_DROPPED);
+
+  transition = gsm_instance_internal_find_transition (instance->active_conditions, instance->current_state, event + 1,
+                                                      now - instance->state_entered);
+  if (transition && _instance_set_state (instance, transition, now))
+    return GSM_STEP_RESULT_TRANSITION;
+
+  return GSM_STEP_RESULT_EVENT_DROPPED;
+}
+
+/**
+ * gsm_instance_get_next_deadline:
+ * @instance: a #GsmInstance
+ * @now: the current time
+ *
+ * The instance needs to be stepped again at the returned time, as a timeout
+ * edge of the current state may apply then.
+ *
+ * Returns: the time at which the next timeout edge of the current state
+ *   expires, or %G_MAXINT64 if there is none.
+ */
+gint64
+gsm_instance_get_next_deadline (GsmInstance *instance,
+                                gint64       now)
+{
+  gint64 deadline;
+
+  g_return_val_if_fail (instance != NULL, G_MAXINT64);
+
+  if (!gsm_instance_internal_next_deadline (instance, now - instance->state_entered, &deadline))
+    return G_MAXINT64;
+
+  return deadline;
+}
@@ -0,0 +1,92 @@
+/* gsm-instance.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-state-machine.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsmInstance GsmInstance;
+
+/**
+ * GsmInstanceCallbacks:
+ * @state_exit: Called before a state is left, with the current and the new
+ *   state and whether the new state will be left again right away.
+ * @state_enter: Called after a state was entered, with the new and the old
+ *   state and whether the new state will be left again right away.
+ *
+ * The callbacks of a #GsmInstance, any of them may be %NULL. The table is
+ * not copied and usually shared by all instances.
+ */
+typedef struct
+{
+  void (*state_exit)  (GsmInstance *instance,
+                       gint         state,
+                       gint         new_state,
+                       gboolean     intermediate,
+                       gpointer     user_data);
+  void (*state_enter) (GsmInstance *instance,
+                       gint         state,
+                       gint         old_state,
+                       gboolean     intermediate,
+                       gpointer     user_data);
+} GsmInstanceCallbacks;
+
+GsmInstance     *gsm_instance_new                      (GsmStateMachineDefinition  *definition,
+                                                        const GsmInstanceCallbacks *callbacks,
+                                                        gpointer                    user_data,
+                                                        gint64                      now);
+void             gsm_instance_free                     (GsmInstance      *instance);
+
+GsmStateMachineDefinition *gsm_instance_get_definition (GsmInstance      *instance);
+gpointer         gsm_instance_get_user_data            (GsmInstance      *instance);
+gint             gsm_instance_get_state                (GsmInstance      *instance);
+
+void             gsm_instance_set_input_value          (GsmInstance      *instance,
+                                                        gint              input,
+                                                        const GValue     *value);
+void             gsm_instance_set_input_boolean        (GsmInstance      *instance,
+                                                        gint              input,
+                                                        gboolean          value);
+void             gsm_instance_set_input_int            (GsmInstance      *instance,
+                                                        gint              input,
+                                                        gint              value);
+void             gsm_instance_set_input_double         (GsmInstance      *instance,
+                                                        gint              input,
+                                                        gdouble           value);
+void             gsm_instance_set_input_enum           (GsmInstance      *instance,
+                                                        gint              input,
+                                                        gint              value);
+
+GsmStepResult    gsm_instance_step                     (GsmInstance      *instance,
+                                                        gint64            now);
+gboolean         gsm_instance_settle                   (GsmInstance      *instance,
+                                                        gint64            now,
+                                                        guint             max_steps);
+GsmStepResult    gsm_instance_handle_event             (GsmInstance      *instance,
+                                                        gint              event,
+                                                        gint64            now);
+gint64           gsm_instance_get_next_deadline        (GsmInstance      *instance,
+                                                        gint64            now);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsmInstance, gsm_instance_free)
+
+G_END_DECLS
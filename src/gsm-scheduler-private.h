@@ -0,0 +1,60 @@
+/* gsm-scheduler-private.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-scheduler.h"
+#include "gsm-state-machine.h"
+#include "gsm-timer-wheel.h"
+
+G_BEGIN_DECLS
+
+/* The link is owned by the queued object and its data must be the
+ * #GsmStateMachine. Queueing an already queued link does nothing. */
+void             gsm_scheduler_queue                   (GsmScheduler     *scheduler,
+                                                        GList            *link);
+void             gsm_scheduler_unqueue                 (GsmScheduler     *scheduler,
+                                                        GList            *link);
+gboolean         gsm_scheduler_is_queued               (GsmScheduler     *scheduler,
+                                                        GList            *link);
+
+/* The deadline is in monotonic time (microseconds), timers have a
+ * resolution of one millisecond and never fire early. */
+void             gsm_scheduler_add_timer               (GsmScheduler     *scheduler,
+                                                        GsmTimer         *timer,
+                                                        gint64            deadline);
+void             gsm_scheduler_remove_timer            (GsmScheduler     *scheduler,
+                                                        GsmTimer         *timer);
+
+/* Node of the list of machines with posted inputs or events, embedded into
+ * the machine. Posting is lock free and may happen from any thread; the
+ * scheduler drains the machine in its next dispatch and then drops the
+ * reference on it that the caller passed on. */
+typedef struct _GsmSchedulerPost GsmSchedulerPost;
+struct _GsmSchedulerPost
+{
+  GsmSchedulerPost *next;
+  GsmStateMachine  *state_machine;
+};
+
+void             gsm_scheduler_post                    (GsmScheduler     *scheduler,
+                                                        GsmSchedulerPost *post);
+
+G_END_DECLS
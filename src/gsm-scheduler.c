@@ -0,0 +1,491 @@
+/* gsm-scheduler.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gsm-scheduler-private.h"
+#include "gsm-state-machine-private.h"
+
+/**
+ * SECTION:gsm-scheduler
+ * @short_description: Shared update source for many state machines
+ *
+ * A #GsmScheduler owns a single #GSource and updates all state machines
+ * that were created with it from there. Machines that need an update are
+ * queued and dispatched in batches; a batch stops early once the time
+ * budget is used up, the remaining machines are updated in the next main
+ * loop iteration.
+ *
+ * The scheduler also keeps the timers of the timed transitions of its
+ * machines in a single timer wheel, so that the number of machines waiting
+ * for a timeout does not affect the main loop.
+ *
+ * The scheduler and its machines must only be used from the thread that
+ * runs its main context, with the exception of the posting API of
+ * #GsmStateMachine (e.g. gsm_state_machine_post_event()).
+ */
+
+struct _GsmScheduler
+{
+  GObject       parent_instance;
+
+  GMainContext *context;
+  gint          priority;
+  guint         time_budget;
+
+  GSource      *source;
+  GQueue        queue;
+
+  /* Stack of machines with posted inputs or events, pushed from any thread
+   * and taken as a whole by the dispatch. */
+  GsmSchedulerPost *posted;
+
+  /* Ticks are milliseconds of monotonic time */
+  GsmTimerWheel timers;
+};
+
+G_DEFINE_TYPE (GsmScheduler, gsm_scheduler, G_TYPE_OBJECT)
+
+enum {
+  PROP_0,
+  PROP_MAIN_CONTEXT,
+  PROP_PRIORITY,
+  PROP_TIME_BUDGET,
+  N_PROPS
+};
+
+static GParamSpec *properties [N_PROPS];
+
+typedef struct
+{
+  GSource       source;
+  GsmScheduler *scheduler;
+} GsmSchedulerSource;
+
+static void
+gsm_scheduler_update_ready_time (GsmScheduler *self)
+{
+  gint64 next;
+
+  if (self->queue.head)
+    {
+      g_source_set_ready_time (self->source, 0);
+      return;
+    }
+
+  next = gsm_timer_wheel_next_event (&self->timers);
+  g_source_set_ready_time (self->source, next >= 0 ? next * 1000 : -1);
+}
+
+static gboolean
+gsm_scheduler_source_prepare (GSource *source,
+                              gint    *timeout)
+{
+  GsmScheduler *self = ((GsmSchedulerSource *) source)->scheduler;
+
+  *timeout = -1;
+
+  return g_atomic_pointer_get (&self->posted) != NULL;
+}
+
+static gboolean
+gsm_scheduler_source_check (GSource *source)
+{
+  GsmScheduler *self = ((GsmSchedulerSource *) source)->scheduler;
+
+  return g_atomic_pointer_get (&self->posted) != NULL;
+}
+
+/* Drains all machines that posted since the last dispatch, which queues
+ * them if they need an update. */
+static void
+gsm_scheduler_drain_posted (GsmScheduler *self)
+{
+  GsmSchedulerPost *posted;
+  GsmSchedulerPost *ordered = NULL;
+
+  do
+    posted = g_atomic_pointer_get (&self->posted);
+  while (!g_atomic_pointer_compare_and_exchange (&self->posted, posted, NULL));
+
+  /* The stack has the most recent post first */
+  while (posted)
+    {
+      GsmSchedulerPost *next = posted->next;
+
+      posted->next = ordered;
+      ordered = posted;
+      posted = next;
+    }
+
+  while (ordered)
+    {
+      GsmStateMachine *state_machine = ordered->state_machine;
+
+      ordered = ordered->next;
+      gsm_state_machine_drain_posted (state_machine);
+      g_object_unref (state_machine);
+    }
+}
+
+static gboolean
+gsm_scheduler_source_dispatch (GSource     *source,
+                               GSourceFunc  callback,
+                               gpointer     user_data)
+{
+  g_autoptr(GsmScheduler) self = g_object_ref (((GsmSchedulerSource *) source)->scheduler);
+  guint n_batch;
+  gint64 deadline = 0;
+
+  gsm_scheduler_drain_posted (self);
+
+  /* Expired timers queue their machines */
+  gsm_timer_wheel_advance (&self->timers, g_source_get_time (source) / 1000);
+  n_batch = self->queue.length;
+
+  if (self->time_budget)
+    deadline = g_get_monotonic_time () + self->time_budget;
+
+  /* Machines queued again while dispatching are only handled in the next
+   * batch, so that a machine that never settles cannot block the others. */
+  while (n_batch > 0 && self->queue.head)
+    {
+      GList *link = g_queue_pop_head_link (&self->queue);
+      g_autoptr(GsmStateMachine) state_machine = g_object_ref (link->data);
+
+      gsm_state_machine_dispatch (state_machine);
+      n_batch--;
+
+      if (deadline && g_get_monotonic_time () >= deadline)
+        break;
+    }
+
+  gsm_scheduler_update_ready_time (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs gsm_scheduler_source_funcs = {
+  .prepare = gsm_scheduler_source_prepare,
+  .check = gsm_scheduler_source_check,
+  .dispatch = gsm_scheduler_source_dispatch,
+};
+
+/**
+ * gsm_scheduler_new:
+ * @context: (nullable): The #GMainContext to run in, or %NULL for the thread
+ *   default main context.
+ *
+ * Create a new #GsmScheduler.
+ *
+ * Returns: (transfer full): a newly created #GsmScheduler
+ */
+GsmScheduler *
+gsm_scheduler_new (GMainContext *context)
+{
+  return g_object_new (GSM_TYPE_SCHEDULER,
+                       "main-context", context,
+                       NULL);
+}
+
+static void
+gsm_scheduler_constructed (GObject *object)
+{
+  GsmScheduler *self = (GsmScheduler *)object;
+  GsmSchedulerSource *source;
+
+  G_OBJECT_CLASS (gsm_scheduler_parent_class)->constructed (object);
+
+  if (!self->context)
+    self->context = g_main_context_ref_thread_default ();
+
+  source = (GsmSchedulerSource *) g_source_new (&gsm_scheduler_source_funcs, sizeof (GsmSchedulerSource));
+  source->scheduler = self;
+  self->source = (GSource *) source;
+
+  g_source_set_name (self->source, "GsmScheduler");
+  g_source_set_priority (self->source, self->priority);
+  g_source_set_ready_time (self->source, -1);
+  g_source_attach (self->source, self->context);
+}
+
+static void
+gsm_scheduler_finalize (GObject *object)
+{
+  GsmScheduler *self = (GsmScheduler *)object;
+
+  /* Machines hold a reference, so none can be queued anymore. */
+  g_assert (self->queue.head == NULL);
+  g_assert (self->posted == NULL);
+  g_assert (self->timers.n_timers == 0);
+
+  g_source_destroy (self->source);
+  g_clear_pointer (&self->source, g_source_unref);
+  g_clear_pointer (&self->context, g_main_context_unref);
+
+  G_OBJECT_CLASS (gsm_scheduler_parent_class)->finalize (object);
+}
+
+static void
+gsm_scheduler_get_property (GObject    *object,
+                            guint       prop_id,
+                            GValue     *value,
+                            GParamSpec *pspec)
+{
+  GsmScheduler *self = GSM_SCHEDULER (object);
+
+  switch (prop_id)
+    {
+    case PROP_MAIN_CONTEXT:
+      g_value_set_boxed (value, self->context);
+      break;
+
+    case PROP_PRIORITY:
+      g_value_set_int (value, self->priority);
+      break;
+
+    case PROP_TIME_BUDGET:
+      g_value_set_uint (value, self->time_budget);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gsm_scheduler_set_property (GObject      *object,
+                            guint         prop_id,
+                            const GValue *value,
+                            GParamSpec   *pspec)
+{
+  GsmScheduler *self = GSM_SCHEDULER (object);
+
+  switch (prop_id)
+    {
+    case PROP_MAIN_CONTEXT:
+      g_assert (self->context == NULL);
+      self->context = g_value_dup_boxed (value);
+      break;
+
+    case PROP_PRIORITY:
+      gsm_scheduler_set_priority (self, g_value_get_int (value));
+      break;
+
+    case PROP_TIME_BUDGET:
+      gsm_scheduler_set_time_budget (self, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gsm_scheduler_class_init (GsmSchedulerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = gsm_scheduler_constructed;
+  object_class->finalize = gsm_scheduler_finalize;
+  object_class->get_property = gsm_scheduler_get_property;
+  object_class->set_property = gsm_scheduler_set_property;
+
+  properties[PROP_MAIN_CONTEXT] =
+    g_param_spec_boxed ("main-context", "MainContext",
+                        "The main context to update in (default: thread default at construction)",
+                        G_TYPE_MAIN_CONTEXT,
+                        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_PRIORITY] =
+    g_param_spec_int ("priority", "Priority",
+                      "The priority of the update source",
+                      G_MININT,
+                      G_MAXINT,
+                      G_PRIORITY_DEFAULT_IDLE,
+                      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_TIME_BUDGET] =
+    g_param_spec_uint ("time-budget", "TimeBudget",
+                       "Time in microseconds after which a batch is stopped, 0 for no limit",
+                       0,
+                       G_MAXUINT,
+                       1000,
+                       G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+gsm_scheduler_init (GsmScheduler *self)
+{
+  g_queue_init (&self->queue);
+  gsm_timer_wheel_init (&self->timers, g_get_monotonic_time () / 1000);
+}
+
+GMainContext*
+gsm_scheduler_get_main_context (GsmScheduler *scheduler)
+{
+  g_return_val_if_fail (GSM_IS_SCHEDULER (scheduler), NULL);
+
+  return scheduler->context;
+}
+
+gint
+gsm_scheduler_get_priority (GsmScheduler *scheduler)
+{
+  g_return_val_if_fail (GSM_IS_SCHEDULER (scheduler), 0);
+
+  return scheduler->priority;
+}
+
+void
+gsm_scheduler_set_priority (GsmScheduler *scheduler,
+                            gint          priority)
+{
+  g_return_if_fail (GSM_IS_SCHEDULER (scheduler));
+
+  if (scheduler->priority == priority)
+    return;
+
+  scheduler->priority = priority;
+
+  /* Not yet created while the construct properties are set */
+  if (scheduler->source)
+    g_source_set_priority (scheduler->source, priority);
+
+  g_object_notify_by_pspec (G_OBJECT (scheduler), properties[PROP_PRIORITY]);
+}
+
+guint
+gsm_scheduler_get_time_budget (GsmScheduler *scheduler)
+{
+  g_return_val_if_fail (GSM_IS_SCHEDULER (scheduler), 0);
+
+  return scheduler->time_budget;
+}
+
+/**
+ * gsm_scheduler_set_time_budget:
+ * @scheduler: a #GsmScheduler
+ * @time_budget: the budget in microseconds, or 0 for no limit
+ *
+ * Sets the time after which dispatching a batch of machines is stopped. The
+ * budget is only checked between machines, so each machine that is started
+ * finishes its update.
+ */
+void
+gsm_scheduler_set_time_budget (GsmScheduler *scheduler,
+                               guint         time_budget)
+{
+  g_return_if_fail (GSM_IS_SCHEDULER (scheduler));
+
+  if (scheduler->time_budget == time_budget)
+    return;
+
+  scheduler->time_budget = time_budget;
+  g_object_notify_by_pspec (G_OBJECT (scheduler), properties[PROP_TIME_BUDGET]);
+}
+
+/**
+ * gsm_scheduler_get_n_queued:
+ * @scheduler: a #GsmScheduler
+ *
+ * Returns: the number of machines waiting for an update.
+ */
+guint
+gsm_scheduler_get_n_queued (GsmScheduler *scheduler)
+{
+  g_return_val_if_fail (GSM_IS_SCHEDULER (scheduler), 0);
+
+  return scheduler->queue.length;
+}
+
+static gboolean
+_link_is_queued (GsmScheduler *scheduler, GList *link)
+{
+  return link->prev != NULL || scheduler->queue.head == link;
+}
+
+void
+gsm_scheduler_queue (GsmScheduler *scheduler,
+                     GList        *link)
+{
+  if (_link_is_queued (scheduler, link))
+    return;
+
+  if (scheduler->queue.head == NULL)
+    g_source_set_ready_time (scheduler->source, 0);
+
+  g_queue_push_tail_link (&scheduler->queue, link);
+}
+
+void
+gsm_scheduler_unqueue (GsmScheduler *scheduler,
+                       GList        *link)
+{
+  if (!_link_is_queued (scheduler, link))
+    return;
+
+  g_queue_unlink (&scheduler->queue, link);
+}
+
+gboolean
+gsm_scheduler_is_queued (GsmScheduler *scheduler,
+                         GList        *link)
+{
+  return _link_is_queued (scheduler, link);
+}
+
+void
+gsm_scheduler_post (GsmScheduler     *scheduler,
+                    GsmSchedulerPost *post)
+{
+  GsmSchedulerPost *head;
+
+  /* Only ever popped as a whole, so there is no ABA problem */
+  do
+    {
+      head = g_atomic_pointer_get (&scheduler->posted);
+      post->next = head;
+    }
+  while (!g_atomic_pointer_compare_and_exchange (&scheduler->posted, head, post));
+
+  if (head == NULL)
+    g_main_context_wakeup (scheduler->context);
+}
+
+void
+gsm_scheduler_add_timer (GsmScheduler *scheduler,
+                         GsmTimer     *timer,
+                         gint64        deadline)
+{
+  gsm_timer_wheel_add (&scheduler->timers, timer, (deadline + 999) / 1000);
+  gsm_scheduler_update_ready_time (scheduler);
+}
+
+void
+gsm_scheduler_remove_timer (GsmScheduler *scheduler,
+                            GsmTimer     *timer)
+{
+  if (!gsm_timer_is_armed (timer))
+    return;
+
+  gsm_timer_wheel_remove (&scheduler->timers, timer);
+  gsm_scheduler_update_ready_time (scheduler);
+}
@@ -0,0 +1,45 @@
+/* gsm-scheduler.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GSM_TYPE_SCHEDULER (gsm_scheduler_get_type())
+
+G_DECLARE_FINAL_TYPE (GsmScheduler, gsm_scheduler, GSM, SCHEDULER, GObject)
+
+GsmScheduler    *gsm_scheduler_new                     (GMainContext     *context);
+
+GMainContext    *gsm_scheduler_get_main_context        (GsmScheduler     *scheduler);
+
+gint             gsm_scheduler_get_priority            (GsmScheduler     *scheduler);
+void             gsm_scheduler_set_priority            (GsmScheduler     *scheduler,
+                                                        gint              priority);
+
+guint            gsm_scheduler_get_time_budget         (GsmScheduler     *scheduler);
+void             gsm_scheduler_set_time_budget         (GsmScheduler     *scheduler,
+                                                        guint             time_budget);
+
+guint            gsm_scheduler_get_n_queued            (GsmScheduler     *scheduler);
+
+G_END_DECLS
@@ -0,0 +1,42 @@
+/* gsm-snapshot-private.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-snapshot.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsmSnapshotBlock GsmSnapshotBlock;
+
+/* The data a machine publishes for its snapshots. It is only written by the
+ * thread owning the machine and outlives the machine if snapshots are left. */
+GsmSnapshotBlock *gsm_snapshot_block_new               (gint              state,
+                                                        guint64           n_transitions,
+                                                        GPtrArray        *outputs);
+GsmSnapshotBlock *gsm_snapshot_block_ref               (GsmSnapshotBlock *block);
+void             gsm_snapshot_block_unref              (GsmSnapshotBlock *block);
+
+void             gsm_snapshot_block_publish            (GsmSnapshotBlock *block,
+                                                        gint              state,
+                                                        guint64           n_transitions,
+                                                        GPtrArray        *outputs);
+
+G_END_DECLS
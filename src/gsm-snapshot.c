@@ -0,0 +1,439 @@
+/* gsm-snapshot.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <string.h>
+#include "gsm-snapshot-private.h"
+#include "gsm-state-machine-private.h"
+
+/**
+ * SECTION:gsm-snapshot
+ * @short_description: Reads the state of a machine from other threads
+ *
+ * A #GsmStateMachine may only be used from the thread that runs its main
+ * context. Other threads, e.g. for monitoring, can create a #GsmSnapshot
+ * instead: after every settled update the machine publishes its state, a
+ * transition counter and the values of its boolean, numeric, enum and flags
+ * outputs, and gsm_snapshot_read() copies a consistent set of them.
+ *
+ * The data is protected by a sequence counter, so reading never blocks or
+ * slows down the machine; a reader simply retries if the machine published
+ * while it was copying. Outputs of other types are not published.
+ */
+
+struct _GsmSnapshotBlock
+{
+  gint     ref_count;
+
+  /* Odd while the machine is writing */
+  guint    sequence;
+  gint     state;
+  guint64  n_transitions;
+
+  /* The type is G_TYPE_INVALID for outputs that are not published */
+  guint    n_outputs;
+  GType   *types;
+  guint64 *values;
+};
+
+struct _GsmSnapshot
+{
+  GsmSnapshotBlock *block;
+
+  /* The sequence of the last read, initially odd so it never matches */
+  guint    sequence;
+  gint     state;
+  guint64  n_transitions;
+  guint64 *values;
+  GValue  *outputs;
+};
+
+static gboolean
+gsm_snapshot_type_is_packed (GType type)
+{
+  switch (G_TYPE_FUNDAMENTAL (type))
+    {
+    case G_TYPE_BOOLEAN:
+    case G_TYPE_INT:
+    case G_TYPE_UINT:
+    case G_TYPE_LONG:
+    case G_TYPE_ULONG:
+    case G_TYPE_INT64:
+    case G_TYPE_UINT64:
+    case G_TYPE_ENUM:
+    case G_TYPE_FLAGS:
+    case G_TYPE_FLOAT:
+    case G_TYPE_DOUBLE:
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+}
+
+/* Stores the value in 64 bits, floating point values as a double */
+static guint64
+gsm_snapshot_pack (const GValue *value)
+{
+  gdouble d;
+  guint64 raw;
+
+  switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value)))
+    {
+    case G_TYPE_BOOLEAN:
+      return g_value_get_boolean (value);
+    case G_TYPE_INT:
+      return (gint64) g_value_get_int (value);
+    case G_TYPE_UINT:
+      return g_value_get_uint (value);
+    case G_TYPE_LONG:
+      return (gint64) g_value_get_long (value);
+    case G_TYPE_ULONG:
+      return g_value_get_ulong (value);
+    case G_TYPE_INT64:
+      return g_value_get_int64 (value);
+    case G_TYPE_UINT64:
+      return g_value_get_uint64 (value);
+    case G_TYPE_ENUM:
+      return (gint64) g_value_get_enum (value);
+    case G_TYPE_FLAGS:
+      return g_value_get_flags (value);
+    case G_TYPE_FLOAT:
+      d = g_value_get_float (value);
+      break;
+    case G_TYPE_DOUBLE:
+      d = g_value_get_double (value);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  memcpy (&raw, &d, sizeof (raw));
+
+  return raw;
+}
+
+static void
+gsm_snapshot_unpack (GValue  *value,
+                     guint64  raw)
+{
+  gdouble d;
+
+  memcpy (&d, &raw, sizeof (d));
+
+  switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value)))
+    {
+    case G_TYPE_BOOLEAN:
+      g_value_set_boolean (value, raw != 0);
+      break;
+    case G_TYPE_INT:
+      g_value_set_int (value, (gint64) raw);
+      break;
+    case G_TYPE_UINT:
+      g_value_set_uint (value, raw);
+      break;
+    case G_TYPE_LONG:
+      g_value_set_long (value, (gint64) raw);
+      break;
+    case G_TYPE_ULONG:
+      g_value_set_ulong (value, raw);
+      break;
+    case G_TYPE_INT64:
+      g_value_set_int64 (value, raw);
+      break;
+    case G_TYPE_UINT64:
+      g_value_set_uint64 (value, raw);
+      break;
+    case G_TYPE_ENUM:
+      g_value_set_enum (value, (gint64) raw);
+      break;
+    case G_TYPE_FLAGS:
+      g_value_set_flags (value, raw);
+      break;
+    case G_TYPE_FLOAT:
+      g_value_set_float (value, d);
+      break;
+    case G_TYPE_DOUBLE:
+      g_value_set_double (value, d);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+GsmSnapshotBlock*
+gsm_snapshot_block_new (gint       state,
+                        guint64    n_transitions,
+                        GPtrArray *outputs)
+{
+  GsmSnapshotBlock *block = g_new0 (GsmSnapshotBlock, 1);
+
+  block->ref_count = 1;
+  block->state = state;
+  block->n_transitions = n_transitions;
+  block->n_outputs = outputs->len;
+  block->types = g_new0 (GType, outputs->len);
+  block->values = g_new0 (guint64, outputs->len);
+
+  for (guint i = 0; i < outputs->len; i++)
+    {
+      const GValue *value = g_ptr_array_index (outputs, i);
+
+      if (!gsm_snapshot_type_is_packed (G_VALUE_TYPE (value)))
+        continue;
+
+      block->types[i] = G_VALUE_TYPE (value);
+      block->values[i] = gsm_snapshot_pack (value);
+    }
+
+  return block;
+}
+
+GsmSnapshotBlock*
+gsm_snapshot_block_ref (GsmSnapshotBlock *block)
+{
+  g_atomic_int_inc (&block->ref_count);
+
+  return block;
+}
+
+void
+gsm_snapshot_block_unref (GsmSnapshotBlock *block)
+{
+  if (!g_atomic_int_dec_and_test (&block->ref_count))
+    return;
+
+  g_free (block->types);
+  g_free (block->values);
+  g_free (block);
+}
+
+/* Only called from the thread owning the machine, which is also the only
+ * writer, so the fields can be compared without atomics. */
+void
+gsm_snapshot_block_publish (GsmSnapshotBlock *block,
+                            gint              state,
+                            guint64           n_transitions,
+                            GPtrArray        *outputs)
+{
+  gboolean changed;
+  guint sequence;
+
+  changed = block->state != state || block->n_transitions != n_transitions;
+  for (guint i = 0; i < block->n_outputs && !changed; i++)
+    {
+      if (block->types[i] != G_TYPE_INVALID)
+        changed = block->values[i] != gsm_snapshot_pack (g_ptr_array_index (outputs, i));
+    }
+
+  /* Readers can tell whether anything changed by the sequence */
+  if (!changed)
+    return;
+
+  sequence = block->sequence;
+  /* The release stores keep the odd sequence ahead of the data */
+  __atomic_store_n (&block->sequence, sequence + 1, __ATOMIC_RELAXED);
+
+  __atomic_store_n (&block->state, state, __ATOMIC_RELEASE);
+  __atomic_store_n (&block->n_transitions, n_transitions, __ATOMIC_RELEASE);
+  for (guint i = 0; i < block->n_outputs; i++)
+    {
+      if (block->types[i] != G_TYPE_INVALID)
+        __atomic_store_n (&block->values[i], gsm_snapshot_pack (g_ptr_array_index (outputs, i)), __ATOMIC_RELEASE);
+    }
+
+  __atomic_store_n (&block->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * gsm_snapshot_new:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Creates a snapshot of @state_machine that is filled with the current
+ * values. This needs to be called from the thread owning the machine and
+ * seals its definition; afterwards the snapshot may be passed to any other
+ * thread. It keeps the published data alive, but not the machine.
+ *
+ * Returns: (transfer full): a new #GsmSnapshot
+ */
+GsmSnapshot*
+gsm_snapshot_new (GsmStateMachine *state_machine)
+{
+  GsmSnapshot *snapshot;
+  GsmSnapshotBlock *block;
+
+  g_return_val_if_fail (GSM_IS_STATE_MACHINE (state_machine), NULL);
+
+  block = gsm_state_machine_get_snapshot_block (state_machine);
+
+  snapshot = g_new0 (GsmSnapshot, 1);
+  snapshot->block = gsm_snapshot_block_ref (block);
+  snapshot->sequence = 1;
+  snapshot->values = g_new0 (guint64, block->n_outputs);
+  snapshot->outputs = g_new0 (GValue, block->n_outputs);
+
+  for (guint i = 0; i < block->n_outputs; i++)
+    {
+      if (block->types[i] != G_TYPE_INVALID)
+        g_value_init (&snapshot->outputs[i], block->types[i]);
+    }
+
+  gsm_snapshot_read (snapshot);
+
+  return snapshot;
+}
+
+/**
+ * gsm_snapshot_free:
+ * @snapshot: a #GsmSnapshot
+ *
+ * Frees the snapshot, this can be done from any thread.
+ */
+void
+gsm_snapshot_free (GsmSnapshot *snapshot)
+{
+  g_return_if_fail (snapshot != NULL);
+
+  for (guint i = 0; i < snapshot->block->n_outputs; i++)
+    {
+      if (G_IS_VALUE (&snapshot->outputs[i]))
+        g_value_unset (&snapshot->outputs[i]);
+    }
+
+  gsm_snapshot_block_unref (snapshot->block);
+  g_free (snapshot->outputs);
+  g_free (snapshot->values);
+  g_free (snapshot);
+}
+
+/**
+ * gsm_snapshot_read:
+ * @snapshot: a #GsmSnapshot
+ *
+ * Copies the values last published by the machine into @snapshot. The
+ * state, transition counter and outputs always belong to the same settled
+ * update. Only one thread may use a snapshot at a time.
+ *
+ * Returns: %TRUE if the machine published anything since the last read
+ */
+gboolean
+gsm_snapshot_read (GsmSnapshot *snapshot)
+{
+  GsmSnapshotBlock *block;
+  guint sequence;
+
+  g_return_val_if_fail (snapshot != NULL, FALSE);
+
+  block = snapshot->block;
+
+  while (TRUE)
+    {
+      sequence = __atomic_load_n (&block->sequence, __ATOMIC_ACQUIRE);
+      if (sequence == snapshot->sequence)
+        return FALSE;
+
+      /* The machine is in the middle of publishing */
+      if (sequence & 1)
+        {
+          g_thread_yield ();
+          continue;
+        }
+
+      /* The acquire loads keep the data ahead of the second check */
+      snapshot->state = __atomic_load_n (&block->state, __ATOMIC_ACQUIRE);
+      snapshot->n_transitions = __atomic_load_n (&block->n_transitions, __ATOMIC_ACQUIRE);
+      for (guint i = 0; i < block->n_outputs; i++)
+        snapshot->values[i] = __atomic_load_n (&block->values[i], __ATOMIC_ACQUIRE);
+
+      if (__atomic_load_n (&block->sequence, __ATOMIC_RELAXED) == sequence)
+        break;
+    }
+
+  snapshot->sequence = sequence;
+  for (guint i = 0; i < block->n_outputs; i++)
+    {
+      if (block->types[i] != G_TYPE_INVALID)
+        gsm_snapshot_unpack (&snapshot->outputs[i], snapshot->values[i]);
+    }
+
+  return TRUE;
+}
+
+/**
+ * gsm_snapshot_get_state:
+ * @snapshot: a #GsmSnapshot
+ *
+ * Returns: the state of the machine at the last gsm_snapshot_read()
+ */
+gint
+gsm_snapshot_get_state (GsmSnapshot *snapshot)
+{
+  g_return_val_if_fail (snapshot != NULL, 0);
+
+  return snapshot->state;
+}
+
+/**
+ * gsm_snapshot_get_n_transitions:
+ * @snapshot: a #GsmSnapshot
+ *
+ * Gets the number of transitions the machine did until the last
+ * gsm_snapshot_read(). Comparing it between two reads shows whether the
+ * machine left the state in between, even if it came back to it.
+ *
+ * Returns: the number of transitions of the machine
+ */
+guint64
+gsm_snapshot_get_n_transitions (GsmSnapshot *snapshot)
+{
+  g_return_val_if_fail (snapshot != NULL, 0);
+
+  return snapshot->n_transitions;
+}
+
+guint
+gsm_snapshot_get_n_outputs (GsmSnapshot *snapshot)
+{
+  g_return_val_if_fail (snapshot != NULL, 0);
+
+  return snapshot->block->n_outputs;
+}
+
+/**
+ * gsm_snapshot_get_output_value:
+ * @snapshot: a #GsmSnapshot
+ * @output: the id of the output
+ *
+ * Gets the value of an output at the last gsm_snapshot_read().
+ *
+ * Returns: (transfer none) (nullable): the value, or %NULL if outputs of
+ *   this type are not published
+ */
+const GValue*
+gsm_snapshot_get_output_value (GsmSnapshot *snapshot,
+                               gint         output)
+{
+  g_return_val_if_fail (snapshot != NULL, NULL);
+  g_return_val_if_fail (output >= 0 && output < snapshot->block->n_outputs, NULL);
+
+  if (!G_IS_VALUE (&snapshot->outputs[output]))
+    return NULL;
+
+  return &snapshot->outputs[output];
+}
@@ -0,0 +1,42 @@
+/* gsm-snapshot.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-state-machine.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsmSnapshot GsmSnapshot;
+
+GsmSnapshot     *gsm_snapshot_new                      (GsmStateMachine  *state_machine);
+void             gsm_snapshot_free                     (GsmSnapshot      *snapshot);
+
+gboolean         gsm_snapshot_read                     (GsmSnapshot      *snapshot);
+
+gint             gsm_snapshot_get_state                (GsmSnapshot      *snapshot);
+guint64          gsm_snapshot_get_n_transitions        (GsmSnapshot      *snapshot);
+guint            gsm_snapshot_get_n_outputs            (GsmSnapshot      *snapshot);
+const GValue    *gsm_snapshot_get_output_value         (GsmSnapshot      *snapshot,
+                                                        gint              output);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsmSnapshot, gsm_snapshot_free)
+
+G_END_DECLS
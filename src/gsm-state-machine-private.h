@@ -0,0 +1,38 @@
+/* gsm-state-machine-private.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "gsm-state-machine.h"
+#include "gsm-snapshot-private.h"
+
+G_BEGIN_DECLS
+
+/* Does the work of one update source dispatch, used by #GsmScheduler */
+void             gsm_state_machine_dispatch            (GsmStateMachine  *state_machine);
+
+/* Applies the inputs and events posted from other threads */
+void             gsm_state_machine_drain_posted        (GsmStateMachine  *state_machine);
+
+/* Seals the definition and starts publishing, the machine keeps the
+ * returned reference */
+GsmSnapshotBlock *gsm_state_machine_get_snapshot_block (GsmStateMachine  *state_machine);
+
+G_END_DECLS
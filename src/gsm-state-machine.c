@@ -18,50 +18,137 @@
  * SPDX-License-Identifier: LGPL-3.0-or-later
  */
 
+#include <string.h>
 #include <gobject/gvaluecollector.h>
-#include "gsm-state-machine.h"
+#include "gsm-state-machine-private.h"
+#include "gsm-scheduler-private.h"
+#include "gsm-clock-private.h"
+#include "gsm-instance-private.h"
+#include "gsm-bitset.h"
+#include "gsm-timer-wheel.h"
 
-typedef struct _GsmStateMachineState GsmStateMachineState;
+/* Number of events that can be posted before the machine drains them */
+#define POST_RING_SIZE 32
 
 typedef struct
 {
-  GType       state_type;
-
-  gint        state;
-
-  GArray     *events;
-  GPtrArray  *input_conditions;
-
-  GArray     *active_conditions;
-  GQuark      active_event;
+  guint sequence;
+  guint bucket;
+} GsmStateMachinePostSlot;
+
+/* Inputs and events posted from other threads, allocated on the first
+ * post. Each input has a slot with the latest posted value and a pending
+ * bit, so repeated posts of an input are coalesced. Events go through a
+ * bounded multi producer ring where the sequence number of a slot tells
+ * whether it is free (position), filled (position + 1) or still being
+ * written. */
+typedef struct
+{
+  guint        n_inputs;
+  guint        tail;
+  guint        head;
+  GsmStateMachinePostSlot ring[POST_RING_SIZE];
 
-  GList      *pending_events;
+  /* Bits in 32 bit words for the GLib atomics, followed by the values */
+  guint       *pending;
+  guint64     *values;
+} GsmStateMachinePostbox;
 
-  GHashTable *inputs;
-  GHashTable *outputs;
-  GArray     *outputs_quark;
+typedef struct
+{
+  GsmStateMachineDefinition *def;
+
+  /* The current state, the time it was entered and the condition results */
+  GsmInstance *instance;
+
+  /* Index of the event plus one, zero if no event is active */
+  guint       active_event;
+
+  /* Ring buffer of pending event buckets, the size is a power of two */
+  guint      *event_ring;
+  guint       event_ring_size;
+  guint       event_ring_head;
+  guint       n_pending_events;
+  guint      *event_pending_count;
+  guint       event_capacity;
+  GsmEventOverflowPolicy event_overflow_policy;
+
+  /* The values of the inputs, indexed like the definition's inputs */
+  GPtrArray  *inputs_by_id;
+  GPtrArray  *dirty_inputs;
+  guint64     n_suppressed_inputs;
+  guint       update_depth;
+  guint64     generation;
+  gboolean    update_deferred;
+  GPtrArray  *changed_inputs;
 
   GPtrArray  *current_outputs;
+  guint64     n_transitions;
 
-  GHashTable *states;
-  GsmStateMachineState *all_state;
-  gint        last_group;
+  /* Created with the first snapshot, see gsm_state_machine_internal_publish() */
+  GsmSnapshotBlock *snapshot_block;
 
   gboolean    running;
-  guint       idle_source_id;
+  GsmUpdateMode update_mode;
+  guint       max_steps;
+
+  GMainContext *context;
+  gint        priority;
+  GSource    *source;
+
+  /* If set, the scheduler is used instead of an own source */
+  GsmScheduler *scheduler;
+
+  /* If set, the time is taken from the clock and a virtual clock also
+   * handles the timers. */
+  GsmClock     *clock;
+
+  /* The timer for the next timed transition. Without a scheduler or
+   * virtual clock the update source is also used for the timer. */
+  GsmTimer      timer;
+  gint64        timer_deadline;
+  gboolean      update_queued;
+  GList       scheduler_link;
+
+  /* Set by the first post after a drain, which wakes up the context */
+  GsmStateMachinePostbox *postbox;
+  gint          post_pending;
+  GsmSchedulerPost scheduler_post;
 } GsmStateMachinePrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GsmStateMachine, gsm_state_machine, G_TYPE_OBJECT)
 #define GSM_STATE_MACHINE_PRIVATE(obj) gsm_state_machine_get_instance_private (obj)
 
 static void gsm_state_machine_internal_queue_update (GsmStateMachine *state_machine);
+static void gsm_state_machine_internal_update_ready_time (GsmStateMachine *state_machine);
+static gint64 gsm_state_machine_internal_now (GsmStateMachine *state_machine);
+static void gsm_state_machine_internal_publish (GsmStateMachine *state_machine);
+static gboolean gsm_state_machine_internal_update_pending (GsmStateMachine *state_machine);
+static void gsm_state_machine_internal_timer_expired (gpointer user_data);
+static void gsm_state_machine_internal_virtual_timer_expired (gpointer user_data);
+static void gsm_state_machine_internal_add_edge (GsmStateMachine  *state_machine,
+                                                 gint              start_state,
+                                                 gint              target_state,
+                                                 guint             timeout,
+                                                 const GStrv       conditions);
+static void gsm_state_machine_internal_arm_timer (GsmStateMachine *state_machine,
+                                                  gint64           elapsed);
 
 
 enum {
   PROP_0,
   PROP_STATE,
   PROP_STATE_TYPE,
+  PROP_DEFINITION,
   PROP_RUNNING,
+  PROP_UPDATE_MODE,
+  PROP_MAX_STEPS,
+  PROP_MAIN_CONTEXT,
+  PROP_PRIORITY,
+  PROP_SCHEDULER,
+  PROP_CLOCK,
+  PROP_EVENT_CAPACITY,
+  PROP_EVENT_OVERFLOW_POLICY,
   N_PROPS
 };
 
@@ -78,17 +165,6 @@ enum {
 };
 static guint signals [N_SIGNALS];
 
-/* An input condition with one or more virtual conditions */
-typedef struct
-{
-  GsmConditionType type;
-  GsmConditionFunc getter;
-
-  GQuark input;
-  GArray *conditions;
-  GArray *conditions_neg;
-} GsmStateMachineCondition;
-
 static GsmStateMachineCondition*
 gsm_state_machine_condition_new ()
 {
@@ -105,47 +181,28 @@ gsm_state_machine_input_condition_destroy (GsmStateMachineCondition* condition)
 {
   g_array_unref (condition->conditions);
   g_array_unref (condition->conditions_neg);
+  g_free (condition->enum_table);
+  g_free (condition->thresholds);
   g_free (condition);
 }
 
 static GsmStateMachineCondition*
-gsm_state_machine_condition_from_quark (GsmStateMachine *state_machine,
-                                        GQuark           condition)
+gsm_state_machine_condition_from_index (GsmStateMachine *state_machine,
+                                        guint            index)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  g_autofree gchar *str_free;
-  gchar *str;
-  gchar *separator;
-  GQuark input;
-
-  str = str_free = g_strdup (g_quark_to_string (condition));
-  separator = strchr(str, ':');
-  if (separator)
-    *separator = '\0';
-  while (str[0] == '!' || str[0] == '<' || str[0] == '>' || str[0] == '=')
-    str++;
 
-  input = g_quark_try_string (str);
-
-  for (gint i = 0; i < priv->input_conditions->len; i++)
+  for (gint i = 0; i < priv->def->input_conditions->len; i++)
     {
       GsmStateMachineCondition *cond;
-      cond = g_ptr_array_index (priv->input_conditions, i);
-      if (cond->input == input)
+      cond = g_ptr_array_index (priv->def->input_conditions, i);
+      if (index >= cond->first_index && index < cond->first_index + 2 * cond->conditions->len)
         return cond;
     }
 
   return NULL;
 }
 
-/* A value in the inputs/outputs dictionaries */
-typedef struct
-{
-  guint         idx;
-  GParamSpec   *pspec;
-  GValue        value;
-} GsmStateMachineValue;
-
 static GsmStateMachineValue*
 gsm_state_machine_value_new ()
 {
@@ -156,155 +213,66 @@ static void
 gsm_state_machine_value_destroy (GsmStateMachineValue *value)
 {
   g_clear_pointer (&value->pspec, g_param_spec_unref);
-  g_value_reset (&value->value);
+  g_clear_pointer (&value->conditions, g_ptr_array_unref);
+  g_value_unset (&value->value);
   g_free (value);
 }
 
-
-
-typedef struct
-{
-  gint    target_state;
-
-  GQuark event;
-  GArray *conditions;
-} GsmStateMachineTransition;
-
-static GsmStateMachineTransition*
-gsm_state_machine_transition_new ()
+static GsmStateMachineValue*
+gsm_state_machine_value_new_instance (const GsmStateMachineValue *def_value)
 {
-  GsmStateMachineTransition *res;
+  GsmStateMachineValue *res = gsm_state_machine_value_new ();
 
-  res = g_new0 (GsmStateMachineTransition, 1);
-  res->conditions = g_array_new (FALSE, TRUE, sizeof(GQuark));
+  res->idx = def_value->idx;
+  res->name = def_value->name;
+  res->pspec = def_value->pspec;
+  res->conditions = def_value->conditions;
+  res->tolerance = def_value->tolerance;
+  g_value_init (&res->value, G_VALUE_TYPE (&def_value->value));
+  g_value_copy (&def_value->value, &res->value);
 
   return res;
 }
 
 static void
-gsm_state_machine_transition_destroy (GsmStateMachineTransition *transition)
+gsm_state_machine_value_destroy_instance (GsmStateMachineValue *value)
 {
-  g_array_unref (transition->conditions);
-  g_free (transition);
+  g_value_unset (&value->value);
+  g_free (value);
 }
 
 
-struct _GsmStateMachineState
-{
-  GsmStateMachineState *parent;
-  GsmStateMachineState *leader;
-  GPtrArray            *all_children;
-
-  gint          value;
-  GQuark        nick;
-
-  /* This points either into a GsmStateMachineValue associated with an input or output,
-   * or it points into owned_values for a constant. */
-  GPtrArray    *outputs;
-  GPtrArray    *owned_values;
-
-  GPtrArray    *transitions;
-};
-
 
-static gint
-_condition_cmp (gconstpointer a, gconstpointer b)
+static GsmStateMachineTransition*
+gsm_state_machine_transition_new (guint n_conditions)
 {
-  const GQuark *qa, *qb;
-
-  qa = a;
-  qb = b;
+  GsmStateMachineTransition *res;
 
-  if (*qa < *qb)
-    return -1;
-  if (*qa > *qb)
-    return 1;
+  res = g_new0 (GsmStateMachineTransition, 1);
+  res->conditions = gsm_bitset_new (n_conditions);
 
-  return 0;
+  return res;
 }
 
 static void
-_condition_expand_positive (GQuark active, GsmStateMachineCondition *condition, GArray *target)
+gsm_state_machine_transition_destroy (GsmStateMachineTransition *transition)
 {
-  gboolean found;
-  gboolean lesser, greater;
-
-  /* Active may be 0 if this is a boolean (i.e. only one value), in which case it means
-   * it is the negated value; do a direct exit */
-  if (active == 0)
-    {
-      g_assert (condition->conditions->len == 1);
-
-      g_array_append_val (target, g_array_index (condition->conditions_neg, GQuark, 0));
-      return;
-    }
-
-  switch (condition->type)
-    {
-    case GSM_CONDITION_TYPE_EQ:
-      lesser = FALSE;
-      greater = FALSE;
-      break;
-    case GSM_CONDITION_TYPE_GEQ:
-      lesser = TRUE;
-      greater = FALSE;
-      break;
-    case GSM_CONDITION_TYPE_LEQ:
-      lesser = FALSE;
-      greater = TRUE;
-      break;
-    }
-
-  found = FALSE;
-  for (guint j = 0; j < condition->conditions->len; j++)
-    {
-      gboolean cond_state;
-      gboolean this = FALSE;
-
-      if (g_array_index (condition->conditions, GQuark, j) == active)
-        {
-          g_assert (found == FALSE);
-          found = TRUE;
-          this = TRUE;
-        }
-
-      if (this)
-        cond_state = TRUE;
-      else if (found)
-        cond_state = greater;
-      else
-        cond_state = lesser;
+  gsm_bitset_free (transition->conditions);
+  g_free (transition);
+}
 
-      if (cond_state)
-        g_array_append_val (target, g_array_index (condition->conditions, GQuark, j));
-      else
-        g_array_append_val (target, g_array_index (condition->conditions_neg, GQuark, j));
-    }
 
-  g_assert (found == TRUE);
-}
 
 static void
-_condition_expand_no_overlap (GQuark active, GsmStateMachineCondition *condition, GArray *target)
+_condition_expand_no_overlap (guint index, GsmStateMachineCondition *condition, GsmBitset *target)
 {
   gboolean negated;
   gint idx;
   gboolean supress_same_state;
   gboolean equal, lesser, greater;
 
-  for (idx = 0; idx < condition->conditions->len; idx++)
-    {
-      if (g_array_index (condition->conditions, GQuark, idx) == active)
-        {
-          negated = TRUE;
-          break;
-        }
-      if (g_array_index (condition->conditions_neg, GQuark, idx) == active)
-        {
-          negated = FALSE;
-          break;
-        }
-    }
+  idx = (index - condition->first_index) / 2;
+  negated = (index - condition->first_index) % 2 == 0;
   g_assert (idx < condition->conditions->len);
 
   /* For the lesser/greater equal cases the non-negated states must be
@@ -317,16 +285,20 @@ _condition_expand_no_overlap (GQuark active, GsmStateMachineCondition *condition
       greater = FALSE;
       supress_same_state = FALSE;
       break;
+    /* Only the lesser/greater conditions that are implied by the given
+     * one are left, which is the same set for both polarities: e.g. the
+     * disjoint set of ">=b" is "<b" and "<a", the one of "<b" is ">=b"
+     * and ">=c". */
     case GSM_CONDITION_TYPE_GEQ:
       equal = TRUE;
-      lesser = TRUE;
-      greater = FALSE;
+      lesser = FALSE;
+      greater = TRUE;
       supress_same_state = TRUE;
       break;
     case GSM_CONDITION_TYPE_LEQ:
       equal = TRUE;
-      lesser = FALSE;
-      greater = TRUE;
+      lesser = TRUE;
+      greater = FALSE;
       supress_same_state = TRUE;
       break;
     }
@@ -334,8 +306,11 @@ _condition_expand_no_overlap (GQuark active, GsmStateMachineCondition *condition
   if (negated)
     {
       equal = !equal;
-      lesser = !lesser;
-      greater = !greater;
+      if (condition->type == GSM_CONDITION_TYPE_EQ)
+        {
+          lesser = !lesser;
+          greater = !greater;
+        }
     }
 
   for (guint j = 0; j < condition->conditions->len; j++)
@@ -350,96 +325,90 @@ _condition_expand_no_overlap (GQuark active, GsmStateMachineCondition *condition
         cond_state = lesser;
 
       if (!supress_same_state || cond_state != negated)
-        {
-          if (cond_state)
-            g_array_append_val (target, g_array_index (condition->conditions, GQuark, j));
-          else
-            g_array_append_val (target, g_array_index (condition->conditions_neg, GQuark, j));
-        }
+        gsm_bitset_set (target, condition->first_index + 2 * j + (cond_state ? 0 : 1));
     }
 }
 
-typedef gboolean (GsmConditionsCompareFunc) (GArray *set, GArray *conditions);
+typedef gboolean (GsmConditionsCompareFunc) (const GsmBitset *set, const GsmBitset *conditions);
 
 static gboolean
-_conditions_is_subset (GArray *set, GArray *conditions)
+_conditions_is_disjunct (const GsmBitset *set, const GsmBitset *conditions)
 {
-  gint i, j;
-  /* Assume both sets are sorted, i.e. we only need to check that each
-   * element in conditions is included in set. */
-
-  for (i = 0, j = 0; i < conditions->len; i++)
-    {
-      GQuark condition = g_array_index (conditions, GQuark, i);
-
-      while ((j < set->len) && (g_array_index (set, GQuark, j) < condition))
-        j++;
+  return gsm_bitset_is_disjunct (set, conditions);
+}
 
-      if ((j >= set->len) || (condition != g_array_index (set, GQuark, j)))
-        return FALSE;
-    }
+static gint
+_machine_condition_index (GsmStateMachine *state_machine, GQuark condition)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-  return TRUE;
+  return GPOINTER_TO_INT (g_hash_table_lookup (priv->def->condition_indices, GUINT_TO_POINTER (condition))) - 1;
 }
 
 static gboolean
-_conditions_is_disjunct (GArray *set, GArray *conditions)
+_machine_has_condition (GsmStateMachine *state_machine, GQuark condition)
 {
-  gint i, j;
-  /* Assume both sets are sorted, i.e. we only need to check that each
-   * element in conditions is included in set. */
-
-  for (i = 0, j = 0; i < conditions->len; i++)
-    {
-      GQuark condition = g_array_index (conditions, GQuark, i);
+  return _machine_condition_index (state_machine, condition) >= 0;
+}
 
-      while ((j < set->len) && (g_array_index (set, GQuark, j) < condition))
-        j++;
+static gint
+_definition_event_index (GsmStateMachineDefinition *definition, GQuark event)
+{
+  return GPOINTER_TO_INT (g_hash_table_lookup (definition->event_indices, GUINT_TO_POINTER (event))) - 1;
+}
 
-      if ((j < set->len) && (condition == g_array_index (set, GQuark, j)))
-        return FALSE;
-    }
+static gint
+_machine_event_index (GsmStateMachine *state_machine, GQuark event)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-  return TRUE;
+  return _definition_event_index (priv->def, event);
 }
 
 static gboolean
-_machine_has_condition (GsmStateMachine *state_machine, GQuark condition)
+_machine_has_event (GsmStateMachine *state_machine, GQuark event)
+{
+  return _machine_event_index (state_machine, event) >= 0;
+}
+
+static void
+_machine_push_event (GsmStateMachine *state_machine, guint bucket)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GsmStateMachineCondition *input_cond;
 
-  for (guint i = 0; i < priv->input_conditions->len; i++)
+  if (priv->n_pending_events == priv->event_ring_size)
     {
-      input_cond = g_ptr_array_index (priv->input_conditions, i);
+      guint new_size = MAX (8, priv->event_ring_size * 2);
+      guint *ring = g_new (guint, new_size);
 
-      for (guint j = 0; j < input_cond->conditions->len; j++)
-        {
-          if (condition == g_array_index (input_cond->conditions, GQuark, j))
-            return TRUE;
+      for (guint i = 0; i < priv->n_pending_events; i++)
+        ring[i] = priv->event_ring[(priv->event_ring_head + i) & (priv->event_ring_size - 1)];
 
-          if (condition == g_array_index (input_cond->conditions_neg, GQuark, j))
-            return TRUE;
-        }
+      g_free (priv->event_ring);
+      priv->event_ring = ring;
+      priv->event_ring_size = new_size;
+      priv->event_ring_head = 0;
     }
 
-  return FALSE;
+  priv->event_ring[(priv->event_ring_head + priv->n_pending_events) & (priv->event_ring_size - 1)] = bucket;
+  priv->n_pending_events += 1;
+  priv->event_pending_count[bucket] += 1;
 }
 
-static gboolean
-_machine_has_event (GsmStateMachine *state_machine, GQuark event)
+static guint
+_machine_pop_event (GsmStateMachine *state_machine)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  guint bucket;
 
-  for (guint i = 0; i < priv->events->len; i++)
-    {
-      GQuark known_event = g_array_index (priv->events, GQuark, i);
+  g_assert (priv->n_pending_events > 0);
 
-      if (known_event == event)
-        return TRUE;
-    }
+  bucket = priv->event_ring[priv->event_ring_head];
+  priv->event_ring_head = (priv->event_ring_head + 1) & (priv->event_ring_size - 1);
+  priv->n_pending_events -= 1;
+  priv->event_pending_count[bucket] -= 1;
 
-  return FALSE;
+  return bucket;
 }
 
 static void
@@ -457,10 +426,13 @@ gsm_state_machine_state_ensure_outputs (GsmStateMachineState *state, GHashTable
 }
 
 static void
-_value_free (gpointer data)
+_output_value_free (gpointer data)
 {
-  g_value_reset ((GValue*) data);
-  g_free (data);
+  GsmStateMachineOutputValue *output_value = data;
+
+  if (G_IS_VALUE (&output_value->value))
+    g_value_unset (&output_value->value);
+  g_free (output_value);
 }
 
 static GsmStateMachineState*
@@ -471,7 +443,7 @@ gsm_state_machine_state_new (GQuark nick, gint value)
   /* We know that nick is from an GEnumValue */
   res->nick = nick;
   res->value = value;
-  res->owned_values = g_ptr_array_new_with_free_func (_value_free);
+  res->owned_values = g_ptr_array_new_with_free_func (_output_value_free);
   res->transitions = g_ptr_array_new_with_free_func ((GDestroyNotify) gsm_state_machine_transition_destroy);
 
   return res;
@@ -480,7 +452,8 @@ gsm_state_machine_state_new (GQuark nick, gint value)
 static GsmStateMachineTransition*
 gsm_state_machine_real_find_transition (GsmStateMachineState      *state,
                                         GQuark                     event,
-                                        GArray                    *conditions,
+                                        guint                      timeout,
+                                        GsmBitset                 *conditions,
                                         GsmConditionsCompareFunc   test_func)
 {
   for (guint i = 0; i < state->transitions->len; i++)
@@ -491,6 +464,11 @@ gsm_state_machine_real_find_transition (GsmStateMachineState      *state,
       if (event != item->event)
         continue;
 
+      /* Timed transitions only apply if no other one does and the
+       * shortest timeout wins, so only equal timeouts can overlap. */
+      if (timeout != item->timeout)
+        continue;
+
       if (test_func (conditions, item->conditions))
         return item;
     }
@@ -501,14 +479,15 @@ gsm_state_machine_real_find_transition (GsmStateMachineState      *state,
 static GsmStateMachineTransition*
 gsm_state_machine_find_transition (GsmStateMachineState      *state,
                                    GQuark                     event,
-                                   GArray                    *conditions,
+                                   guint                      timeout,
+                                   GsmBitset                 *conditions,
                                    GsmConditionsCompareFunc   test_func,
                                    GsmStateMachineState     **in_state)
 {
   do
     {
       GsmStateMachineTransition* res;
-      res = gsm_state_machine_real_find_transition (state, event, conditions, test_func);
+      res = gsm_state_machine_real_find_transition (state, event, timeout, conditions, test_func);
       if (res)
         {
           if (in_state)
@@ -526,13 +505,14 @@ gsm_state_machine_find_transition (GsmStateMachineState      *state,
 static GsmStateMachineTransition*
 gsm_state_machine_children_find_transition (GsmStateMachineState      *state,
                                             GQuark                     event,
-                                            GArray                    *conditions,
+                                            guint                      timeout,
+                                            GsmBitset                 *conditions,
                                             GsmConditionsCompareFunc   test_func,
                                             GsmStateMachineState     **in_state)
 {
   GsmStateMachineTransition* res;
 
-  res = gsm_state_machine_real_find_transition (state, event, conditions, test_func);
+  res = gsm_state_machine_real_find_transition (state, event, timeout, conditions, test_func);
   if (res)
     {
       if (in_state)
@@ -545,7 +525,7 @@ gsm_state_machine_children_find_transition (GsmStateMachineState      *state,
 
   for (guint i = 0; i < state->all_children->len; i++)
     {
-      res = gsm_state_machine_children_find_transition (g_ptr_array_index (state->all_children, i), event, conditions, test_func, in_state);
+      res = gsm_state_machine_children_find_transition (g_ptr_array_index (state->all_children, i), event, timeout, conditions, test_func, in_state);
       if (res)
         return res;
     }
@@ -558,23 +538,24 @@ gsm_state_machine_state_add_transition (GsmStateMachine            *state_machin
                                         GsmStateMachineState       *state,
                                         GsmStateMachineTransition  *transition)
 {
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
   GsmStateMachineState *in_state = NULL;
-  g_autoptr(GArray) conditions_neg = NULL;
+  g_autoptr(GsmBitset) conditions_neg = NULL;
 
-  conditions_neg = g_array_new (FALSE, FALSE, sizeof(GQuark));
+  conditions_neg = gsm_bitset_new (priv->def->condition_quarks->len);
 
   /* XXX: This is relatively slow unfortunately; but also executed seldomly! */
-  for (guint i = 0; i < transition->conditions->len; i++)
+  for (gint index = gsm_bitset_next (transition->conditions, 0);
+       index >= 0;
+       index = gsm_bitset_next (transition->conditions, index + 1))
     {
-      GQuark cond = g_array_index (transition->conditions, GQuark, i);
-      GsmStateMachineCondition *condition = gsm_state_machine_condition_from_quark (state_machine, cond);
+      GsmStateMachineCondition *condition = gsm_state_machine_condition_from_index (state_machine, index);
 
-      _condition_expand_no_overlap (cond, condition, conditions_neg);
+      _condition_expand_no_overlap (index, condition, conditions_neg);
     }
-  g_array_sort (conditions_neg, _condition_cmp);
 
-  if (gsm_state_machine_find_transition (state, transition->event, conditions_neg, _conditions_is_disjunct, &in_state) ||
-      gsm_state_machine_children_find_transition (state, transition->event, conditions_neg, _conditions_is_disjunct, &in_state))
+  if (gsm_state_machine_find_transition (state, transition->event, transition->timeout, conditions_neg, _conditions_is_disjunct, &in_state) ||
+      gsm_state_machine_children_find_transition (state, transition->event, transition->timeout, conditions_neg, _conditions_is_disjunct, &in_state))
     {
        g_critical ("Transition added to state \"%s\" conflicts with one in state \"%s\"",
                    g_quark_to_string (state->nick),
@@ -584,6 +565,7 @@ gsm_state_machine_state_add_transition (GsmStateMachine            *state_machin
     }
 
   g_ptr_array_add (state->transitions, transition);
+  priv->def->compiled = FALSE;
 }
 
 static void
@@ -616,10 +598,128 @@ gsm_state_machine_state_destroy (GsmStateMachineState *state)
   g_clear_pointer (&state->owned_values, g_ptr_array_unref);
   g_clear_pointer (&state->transitions, g_ptr_array_unref);
   g_clear_pointer (&state->all_children, g_ptr_array_unref);
+  g_clear_pointer (&state->compiled, g_array_unref);
+  g_clear_pointer (&state->compiled_offsets, g_free);
+  g_clear_pointer (&state->sensitive_inputs, gsm_bitset_free);
 
   g_free (state);
 }
 
+static GsmStateMachineDefinition*
+gsm_state_machine_definition_new (GType state_type)
+{
+  GsmStateMachineDefinition *def;
+  g_autoptr(GEnumClass) enum_class = NULL;
+
+  g_assert (G_TYPE_IS_ENUM (state_type));
+
+  def = g_new0 (GsmStateMachineDefinition, 1);
+  def->ref_count = 1;
+  def->state_type = state_type;
+
+  def->input_conditions = g_ptr_array_new_with_free_func ((GDestroyNotify) gsm_state_machine_input_condition_destroy);
+
+  def->events = g_array_new (FALSE, TRUE, sizeof (GQuark));
+  def->event_indices = g_hash_table_new (g_direct_hash, g_direct_equal);
+  def->inputs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) gsm_state_machine_value_destroy);
+  def->inputs_by_id = g_ptr_array_new ();
+  def->outputs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) gsm_state_machine_value_destroy);
+  def->outputs_by_id = g_ptr_array_new ();
+  def->outputs_quark = g_array_new (FALSE, TRUE, sizeof (GQuark));
+
+  def->condition_quarks = g_array_new (FALSE, TRUE, sizeof (GQuark));
+  def->condition_indices = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  def->states = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) gsm_state_machine_state_destroy);
+
+  /* Ensure the states dictionary is filled */
+  enum_class = G_ENUM_CLASS (g_type_class_ref (state_type));
+  if (!g_enum_get_value (enum_class, 0))
+    g_error ("Enum must contain a value of 0 for the initial state.");
+
+  def->all_state = gsm_state_machine_state_new (g_quark_from_static_string ("all"), -1);
+  gsm_state_machine_state_ensure_outputs (def->all_state, def->outputs);
+  def->last_group = -1;
+  g_hash_table_insert (def->states,
+                       GINT_TO_POINTER (-1),
+                       def->all_state);
+
+  for (guint i = 0; i < enum_class->n_values; i++)
+    {
+      GsmStateMachineState *state;
+      GEnumValue *enum_value = &enum_class->values[i];
+
+      if (enum_value->value < 0)
+        g_error ("Negative values are reserved by the state machine and cannot be used in the state enum type.");
+
+      state = gsm_state_machine_state_new (g_quark_from_static_string (enum_value->value_nick),
+                                           enum_value->value);
+      gsm_state_machine_state_reparent (state, def->all_state);
+      g_hash_table_insert (def->states,
+                           GINT_TO_POINTER (enum_value->value),
+                           state);
+
+      /* We may not add the zero state first, so just set it like this. */
+      if (state->value == 0)
+        def->all_state->leader = state;
+    }
+
+  g_assert (def->all_state->leader);
+
+  return def;
+}
+
+/**
+ * gsm_state_machine_definition_ref:
+ * @definition: a #GsmStateMachineDefinition
+ *
+ * Returns: (transfer full): @definition
+ */
+GsmStateMachineDefinition*
+gsm_state_machine_definition_ref (GsmStateMachineDefinition *definition)
+{
+  g_return_val_if_fail (definition != NULL, NULL);
+
+  g_atomic_int_inc (&definition->ref_count);
+
+  return definition;
+}
+
+void
+gsm_state_machine_definition_unref (GsmStateMachineDefinition *definition)
+{
+  g_return_if_fail (definition != NULL);
+
+  if (!g_atomic_int_dec_and_test (&definition->ref_count))
+    return;
+
+  g_clear_pointer (&definition->events, g_array_unref);
+  g_clear_pointer (&definition->event_indices, g_hash_table_unref);
+  g_clear_pointer (&definition->inputs, g_hash_table_unref);
+  g_clear_pointer (&definition->inputs_by_id, g_ptr_array_unref);
+  g_clear_pointer (&definition->outputs, g_hash_table_unref);
+  g_clear_pointer (&definition->outputs_by_id, g_ptr_array_unref);
+  g_clear_pointer (&definition->outputs_quark, g_array_unref);
+  g_clear_pointer (&definition->states, g_hash_table_unref);
+  g_clear_pointer (&definition->input_conditions, g_ptr_array_unref);
+  g_clear_pointer (&definition->condition_quarks, g_array_unref);
+  g_clear_pointer (&definition->condition_indices, g_hash_table_unref);
+  g_clear_pointer (&definition->instance_template, g_free);
+
+  g_free (definition);
+}
+
+G_DEFINE_BOXED_TYPE (GsmStateMachineDefinition, gsm_state_machine_definition,
+                     gsm_state_machine_definition_ref, gsm_state_machine_definition_unref)
+
+GType
+gsm_state_machine_definition_get_state_type (GsmStateMachineDefinition *definition)
+{
+  g_return_val_if_fail (definition != NULL, G_TYPE_NONE);
+
+  return definition->state_type;
+}
+
 /**
  * gsm_state_machine_new:
  * @state_type: The #GType of the state enum.
@@ -636,126 +736,374 @@ gsm_state_machine_new (GType state_type)
                        NULL);
 }
 
+/**
+ * gsm_state_machine_new_from_definition:
+ * @definition: a sealed #GsmStateMachineDefinition
+ *
+ * Create a new #GsmStateMachine that shares the definition (states, edges,
+ * conditions, inputs, outputs and events) of another machine, see
+ * gsm_state_machine_get_definition(). The machine starts in the initial
+ * state with all inputs at their default value.
+ *
+ * Returns: (transfer full): a newly created #GsmStateMachine
+ */
+GsmStateMachine *
+gsm_state_machine_new_from_definition (GsmStateMachineDefinition *definition)
+{
+  g_return_val_if_fail (definition != NULL, NULL);
+  g_return_val_if_fail (definition->sealed, NULL);
+
+  return g_object_new (GSM_TYPE_STATE_MACHINE,
+                       "definition", definition,
+                       NULL);
+}
+
 static void
 gsm_state_machine_finalize (GObject *object)
 {
   GsmStateMachine *self = (GsmStateMachine *)object;
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (self);
 
-  g_clear_pointer (&priv->events, g_array_unref);
-  g_clear_pointer (&priv->inputs, g_hash_table_unref);
-  g_clear_pointer (&priv->outputs, g_hash_table_unref);
-
+  g_clear_pointer (&priv->event_ring, g_free);
+  g_clear_pointer (&priv->event_pending_count, g_free);
+  g_clear_pointer (&priv->postbox, g_free);
+  g_clear_pointer (&priv->inputs_by_id, g_ptr_array_unref);
+  g_clear_pointer (&priv->changed_inputs, g_ptr_array_unref);
   g_clear_pointer (&priv->current_outputs, g_ptr_array_unref);
+  g_clear_pointer (&priv->snapshot_block, gsm_snapshot_block_unref);
+  g_clear_pointer (&priv->instance, gsm_instance_free);
+  g_clear_pointer (&priv->dirty_inputs, g_ptr_array_unref);
+
+  g_clear_pointer (&priv->def, gsm_state_machine_definition_unref);
 
-  g_clear_pointer (&priv->states, g_hash_table_unref);
+  if (priv->source)
+    g_source_destroy (priv->source);
+  g_clear_pointer (&priv->source, g_source_unref);
+  g_clear_pointer (&priv->context, g_main_context_unref);
 
-  g_clear_pointer (&priv->input_conditions, g_ptr_array_unref);
-  g_clear_pointer (&priv->active_conditions, g_array_unref);
-  g_clear_pointer (&priv->outputs_quark, g_array_unref);
+  if (priv->clock && gsm_clock_is_virtual (priv->clock))
+    gsm_clock_remove_timer (priv->clock, &priv->timer);
+  g_clear_object (&priv->clock);
 
-  if (priv->idle_source_id)
-    g_source_remove (priv->idle_source_id);
+  if (priv->scheduler)
+    {
+      gsm_scheduler_unqueue (priv->scheduler, &priv->scheduler_link);
+      gsm_scheduler_remove_timer (priv->scheduler, &priv->timer);
+    }
+  g_clear_object (&priv->scheduler);
 
   G_OBJECT_CLASS (gsm_state_machine_parent_class)->finalize (object);
 }
 
-static void
-gsm_state_machine_get_property (GObject    *object,
-                                guint       prop_id,
-                                GValue     *value,
-                                GParamSpec *pspec)
+/* The update source is created once and stays attached for the lifetime of
+ * the machine, it is (de)activated using the ready time. */
+typedef struct
 {
-  GsmStateMachine *self = GSM_STATE_MACHINE (object);
-
-  switch (prop_id)
-    {
-    case PROP_STATE:
-      g_value_set_int (value, gsm_state_machine_get_state (self));
-      break;
+  GSource          source;
+  GsmStateMachine *state_machine;
+} GsmStateMachineSource;
 
-    case PROP_STATE_TYPE:
-      g_value_set_gtype (value, gsm_state_machine_get_state_type (self));
-      break;
+/* Posts from other threads only wake up the context, the source notices
+ * them here. */
+static gboolean
+gsm_state_machine_source_prepare (GSource *source,
+                                  gint    *timeout)
+{
+  GsmStateMachineSource *sm_source = (GsmStateMachineSource *) source;
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (sm_source->state_machine);
 
-    case PROP_RUNNING:
-      g_value_set_boolean (value, gsm_state_machine_get_running (self));
-      break;
+  *timeout = -1;
 
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-    }
+  return g_atomic_int_get (&priv->post_pending) != 0;
 }
 
-static void
-gsm_state_machine_set_property (GObject      *object,
-                                guint         prop_id,
-                                const GValue *value,
-                                GParamSpec   *pspec)
+static gboolean
+gsm_state_machine_source_check (GSource *source)
 {
-  GsmStateMachine *self = GSM_STATE_MACHINE (object);
-  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (self);
-  g_autoptr(GEnumClass) enum_class = NULL;
-
+  GsmStateMachineSource *sm_source = (GsmStateMachineSource *) source;
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (sm_source->state_machine);
 
-  switch (prop_id)
-    {
-    case PROP_STATE_TYPE:
-      g_assert (priv->state_type == G_TYPE_NONE);
-      priv->state_type = g_value_get_gtype (value);
-      g_assert (G_TYPE_IS_ENUM (priv->state_type));
-
-      /* Ensure the states dictionary is filled */
-      enum_class = G_ENUM_CLASS (g_type_class_ref (g_value_get_gtype (value)));
-      if (!g_enum_get_value (enum_class, 0))
-        g_error ("Enum must contain a value of 0 for the initial state.");
-
-      priv->all_state = gsm_state_machine_state_new (g_quark_from_static_string ("all"), -1);
-      gsm_state_machine_state_ensure_outputs (priv->all_state, priv->outputs);
-      priv->last_group = -1;
-      g_hash_table_insert (priv->states,
-                           GINT_TO_POINTER (-1),
-                           priv->all_state);
-
-      for (guint i = 0; i < enum_class->n_values; i++)
-        {
-          GsmStateMachineState *state;
-          GEnumValue *enum_value = &enum_class->values[i];
-
-          if (enum_value->value < 0)
-            g_error ("Negative values are reserved by the state machine and cannot be used in the state enum type.");
-
-          state = gsm_state_machine_state_new (g_quark_from_static_string (enum_value->value_nick),
-                                               enum_value->value);
-          gsm_state_machine_state_reparent (state, priv->all_state);
-          g_hash_table_insert (priv->states,
-                               GINT_TO_POINTER (enum_value->value),
-                               state);
-
-          /* We may not add the zero state first, so just set it like this. */
-          if (state->value == 0)
-            priv->all_state->leader = state;
-        }
+  return g_atomic_int_get (&priv->post_pending) != 0;
+}
 
-      g_assert (priv->all_state->leader);
+static gboolean
+gsm_state_machine_source_dispatch (GSource     *source,
+                                   GSourceFunc  callback,
+                                   gpointer     user_data)
+{
+  GsmStateMachineSource *sm_source = (GsmStateMachineSource *) source;
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (sm_source->state_machine);
 
-      break;
+  /* Queues an update if one is needed */
+  gsm_state_machine_drain_posted (sm_source->state_machine);
+  if (!priv->running)
+    return G_SOURCE_CONTINUE;
 
-    case PROP_RUNNING:
-      gsm_state_machine_set_running (self, g_value_get_boolean (value));
+  /* Posts that did not queue an update only needed the drain */
+  if (!priv->update_queued &&
+      !(priv->timer_deadline && g_source_get_time (source) >= priv->timer_deadline))
+    return G_SOURCE_CONTINUE;
 
-      break;
+  /* Either an update was queued or the timer expired, in both cases the
+   * update re-arms the timer if needed. */
+  priv->update_queued = FALSE;
+  priv->timer_deadline = 0;
+  gsm_state_machine_internal_update_ready_time (sm_source->state_machine);
+  gsm_state_machine_dispatch (sm_source->state_machine);
 
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-    }
+  return G_SOURCE_CONTINUE;
 }
 
+static GSourceFuncs gsm_state_machine_source_funcs = {
+  .prepare = gsm_state_machine_source_prepare,
+  .check = gsm_state_machine_source_check,
+  .dispatch = gsm_state_machine_source_dispatch,
+};
+
+static void gsm_state_machine_internal_mark_input_dirty (GsmStateMachine      *state_machine,
+                                                         GsmStateMachineValue *input_value);
+static GValue* gsm_state_machine_internal_resolve_output (GsmStateMachine            *state_machine,
+                                                         GsmStateMachineOutputValue *output_value);
+
+/* Sets up the per machine data for everything in the definition */
 static void
-gsm_state_machine_class_init (GsmStateMachineClass *klass)
+gsm_state_machine_internal_init_instance (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineDefinition *def = priv->def;
+
+  priv->instance = gsm_instance_internal_new (def);
+  priv->event_pending_count = g_new0 (guint, def->events->len + 1);
+
+  for (guint i = 0; i < def->inputs_by_id->len; i++)
+    {
+      GsmStateMachineValue *input_value;
+
+      input_value = gsm_state_machine_value_new_instance (g_ptr_array_index (def->inputs_by_id, i));
+      g_ptr_array_add (priv->inputs_by_id, input_value);
+
+      /* Evaluate the conditions on the first update */
+      gsm_state_machine_internal_mark_input_dirty (state_machine, input_value);
+    }
+
+  for (guint i = 0; i < def->outputs_by_id->len; i++)
+    g_ptr_array_add (priv->current_outputs,
+                     gsm_state_machine_internal_resolve_output (state_machine, g_ptr_array_index (def->all_state->outputs, i)));
+}
+
+static void
+gsm_state_machine_constructed (GObject *object)
+{
+  GsmStateMachine *self = (GsmStateMachine *)object;
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (self);
+  GsmStateMachineSource *source;
+
+  G_OBJECT_CLASS (gsm_state_machine_parent_class)->constructed (object);
+
+  if (!priv->def)
+    g_error ("Either a state type or a definition is required.");
+  gsm_state_machine_internal_init_instance (self);
+
+  if (priv->clock && gsm_clock_is_virtual (priv->clock))
+    gsm_timer_init (&priv->timer, gsm_state_machine_internal_virtual_timer_expired, self);
+  else
+    gsm_timer_init (&priv->timer, gsm_state_machine_internal_timer_expired, self);
+  priv->instance->state_entered = gsm_state_machine_internal_now (self);
+
+  if (priv->scheduler)
+    {
+      GMainContext *context = gsm_scheduler_get_main_context (priv->scheduler);
+
+      if (priv->context && priv->context != context)
+        g_critical ("The main context must match the one of the scheduler, using the scheduler's");
+
+      g_clear_pointer (&priv->context, g_main_context_unref);
+      priv->context = g_main_context_ref (context);
+      priv->scheduler_link.data = self;
+      priv->scheduler_post.state_machine = self;
+
+      return;
+    }
+
+  if (!priv->context)
+    priv->context = g_main_context_ref_thread_default ();
+
+  source = (GsmStateMachineSource *) g_source_new (&gsm_state_machine_source_funcs, sizeof (GsmStateMachineSource));
+  source->state_machine = self;
+  priv->source = (GSource *) source;
+
+  g_source_set_name (priv->source, "GsmStateMachine update");
+  g_source_set_priority (priv->source, priv->priority);
+  g_source_set_ready_time (priv->source, -1);
+  g_source_attach (priv->source, priv->context);
+}
+
+static void
+gsm_state_machine_get_property (GObject    *object,
+                                guint       prop_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+  GsmStateMachine *self = GSM_STATE_MACHINE (object);
+
+  switch (prop_id)
+    {
+    case PROP_STATE:
+      g_value_set_int (value, gsm_state_machine_get_state (self));
+      break;
+
+    case PROP_STATE_TYPE:
+      g_value_set_gtype (value, gsm_state_machine_get_state_type (self));
+      break;
+
+    case PROP_DEFINITION:
+      g_value_set_boxed (value, gsm_state_machine_get_definition (self));
+      break;
+
+    case PROP_RUNNING:
+      g_value_set_boolean (value, gsm_state_machine_get_running (self));
+      break;
+
+    case PROP_UPDATE_MODE:
+      g_value_set_enum (value, gsm_state_machine_get_update_mode (self));
+      break;
+
+    case PROP_MAX_STEPS:
+      g_value_set_uint (value, gsm_state_machine_get_max_steps (self));
+      break;
+
+    case PROP_MAIN_CONTEXT:
+      g_value_set_boxed (value, gsm_state_machine_get_main_context (self));
+      break;
+
+    case PROP_PRIORITY:
+      g_value_set_int (value, gsm_state_machine_get_priority (self));
+      break;
+
+    case PROP_SCHEDULER:
+      g_value_set_object (value, gsm_state_machine_get_scheduler (self));
+      break;
+
+    case PROP_CLOCK:
+      g_value_set_object (value, gsm_state_machine_get_clock (self));
+      break;
+
+    case PROP_EVENT_CAPACITY:
+      g_value_set_uint (value, gsm_state_machine_get_event_capacity (self));
+      break;
+
+    case PROP_EVENT_OVERFLOW_POLICY:
+      g_value_set_enum (value, gsm_state_machine_get_event_overflow_policy (self));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gsm_state_machine_set_property (GObject      *object,
+                                guint         prop_id,
+                                const GValue *value,
+                                GParamSpec   *pspec)
+{
+  GsmStateMachine *self = GSM_STATE_MACHINE (object);
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (self);
+
+  switch (prop_id)
+    {
+    case PROP_STATE_TYPE:
+      /* The default (abstract) enum type means the definition is used */
+      if (g_value_get_gtype (value) == G_TYPE_ENUM)
+        break;
+
+      if (priv->def)
+        {
+          if (priv->def->state_type != g_value_get_gtype (value))
+            g_critical ("The state type does not match the one of the definition");
+          break;
+        }
+
+      priv->def = gsm_state_machine_definition_new (g_value_get_gtype (value));
+
+      break;
+
+    case PROP_DEFINITION:
+      if (!g_value_get_boxed (value))
+        break;
+
+      /* Replace the empty one created from the state type */
+      if (priv->def)
+        {
+          if (priv->def->state_type != ((GsmStateMachineDefinition *) g_value_get_boxed (value))->state_type)
+            g_critical ("The state type does not match the one of the definition");
+          g_clear_pointer (&priv->def, gsm_state_machine_definition_unref);
+        }
+
+      priv->def = g_value_dup_boxed (value);
+      g_assert (priv->def->sealed);
+
+      break;
+
+    case PROP_RUNNING:
+      gsm_state_machine_set_running (self, g_value_get_boolean (value));
+
+      break;
+
+    case PROP_UPDATE_MODE:
+      gsm_state_machine_set_update_mode (self, g_value_get_enum (value));
+
+      break;
+
+    case PROP_MAX_STEPS:
+      gsm_state_machine_set_max_steps (self, g_value_get_uint (value));
+
+      break;
+
+    case PROP_MAIN_CONTEXT:
+      g_assert (priv->context == NULL);
+      priv->context = g_value_dup_boxed (value);
+
+      break;
+
+    case PROP_PRIORITY:
+      gsm_state_machine_set_priority (self, g_value_get_int (value));
+
+      break;
+
+    case PROP_SCHEDULER:
+      g_assert (priv->scheduler == NULL);
+      priv->scheduler = g_value_dup_object (value);
+
+      break;
+
+    case PROP_CLOCK:
+      g_assert (priv->clock == NULL);
+      priv->clock = g_value_dup_object (value);
+
+      break;
+
+    case PROP_EVENT_CAPACITY:
+      gsm_state_machine_set_event_capacity (self, g_value_get_uint (value));
+
+      break;
+
+    case PROP_EVENT_OVERFLOW_POLICY:
+      gsm_state_machine_set_event_overflow_policy (self, g_value_get_enum (value));
+
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gsm_state_machine_class_init (GsmStateMachineClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->constructed = gsm_state_machine_constructed;
   object_class->finalize = gsm_state_machine_finalize;
   object_class->get_property = gsm_state_machine_get_property;
   object_class->set_property = gsm_state_machine_set_property;
@@ -775,12 +1123,75 @@ gsm_state_machine_class_init (GsmStateMachineClass *klass)
                         G_TYPE_ENUM,
                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  /* Reading the definition seals it */
+  properties[PROP_DEFINITION] =
+    g_param_spec_boxed ("definition", "Definition",
+                        "The (shared) definition of the machine, used instead of the state type",
+                        GSM_TYPE_STATE_MACHINE_DEFINITION,
+                        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   properties[PROP_RUNNING] =
     g_param_spec_boolean ("running", "Running",
                           "Whether the state machine is updating from an idle handler",
                           FALSE,
                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_UPDATE_MODE] =
+    g_param_spec_enum ("update-mode", "UpdateMode",
+                       "Whether one or all pending transitions are done per update",
+                       GSM_TYPE_UPDATE_MODE,
+                       GSM_UPDATE_MODE_SINGLE_STEP,
+                       G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_MAX_STEPS] =
+    g_param_spec_uint ("max-steps", "MaxSteps",
+                       "Maximum number of steps per update when running to completion",
+                       1,
+                       G_MAXUINT,
+                       32,
+                       G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_MAIN_CONTEXT] =
+    g_param_spec_boxed ("main-context", "MainContext",
+                        "The main context to update in (default: thread default at construction)",
+                        G_TYPE_MAIN_CONTEXT,
+                        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_PRIORITY] =
+    g_param_spec_int ("priority", "Priority",
+                      "The priority of the update source",
+                      G_MININT,
+                      G_MAXINT,
+                      G_PRIORITY_DEFAULT_IDLE,
+                      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_SCHEDULER] =
+    g_param_spec_object ("scheduler", "Scheduler",
+                         "A scheduler to update from instead of an own source",
+                         GSM_TYPE_SCHEDULER,
+                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_CLOCK] =
+    g_param_spec_object ("clock", "Clock",
+                         "The clock for timeout edges (default: monotonic time)",
+                         GSM_TYPE_CLOCK,
+                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_EVENT_CAPACITY] =
+    g_param_spec_uint ("event-capacity", "EventCapacity",
+                       "Maximum number of pending events, 0 for no limit",
+                       0,
+                       G_MAXUINT,
+                       0,
+                       G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_EVENT_OVERFLOW_POLICY] =
+    g_param_spec_enum ("event-overflow-policy", "EventOverflowPolicy",
+                       "What happens to events queued while the queue is full",
+                       GSM_TYPE_EVENT_OVERFLOW_POLICY,
+                       GSM_EVENT_OVERFLOW_DROP_OLDEST,
+                       G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, N_PROPS, properties);
 
   signals[SIGNAL_STATE_ENTER] =
@@ -830,49 +1241,84 @@ gsm_state_machine_init (GsmStateMachine *self)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (self);
 
-  priv->state_type = G_TYPE_NONE;
+  priv->update_mode = GSM_UPDATE_MODE_SINGLE_STEP;
+  priv->max_steps = 32;
 
-  priv->input_conditions = g_ptr_array_new_with_free_func ((GDestroyNotify) gsm_state_machine_input_condition_destroy);
+  priv->inputs_by_id = g_ptr_array_new_with_free_func ((GDestroyNotify) gsm_state_machine_value_destroy_instance);
+  priv->changed_inputs = g_ptr_array_new ();
+  priv->dirty_inputs = g_ptr_array_new ();
+  priv->current_outputs = g_ptr_array_new ();
+}
 
-  priv->events = g_array_new (FALSE, TRUE, sizeof (GQuark));
-  priv->inputs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) gsm_state_machine_value_destroy);
-  priv->outputs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) gsm_state_machine_value_destroy);
+static void
+gsm_state_machine_internal_update_conditionals (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-  priv->current_outputs = g_ptr_array_new ();
+  /* Only conditions of inputs that changed since the last update are
+   * evaluated, each one only touches its own bits in the active set. */
+  for (guint i = 0; i < priv->dirty_inputs->len; i++)
+    {
+      GsmStateMachineValue *input_value = g_ptr_array_index (priv->dirty_inputs, i);
 
-  priv->outputs_quark = g_array_new (FALSE, TRUE, sizeof (GQuark));
+      input_value->dirty = FALSE;
 
-  priv->active_conditions = g_array_new (TRUE, TRUE, sizeof (GQuark));
+      for (guint j = 0; j < input_value->conditions->len; j++)
+        gsm_instance_internal_evaluate (priv->instance, g_ptr_array_index (input_value->conditions, j), &input_value->value);
+    }
 
-  priv->states = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) gsm_state_machine_state_destroy);
+  g_ptr_array_set_size (priv->dirty_inputs, 0);
 }
 
 static void
-gsm_state_machine_internal_update_conditionals (GsmStateMachine *state_machine)
+gsm_state_machine_internal_mark_input_dirty (GsmStateMachine      *state_machine,
+                                             GsmStateMachineValue *input_value)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-  g_array_set_size (priv->active_conditions, 0);
+  if (input_value->dirty || input_value->conditions->len == 0)
+    return;
 
-  for (guint i = 0; i < priv->input_conditions->len; i++)
-    {
-      GsmStateMachineCondition *condition;
-      GValue value = G_VALUE_INIT;
-      GQuark active;
+  input_value->dirty = TRUE;
+  g_ptr_array_add (priv->dirty_inputs, input_value);
+}
+
+static gboolean
+gsm_state_machine_internal_input_is_sensitive (GsmStateMachine      *state_machine,
+                                               GsmStateMachineValue *input_value)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-      condition = g_ptr_array_index (priv->input_conditions, i);
+  if (!priv->def->compiled)
+    return TRUE;
 
-      gsm_state_machine_get_input_value (state_machine, g_quark_to_string (condition->input), &value);
-      active = condition->getter (condition->input, condition->type, &value);
+  return gsm_bitset_get (priv->instance->current_state->sensitive_inputs, input_value->idx);
+}
 
-      _condition_expand_positive (active, condition, priv->active_conditions);
-    }
+/* The value of the output for this machine */
+static GValue*
+gsm_state_machine_internal_resolve_output (GsmStateMachine            *state_machine,
+                                           GsmStateMachineOutputValue *output_value)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
 
-  g_array_sort (priv->active_conditions, _condition_cmp);
+  if (!output_value)
+    return NULL;
+
+  if (output_value->input < 0)
+    return &output_value->value;
+
+  input_value = g_ptr_array_index (priv->inputs_by_id, output_value->input);
+
+  return &input_value->value;
 }
 
 static void
-gsm_state_machine_internal_update_outputs (GsmStateMachine *state_machine, GsmStateMachineState *sm_state_real)
+gsm_state_machine_internal_update_outputs (GsmStateMachine      *state_machine,
+                                           GsmStateMachineState *sm_state_real,
+                                           gboolean              state_change,
+                                           gboolean              intermediate)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
   g_autoptr(GPtrArray)  old_outputs = NULL;
@@ -897,7 +1343,8 @@ gsm_state_machine_internal_update_outputs (GsmStateMachine *state_machine, GsmSt
 
               /* The state might not have the full array. */
               if (i < sm_state_real->outputs->len)
-                g_ptr_array_index (priv->current_outputs, i) = g_ptr_array_index (sm_state_real->outputs, i);
+                g_ptr_array_index (priv->current_outputs, i) =
+                  gsm_state_machine_internal_resolve_output (state_machine, g_ptr_array_index (sm_state_real->outputs, i));
 
               if (g_ptr_array_index (priv->current_outputs, i) == NULL)
                 output_missing = TRUE;
@@ -920,156 +1367,417 @@ gsm_state_machine_internal_update_outputs (GsmStateMachine *state_machine, GsmSt
       if (old_value == new_value)
         continue;
 
+      priv->generation += 1;
       g_signal_emit (state_machine,
                      signals[SIGNAL_OUTPUT_CHANGED],
-                     g_array_index (priv->outputs_quark, GQuark, i),
-                     g_quark_to_string (g_array_index (priv->outputs_quark, GQuark, i)),
-                     new_value, TRUE);
+                     g_array_index (priv->def->outputs_quark, GQuark, i),
+                     g_quark_to_string (g_array_index (priv->def->outputs_quark, GQuark, i)),
+                     new_value, state_change, intermediate);
+    }
+}
+
+/* Flattens the transitions of every leaf state and its parents into one
+ * table and resolves group leaders. Adding edges or groups invalidates it. */
+void
+gsm_state_machine_definition_compile (GsmStateMachineDefinition *definition)
+{
+  GHashTableIter iter;
+  GsmStateMachineState *state;
+  g_autofree guint *condition_inputs = NULL;
+  guint n_buckets;
+
+  if (definition->compiled)
+    return;
+
+  /* Input of each dense condition index */
+  condition_inputs = g_new (guint, definition->condition_quarks->len);
+  for (guint i = 0; i < definition->input_conditions->len; i++)
+    {
+      GsmStateMachineCondition *condition = g_ptr_array_index (definition->input_conditions, i);
+
+      for (guint j = 0; j < 2 * condition->conditions->len; j++)
+        condition_inputs[condition->first_index + j] = condition->input_idx;
+    }
+
+  g_hash_table_iter_init (&iter, definition->states);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &state))
+    {
+      state->real = state;
+      while (state->real->leader)
+        state->real = state->real->leader;
+    }
+
+  n_buckets = definition->events->len + 1;
+
+  g_hash_table_iter_init (&iter, definition->states);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &state))
+    {
+      g_autofree guint *fill = NULL;
+      guint fill_timed;
+      guint n_timed = 0;
+
+      /* Groups are never active, so they do not need a table. */
+      if (state->value < 0)
+        continue;
+
+      if (!state->compiled)
+        state->compiled = g_array_new (FALSE, FALSE, sizeof (GsmStateMachineCompiledTransition));
+      g_free (state->compiled_offsets);
+      state->compiled_offsets = g_new0 (guint, n_buckets + 1);
+      g_clear_pointer (&state->sensitive_inputs, gsm_bitset_free);
+      state->sensitive_inputs = gsm_bitset_new (definition->inputs_by_id->len);
+
+      /* Count the transitions of each bucket, then sort them in keeping
+       * the order within each bucket. */
+      for (GsmStateMachineState *parent = state; parent; parent = parent->parent)
+        {
+          for (guint i = 0; i < parent->transitions->len; i++)
+            {
+              GsmStateMachineTransition *transition = g_ptr_array_index (parent->transitions, i);
+
+              state->compiled_offsets[_definition_event_index (definition, transition->event) + 2] += 1;
+              if (transition->timeout)
+                n_timed++;
+            }
+        }
+
+      for (guint b = 1; b <= n_buckets; b++)
+        state->compiled_offsets[b] += state->compiled_offsets[b - 1];
+
+      fill = g_new (guint, n_buckets);
+      memcpy (fill, state->compiled_offsets, n_buckets * sizeof (guint));
+      g_array_set_size (state->compiled, state->compiled_offsets[n_buckets]);
+
+      /* Timed transitions (never with an event) go to the end of bucket 0 */
+      fill_timed = state->compiled_offsets[1] - n_timed;
+
+      for (GsmStateMachineState *parent = state; parent; parent = parent->parent)
+        {
+          for (guint i = 0; i < parent->transitions->len; i++)
+            {
+              GsmStateMachineTransition *transition = g_ptr_array_index (parent->transitions, i);
+              GsmStateMachineCompiledTransition *entry;
+              guint bucket = _definition_event_index (definition, transition->event) + 1;
+
+              if (transition->timeout)
+                entry = &g_array_index (state->compiled, GsmStateMachineCompiledTransition, fill_timed++);
+              else
+                entry = &g_array_index (state->compiled, GsmStateMachineCompiledTransition, fill[bucket]++);
+              entry->conditions = transition->conditions;
+              entry->target = g_hash_table_lookup (definition->states, GINT_TO_POINTER (transition->target_state));
+              g_assert (entry->target);
+              entry->real_target = entry->target->real;
+              entry->timeout = transition->timeout;
+
+              for (gint bit = gsm_bitset_next (transition->conditions, 0);
+                   bit >= 0;
+                   bit = gsm_bitset_next (transition->conditions, bit + 1))
+                gsm_bitset_set (state->sensitive_inputs, condition_inputs[bit]);
+            }
+        }
+
+      /* Shortest timeout first, stable so that the order is kept otherwise */
+      for (guint i = state->compiled_offsets[1] - n_timed + 1; i < state->compiled_offsets[1]; i++)
+        {
+          GsmStateMachineCompiledTransition tmp = g_array_index (state->compiled, GsmStateMachineCompiledTransition, i);
+          guint j = i;
+
+          for (; j > state->compiled_offsets[1] - n_timed; j--)
+            {
+              if (g_array_index (state->compiled, GsmStateMachineCompiledTransition, j - 1).timeout <= tmp.timeout)
+                break;
+              g_array_index (state->compiled, GsmStateMachineCompiledTransition, j) =
+                g_array_index (state->compiled, GsmStateMachineCompiledTransition, j - 1);
+            }
+          g_array_index (state->compiled, GsmStateMachineCompiledTransition, j) = tmp;
+        }
     }
+
+  definition->compiled = TRUE;
 }
 
 static gboolean
-gsm_state_machine_internal_set_state (GsmStateMachine *state_machine, gint target_state)
+gsm_state_machine_internal_set_state (GsmStateMachine                         *state_machine,
+                                      const GsmStateMachineCompiledTransition *transition)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  gint old_state;
+  gint old_state, target_state;
   GsmStateMachineState *sm_state_old;
   GsmStateMachineState *sm_state_new;
   GsmStateMachineState *sm_state_real;
+  gboolean intermediate;
 
-  old_state = priv->state;
-  sm_state_old = g_hash_table_lookup (priv->states, GINT_TO_POINTER (old_state));
-  g_assert (sm_state_old);
-
-  sm_state_new = g_hash_table_lookup (priv->states, GINT_TO_POINTER (target_state));
-  g_assert (sm_state_new);
+  sm_state_old = priv->instance->current_state;
+  old_state = sm_state_old->value;
 
-  sm_state_real = sm_state_new;
-  while (sm_state_real->leader)
-    sm_state_real = sm_state_real->leader;
+  sm_state_new = transition->target;
+  sm_state_real = transition->real_target;
 
   if (sm_state_old == sm_state_real)
     return FALSE;
 
   target_state = sm_state_real->value;
+  intermediate = gsm_instance_internal_is_transient (priv->instance->active_conditions, sm_state_real);
 
   g_signal_emit (state_machine,
                  signals[SIGNAL_STATE_EXIT],
                  sm_state_old->nick,
-                 old_state, target_state);
+                 old_state, target_state, intermediate);
 
-  g_debug ("Doing transition from state \"%s\" to state \"%s\" (\"%s\")",
+  g_debug ("Doing transition from state \"%s\" to state \"%s\" (\"%s\")%s",
            g_quark_to_string (sm_state_old->nick),
            g_quark_to_string (sm_state_real->nick),
-           sm_state_new != sm_state_real ? g_quark_to_string (sm_state_new->nick) : "-");
+           sm_state_new != sm_state_real ? g_quark_to_string (sm_state_new->nick) : "-",
+           intermediate ? ", intermediate" : "");
 
-  priv->state = target_state;
+  priv->instance->current_state = sm_state_real;
+  priv->instance->state_entered = gsm_state_machine_internal_now (state_machine);
+  priv->generation += 1;
+  priv->n_transitions += 1;
   g_object_notify_by_pspec (G_OBJECT (state_machine), properties[PROP_STATE]);
 
-  gsm_state_machine_internal_update_outputs (state_machine, sm_state_real);
+  gsm_state_machine_internal_update_outputs (state_machine, sm_state_real, TRUE, intermediate);
 
   g_signal_emit (state_machine,
                  signals[SIGNAL_STATE_ENTER],
                  sm_state_new->nick,
-                 target_state, old_state);
-
-  /* We may need further updates */
-  gsm_state_machine_internal_queue_update (state_machine);
+                 target_state, old_state, intermediate);
 
   return TRUE;
 }
 
-static gboolean
-gsm_state_machine_internal_get_next_state (GsmStateMachine *state_machine, gint start_state, gint *new_state)
-{
-  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GsmStateMachineState *sm_state = NULL;
-  GsmStateMachineTransition *transition;
-
-  sm_state = g_hash_table_lookup (priv->states, GINT_TO_POINTER (start_state));
-  g_assert (sm_state);
-
-  transition = gsm_state_machine_find_transition (sm_state, priv->active_event, priv->active_conditions, _conditions_is_subset, NULL);
-  if (transition)
-    {
-      *new_state = transition->target_state;
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-static void
+/* Does one transition, or processes one event if the machine is stable. */
+static GsmStepResult
 gsm_state_machine_internal_update (GsmStateMachine *state_machine)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  gint next_state;
-  gboolean transitioned;
+  const GsmStateMachineCompiledTransition *transition;
+  gint64 elapsed;
 
+  gsm_state_machine_definition_compile (priv->def);
   gsm_state_machine_internal_update_conditionals (state_machine);
 
-  transitioned = gsm_state_machine_internal_get_next_state (state_machine, priv->state, &next_state);
-  if (transitioned)
-    transitioned = gsm_state_machine_internal_set_state (state_machine, next_state);
+  elapsed = gsm_state_machine_internal_now (state_machine) - priv->instance->state_entered;
 
-  if (!transitioned)
+  transition = gsm_instance_internal_find_transition (priv->instance->active_conditions, priv->instance->current_state, 0, elapsed);
+  if (transition && gsm_state_machine_internal_set_state (state_machine, transition))
+    return GSM_STEP_RESULT_TRANSITION;
+
+  /* The state machine is currently stable, we can execute an event if one is pending */
+  if (priv->n_pending_events == 0)
     {
-      /* The state machine is currently stable, we can execute an event if one is pending */
-      if (!priv->pending_events)
-        return;
+      gsm_state_machine_internal_arm_timer (state_machine, elapsed);
+      return GSM_STEP_RESULT_STABLE;
+    }
 
-      priv->active_event = GPOINTER_TO_INT (priv->pending_events->data);
-      priv->pending_events = g_list_delete_link (priv->pending_events, priv->pending_events);
+  priv->active_event = _machine_pop_event (state_machine);
 
-      /* Re-check if the event caused a transition. */
-      transitioned = gsm_state_machine_internal_get_next_state (state_machine, priv->state, &next_state);
-      priv->active_event = 0;
+  /* Re-check if the event caused a transition. */
+  transition = gsm_instance_internal_find_transition (priv->instance->active_conditions, priv->instance->current_state, priv->active_event, elapsed);
+  priv->active_event = 0;
 
-      if (transitioned)
-        gsm_state_machine_internal_set_state (state_machine, next_state);
-    }
+  if (transition && gsm_state_machine_internal_set_state (state_machine, transition))
+    return GSM_STEP_RESULT_TRANSITION;
+
+  return GSM_STEP_RESULT_EVENT_DROPPED;
 }
 
-static gboolean
-gsm_state_machine_internal_idle_update (gpointer user_data)
+void
+gsm_state_machine_dispatch (GsmStateMachine *state_machine)
 {
-  GsmStateMachine *state_machine = GSM_STATE_MACHINE (user_data);
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  guint steps;
+
+  /* Never run on a partially updated set of inputs */
+  if (priv->update_depth > 0)
+    {
+      priv->update_deferred = TRUE;
+      return;
+    }
 
-  priv->idle_source_id = 0;
+  steps = priv->update_mode == GSM_UPDATE_MODE_RUN_TO_COMPLETION ? priv->max_steps : 1;
 
-  gsm_state_machine_internal_update (state_machine);
+  while (steps > 0 && gsm_state_machine_internal_update (state_machine) != GSM_STEP_RESULT_STABLE)
+    steps--;
 
-  return G_SOURCE_REMOVE;
+  /* Out of budget, continue in the next main loop iteration */
+  if (steps == 0)
+    gsm_state_machine_internal_queue_update (state_machine);
+  else
+    gsm_state_machine_internal_publish (state_machine);
 }
 
+/* Makes the current state and outputs visible to snapshots, called
+ * whenever the machine settled. */
 static void
-gsm_state_machine_internal_queue_update (GsmStateMachine *state_machine)
+gsm_state_machine_internal_publish (GsmStateMachine *state_machine)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-  if (!priv->running)
+  if (!priv->snapshot_block)
     return;
 
-  if (priv->idle_source_id)
-    return;
-  priv->idle_source_id = g_idle_add (gsm_state_machine_internal_idle_update, state_machine);
+  gsm_snapshot_block_publish (priv->snapshot_block,
+                              priv->instance->current_state->value,
+                              priv->n_transitions,
+                              priv->current_outputs);
 }
 
-gint
-gsm_state_machine_get_state (GsmStateMachine  *state_machine)
+/* Whether an update will run that may still change the state, in which
+ * case publishing is left to it. */
+static gboolean
+gsm_state_machine_internal_update_pending (GsmStateMachine *state_machine)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-  return priv->state;
+  if (priv->update_queued || priv->update_deferred || priv->n_pending_events > 0)
+    return TRUE;
+
+  return priv->scheduler && gsm_scheduler_is_queued (priv->scheduler, &priv->scheduler_link);
 }
 
-GType
-gsm_state_machine_get_state_type (GsmStateMachine  *state_machine)
+GsmSnapshotBlock*
+gsm_state_machine_get_snapshot_block (GsmStateMachine *state_machine)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-  return priv->state_type;
+  /* The outputs cannot change anymore */
+  gsm_state_machine_get_definition (state_machine);
+
+  if (!priv->snapshot_block)
+    priv->snapshot_block = gsm_snapshot_block_new (priv->instance->current_state->value,
+                                                   priv->n_transitions,
+                                                   priv->current_outputs);
+
+  return priv->snapshot_block;
+}
+
+static void
+gsm_state_machine_internal_queue_update (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  if (!priv->running)
+    return;
+
+  if (priv->scheduler)
+    {
+      gsm_scheduler_queue (priv->scheduler, &priv->scheduler_link);
+    }
+  else
+    {
+      priv->update_queued = TRUE;
+      gsm_state_machine_internal_update_ready_time (state_machine);
+    }
+}
+
+/* Without a scheduler the update source doubles as the timer */
+static void
+gsm_state_machine_internal_update_ready_time (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  if (!priv->running)
+    g_source_set_ready_time (priv->source, -1);
+  else if (priv->update_queued)
+    g_source_set_ready_time (priv->source, 0);
+  else if (priv->timer_deadline)
+    g_source_set_ready_time (priv->source, priv->timer_deadline);
+  else
+    g_source_set_ready_time (priv->source, -1);
+}
+
+static gint64
+gsm_state_machine_internal_now (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  if (priv->clock)
+    return gsm_clock_get_time (priv->clock);
+
+  return g_get_monotonic_time ();
+}
+
+static void
+gsm_state_machine_internal_timer_expired (gpointer user_data)
+{
+  gsm_state_machine_internal_queue_update (GSM_STATE_MACHINE (user_data));
+}
+
+/* Called while the virtual clock is at the expiry time, so the update has
+ * to happen right away. */
+static void
+gsm_state_machine_internal_virtual_timer_expired (gpointer user_data)
+{
+  GsmStateMachine *state_machine = GSM_STATE_MACHINE (user_data);
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  guint steps = priv->max_steps;
+
+  if (!priv->running)
+    return;
+
+  if (priv->update_depth > 0)
+    {
+      priv->update_deferred = TRUE;
+      return;
+    }
+
+  while (steps > 0 && gsm_state_machine_internal_update (state_machine) != GSM_STEP_RESULT_STABLE)
+    steps--;
+
+  if (steps == 0)
+    gsm_state_machine_internal_queue_update (state_machine);
+  else
+    gsm_state_machine_internal_publish (state_machine);
+}
+
+/* Sets up the timer for the shortest timed transition of the current state
+ * that has not elapsed yet (they are at the end of the transition table);
+ * replaces any earlier timer. */
+static void
+gsm_state_machine_internal_arm_timer (GsmStateMachine *state_machine,
+                                      gint64           elapsed)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  gint64 deadline;
+  gboolean armed;
+
+  armed = gsm_instance_internal_next_deadline (priv->instance, elapsed, &deadline);
+
+  if (priv->clock && gsm_clock_is_virtual (priv->clock))
+    {
+      gsm_clock_remove_timer (priv->clock, &priv->timer);
+      if (armed)
+        gsm_clock_add_timer (priv->clock, &priv->timer, deadline);
+    }
+  else if (priv->scheduler)
+    {
+      gsm_scheduler_remove_timer (priv->scheduler, &priv->timer);
+      if (armed)
+        gsm_scheduler_add_timer (priv->scheduler, &priv->timer, deadline);
+    }
+  else
+    {
+      /* Monotonic time, so 0 is never a real deadline here */
+      priv->timer_deadline = armed ? deadline : 0;
+      gsm_state_machine_internal_update_ready_time (state_machine);
+    }
+}
+
+gint
+gsm_state_machine_get_state (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->instance->current_state->value;
+}
+
+GType
+gsm_state_machine_get_state_type (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->def->state_type;
 }
 
 gboolean
@@ -1081,232 +1789,1763 @@ gsm_state_machine_get_running (GsmStateMachine  *state_machine)
 }
 
 void
-gsm_state_machine_set_running (GsmStateMachine  *state_machine,
-                               gboolean          running)
+gsm_state_machine_set_running (GsmStateMachine  *state_machine,
+                               gboolean          running)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  priv->running = running;
+
+  if (priv->running)
+    gsm_state_machine_internal_queue_update (state_machine);
+  else if (priv->scheduler)
+    gsm_scheduler_unqueue (priv->scheduler, &priv->scheduler_link);
+  else
+    gsm_state_machine_internal_update_ready_time (state_machine);
+}
+
+/**
+ * gsm_state_machine_get_main_context:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Returns: (transfer none): the #GMainContext the machine is updated in.
+ */
+GMainContext*
+gsm_state_machine_get_main_context (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->context;
+}
+
+/**
+ * gsm_state_machine_get_scheduler:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Returns: (transfer none) (nullable): the #GsmScheduler the machine is
+ *   updated from, or %NULL if it uses its own source.
+ */
+GsmScheduler*
+gsm_state_machine_get_scheduler (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->scheduler;
+}
+
+/**
+ * gsm_state_machine_get_clock:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Returns: (transfer none) (nullable): the #GsmClock used for timeout edges,
+ *   or %NULL if the monotonic time is used.
+ */
+GsmClock*
+gsm_state_machine_get_clock (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->clock;
+}
+
+/**
+ * gsm_state_machine_get_definition:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Returns the definition of the machine for use with
+ * gsm_state_machine_new_from_definition(). The definition is sealed, i.e.
+ * no more inputs, outputs, events, conditions, edges or groups can be added
+ * and the outputs of states cannot be changed anymore.
+ *
+ * Machines created from a definition only store their current state, the
+ * input values, pending events and outputs, so they are cheap to create.
+ *
+ * Returns: (transfer none): the sealed definition of the machine
+ */
+GsmStateMachineDefinition*
+gsm_state_machine_get_definition (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  g_return_val_if_fail (GSM_IS_STATE_MACHINE (state_machine), NULL);
+
+  if (!priv->def->sealed)
+    {
+      gsm_state_machine_definition_compile (priv->def);
+      priv->def->sealed = TRUE;
+      priv->def->instance_template = gsm_instance_internal_new_template (priv->def);
+    }
+
+  return priv->def;
+}
+
+gint
+gsm_state_machine_get_priority (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->priority;
+}
+
+void
+gsm_state_machine_set_priority (GsmStateMachine  *state_machine,
+                                gint              priority)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  if (priv->priority == priority)
+    return;
+
+  priv->priority = priority;
+
+  /* Not yet created while the construct properties are set */
+  if (priv->source)
+    g_source_set_priority (priv->source, priority);
+
+  g_object_notify_by_pspec (G_OBJECT (state_machine), properties[PROP_PRIORITY]);
+}
+
+GsmUpdateMode
+gsm_state_machine_get_update_mode (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->update_mode;
+}
+
+void
+gsm_state_machine_set_update_mode (GsmStateMachine  *state_machine,
+                                   GsmUpdateMode     mode)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  if (priv->update_mode == mode)
+    return;
+
+  priv->update_mode = mode;
+  g_object_notify_by_pspec (G_OBJECT (state_machine), properties[PROP_UPDATE_MODE]);
+}
+
+guint
+gsm_state_machine_get_max_steps (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->max_steps;
+}
+
+/**
+ * gsm_state_machine_set_max_steps:
+ * @state_machine: a #GsmStateMachine
+ * @max_steps: the step budget, must be at least one
+ *
+ * Sets how many steps (transitions or processed events) may be done in one
+ * update when running to completion. If the budget is used up, the update
+ * continues in the next main loop iteration so that other sources can run.
+ */
+void
+gsm_state_machine_set_max_steps (GsmStateMachine  *state_machine,
+                                 guint             max_steps)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  g_return_if_fail (max_steps > 0);
+
+  if (priv->max_steps == max_steps)
+    return;
+
+  priv->max_steps = max_steps;
+  g_object_notify_by_pspec (G_OBJECT (state_machine), properties[PROP_MAX_STEPS]);
+}
+
+/**
+ * gsm_state_machine_step:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Synchronously does one update step, i.e. one transition or, if the machine
+ * is stable, processes one pending event. This works independent of
+ * #GsmStateMachine:running and does not require a main loop.
+ *
+ * Returns: What was done in the step.
+ */
+GsmStepResult
+gsm_state_machine_step (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStepResult res;
+
+  g_return_val_if_fail (GSM_IS_STATE_MACHINE (state_machine), GSM_STEP_RESULT_STABLE);
+  g_return_val_if_fail (priv->update_depth == 0, GSM_STEP_RESULT_STABLE);
+
+  res = gsm_state_machine_internal_update (state_machine);
+  if (res == GSM_STEP_RESULT_STABLE)
+    gsm_state_machine_internal_publish (state_machine);
+
+  return res;
+}
+
+/**
+ * gsm_state_machine_settle:
+ * @state_machine: a #GsmStateMachine
+ * @max_steps: the maximum number of steps, or 0 to use #GsmStateMachine:max-steps
+ * @n_transitions: (out) (optional): location for the number of transitions done
+ *
+ * Synchronously steps the machine until it is stable, including processing
+ * all pending events. See gsm_state_machine_step().
+ *
+ * Returns: %TRUE if the machine is stable, %FALSE if the step budget was
+ *   used up first.
+ */
+gboolean
+gsm_state_machine_settle (GsmStateMachine  *state_machine,
+                          guint             max_steps,
+                          guint            *n_transitions)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStepResult res = GSM_STEP_RESULT_STABLE;
+  guint transitions = 0;
+  guint steps;
+
+  g_return_val_if_fail (GSM_IS_STATE_MACHINE (state_machine), FALSE);
+  g_return_val_if_fail (priv->update_depth == 0, FALSE);
+
+  if (max_steps == 0)
+    max_steps = priv->max_steps;
+
+  for (steps = 0; steps < max_steps; steps++)
+    {
+      res = gsm_state_machine_internal_update (state_machine);
+      if (res == GSM_STEP_RESULT_STABLE)
+        break;
+
+      if (res == GSM_STEP_RESULT_TRANSITION)
+        transitions++;
+    }
+
+  if (n_transitions)
+    *n_transitions = transitions;
+
+  if (res == GSM_STEP_RESULT_STABLE)
+    {
+      gsm_state_machine_internal_publish (state_machine);
+      return TRUE;
+    }
+
+  /* The budget is used up, but the last step may have reached a stable state */
+  gsm_state_machine_internal_update_conditionals (state_machine);
+
+  if (priv->n_pending_events > 0 ||
+      gsm_instance_internal_is_transient (priv->instance->active_conditions, priv->instance->current_state))
+    return FALSE;
+
+  gsm_state_machine_internal_publish (state_machine);
+  return TRUE;
+}
+
+/**
+ * gsm_state_machine_add_event:
+ * @state_machine: a #GsmStateMachine
+ * @event: the name of the event
+ *
+ * Adds a new event that can be used in edges and queued.
+ *
+ * Returns: the id of the event for gsm_state_machine_queue_event_by_id(),
+ *   or -1 if the name is already in use.
+ */
+gint
+gsm_state_machine_add_event (GsmStateMachine  *state_machine,
+                             const gchar      *event)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GQuark event_quark = g_quark_from_string (event);
+
+  g_return_val_if_fail (!priv->def->sealed, -1);
+
+  if (_machine_has_condition (state_machine, event_quark) || _machine_has_event (state_machine, event_quark))
+    {
+      g_critical ("A condition or event with the name %s already exists", event);
+      return -1;
+    }
+
+  g_array_append_val (priv->def->events, event_quark);
+  g_hash_table_insert (priv->def->event_indices, GUINT_TO_POINTER (event_quark), GUINT_TO_POINTER (priv->def->events->len));
+  priv->def->compiled = FALSE;
+
+  priv->event_pending_count = g_renew (guint, priv->event_pending_count, priv->def->events->len + 1);
+  priv->event_pending_count[priv->def->events->len] = 0;
+
+  return priv->def->events->len - 1;
+}
+
+gint
+gsm_state_machine_lookup_event (GsmStateMachine  *state_machine,
+                                const gchar      *event)
+{
+  GQuark event_quark = g_quark_try_string (event);
+
+  if (!event_quark)
+    return -1;
+
+  return _machine_event_index (state_machine, event_quark);
+}
+
+/**
+ * gsm_state_machine_queue_event:
+ * @state_machine: a #GsmStateMachine
+ * @event: the name of the event
+ *
+ * Queues an event to be processed once the machine is stable. If the event
+ * queue is at capacity, the #GsmStateMachine:event-overflow-policy decides
+ * what happens.
+ *
+ * Returns: %FALSE if the event is unknown or was rejected by the overflow
+ *   policy.
+ */
+gboolean
+gsm_state_machine_queue_event (GsmStateMachine  *state_machine,
+                               const gchar      *event)
+{
+  gint index = gsm_state_machine_lookup_event (state_machine, event);
+
+  if (index < 0)
+    {
+      g_critical ("The event %s has not been registered\n", event);
+      return FALSE;
+    }
+
+  return gsm_state_machine_queue_event_by_id (state_machine, index);
+}
+
+/**
+ * gsm_state_machine_queue_event_by_id:
+ * @state_machine: a #GsmStateMachine
+ * @event: the id of the event
+ *
+ * Same as gsm_state_machine_queue_event() but using the id returned by
+ * gsm_state_machine_add_event() or gsm_state_machine_lookup_event().
+ *
+ * Returns: %FALSE if the event is unknown or was rejected by the overflow
+ *   policy.
+ */
+gboolean
+gsm_state_machine_queue_event_by_id (GsmStateMachine  *state_machine,
+                                     gint              event)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  guint bucket;
+
+  g_return_val_if_fail (event >= 0 && event < priv->def->events->len, FALSE);
+
+  /* Stored as the bucket of the compiled transition tables */
+  bucket = event + 1;
+
+  if (priv->event_overflow_policy == GSM_EVENT_OVERFLOW_COALESCE && priv->event_pending_count[bucket] > 0)
+    return TRUE;
+
+  if (priv->event_capacity > 0 && priv->n_pending_events >= priv->event_capacity)
+    {
+      switch (priv->event_overflow_policy)
+        {
+        case GSM_EVENT_OVERFLOW_DROP_OLDEST:
+          g_debug ("Event queue full, dropping oldest event");
+          _machine_pop_event (state_machine);
+          break;
+
+        case GSM_EVENT_OVERFLOW_DROP_NEWEST:
+          g_debug ("Event queue full, dropping event \"%s\"",
+                   g_quark_to_string (g_array_index (priv->def->events, GQuark, event)));
+          return TRUE;
+
+        case GSM_EVENT_OVERFLOW_REJECT:
+        case GSM_EVENT_OVERFLOW_COALESCE:
+          return FALSE;
+        }
+    }
+
+  _machine_push_event (state_machine, bucket);
+
+  gsm_state_machine_internal_queue_update (state_machine);
+
+  return TRUE;
+}
+
+/**
+ * gsm_state_machine_get_n_pending_events:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Returns: the number of queued events that have not been processed yet.
+ */
+guint
+gsm_state_machine_get_n_pending_events (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->n_pending_events;
+}
+
+guint
+gsm_state_machine_get_event_capacity (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->event_capacity;
+}
+
+/**
+ * gsm_state_machine_set_event_capacity:
+ * @state_machine: a #GsmStateMachine
+ * @capacity: the maximum number of pending events, or 0 for no limit
+ *
+ * Limits the number of pending events. Events that are already pending are
+ * kept if the capacity is lowered.
+ */
+void
+gsm_state_machine_set_event_capacity (GsmStateMachine  *state_machine,
+                                      guint             capacity)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  if (priv->event_capacity == capacity)
+    return;
+
+  priv->event_capacity = capacity;
+  g_object_notify_by_pspec (G_OBJECT (state_machine), properties[PROP_EVENT_CAPACITY]);
+}
+
+GsmEventOverflowPolicy
+gsm_state_machine_get_event_overflow_policy (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  return priv->event_overflow_policy;
+}
+
+void
+gsm_state_machine_set_event_overflow_policy (GsmStateMachine       *state_machine,
+                                             GsmEventOverflowPolicy policy)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  if (priv->event_overflow_policy == policy)
+    return;
+
+  priv->event_overflow_policy = policy;
+  g_object_notify_by_pspec (G_OBJECT (state_machine), properties[PROP_EVENT_OVERFLOW_POLICY]);
+}
+
+/**
+ * gsm_state_machine_add_input:
+ * @state_machine: a #GsmStateMachine
+ * @pspec: (transfer floating): the #GParamSpec describing the input
+ *
+ * Adds an input named after the @pspec, its value is initialized to the
+ * default value.
+ *
+ * Returns: the id of the input for the `_by_id` accessors
+ */
+gint
+gsm_state_machine_add_input (GsmStateMachine  *state_machine,
+                             GParamSpec       *pspec)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *value = NULL;
+
+  g_return_val_if_fail (!priv->def->sealed, -1);
+  g_assert (g_hash_table_lookup (priv->def->inputs, pspec->name) == NULL);
+
+  value = gsm_state_machine_value_new ();
+  value->pspec = g_param_spec_ref_sink (pspec);
+  value->idx   = priv->def->inputs_by_id->len;
+  value->name  = g_quark_from_string (pspec->name);
+  value->conditions = g_ptr_array_new ();
+  g_value_init (&value->value, G_PARAM_SPEC_VALUE_TYPE (value->pspec));
+  g_value_copy (g_param_spec_get_default_value (pspec), &value->value);
+
+  g_hash_table_insert (priv->def->inputs, (gpointer) pspec->name, value);
+  g_ptr_array_add (priv->def->inputs_by_id, value);
+
+  g_ptr_array_add (priv->inputs_by_id, gsm_state_machine_value_new_instance (value));
+
+  return value->idx;
+}
+
+/**
+ * gsm_state_machine_add_output:
+ * @state_machine: a #GsmStateMachine
+ * @pspec: (transfer floating): the #GParamSpec describing the output
+ *
+ * Adds an output named after the @pspec, the default value is used in all
+ * states that do not set or map the output.
+ *
+ * Returns: the id of the output for the `_by_id` accessors
+ */
+gint
+gsm_state_machine_add_output (GsmStateMachine  *state_machine,
+                              GParamSpec       *pspec)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *value = NULL;
+  GsmStateMachineOutputValue *default_value;
+  GQuark quark;
+
+  g_return_val_if_fail (!priv->def->sealed, -1);
+  g_assert (g_hash_table_lookup (priv->def->outputs, pspec->name) == NULL);
+
+  value = gsm_state_machine_value_new ();
+  value->pspec = g_param_spec_ref_sink (pspec);
+  value->idx   = priv->def->outputs_by_id->len;
+  g_value_init (&value->value, G_PARAM_SPEC_VALUE_TYPE (pspec));
+  g_value_copy (g_param_spec_get_default_value (pspec), &value->value);
+
+  g_hash_table_insert (priv->def->outputs, (gpointer) pspec->name, value);
+  g_ptr_array_add (priv->def->outputs_by_id, value);
+
+  /* Set default value in the ALL group and the current outputs */
+  default_value = g_new0 (GsmStateMachineOutputValue, 1);
+  default_value->input = -1;
+  g_value_init (&default_value->value, G_PARAM_SPEC_VALUE_TYPE (pspec));
+  g_value_copy (&value->value, &default_value->value);
+  g_ptr_array_add (priv->def->all_state->owned_values, default_value);
+
+  g_assert (priv->def->all_state->outputs->len == value->idx);
+  g_ptr_array_add (priv->def->all_state->outputs, default_value);
+
+  g_assert (priv->current_outputs->len == value->idx);
+  g_ptr_array_add (priv->current_outputs, &default_value->value);
+
+  quark = g_quark_from_static_string (pspec->name);
+  value->name = quark;
+  g_array_append_val (priv->def->outputs_quark, quark);
+
+  return value->idx;
+}
+
+gint
+gsm_state_machine_lookup_input (GsmStateMachine  *state_machine,
+                                const gchar      *input)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
+
+  input_value = g_hash_table_lookup (priv->def->inputs, input);
+
+  return input_value ? (gint) input_value->idx : -1;
+}
+
+gint
+gsm_state_machine_lookup_output (GsmStateMachine  *state_machine,
+                                 const gchar      *output)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *output_value;
+
+  output_value = g_hash_table_lookup (priv->def->outputs, output);
+
+  return output_value ? (gint) output_value->idx : -1;
+}
+
+void
+gsm_state_machine_map_output (GsmStateMachine  *state_machine,
+                              gint              state,
+                              const gchar      *output,
+                              const gchar      *input)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineState *sm_state = NULL;
+  GsmStateMachineValue *output_value;
+  GsmStateMachineValue *input_value;
+  GsmStateMachineOutputValue *new;
+
+  g_return_if_fail (!priv->def->sealed);
+
+  sm_state = g_hash_table_lookup (priv->def->states, GINT_TO_POINTER (state));
+  g_assert (sm_state);
+
+  gsm_state_machine_state_ensure_outputs (sm_state, priv->def->outputs);
+
+  output_value = g_hash_table_lookup (priv->def->outputs, output);
+  input_value = g_hash_table_lookup (priv->def->inputs, input);
+
+  g_ptr_array_remove_fast (sm_state->owned_values, sm_state->outputs->pdata[output_value->idx]);
+
+  new = g_new0 (GsmStateMachineOutputValue, 1);
+  new->input = input_value->idx;
+  g_ptr_array_add (sm_state->owned_values, new);
+  sm_state->outputs->pdata[output_value->idx] = new;
+}
+
+#if 0
+void             gsm_state_machine_map_output_default  (GsmStateMachine  *state_machine,
+                                                        const gchar      *output,
+                                                        const gchar      *input);
+#endif
+
+#if 0
+void             gsm_state_machine_get_input           (GsmStateMachine  *state_machine,
+                                                        const gchar      *output,
+                                                        ...);
+#endif
+
+void
+gsm_state_machine_get_input_value (GsmStateMachine  *state_machine,
+                                   const gchar      *input,
+                                   GValue           *out)
+{
+  gint id = gsm_state_machine_lookup_input (state_machine, input);
+
+  g_return_if_fail (id >= 0);
+
+  gsm_state_machine_get_input_value_by_id (state_machine, id, out);
+}
+
+void
+gsm_state_machine_get_input_value_by_id (GsmStateMachine  *state_machine,
+                                         gint              input,
+                                         GValue           *out)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
+
+  g_return_if_fail (input >= 0 && input < priv->inputs_by_id->len);
+  input_value = g_ptr_array_index (priv->inputs_by_id, input);
+
+  g_value_init (out, G_VALUE_TYPE (&input_value->value));
+  g_value_copy (&input_value->value, out);
+}
+
+static void
+gsm_state_machine_set_input_valist (GsmStateMachine  *state_machine,
+                                    gint              input,
+                                    va_list           var_args)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
+  g_autofree gchar *error = NULL;
+  GValue value;
+
+  input_value = g_ptr_array_index (priv->inputs_by_id, input);
+
+  G_VALUE_COLLECT_INIT (&value, input_value->pspec->value_type, var_args,
+                        0, &error);
+  if (error)
+    {
+      g_warning ("%s: %s", G_STRFUNC, error);
+    }
+  else
+    {
+      gsm_state_machine_set_input_value_by_id (state_machine, input, &value);
+    }
+  g_value_unset (&value);
+}
+
+void
+gsm_state_machine_set_input (GsmStateMachine  *state_machine,
+                             const gchar      *input,
+                             ...)
+{
+  gint id = gsm_state_machine_lookup_input (state_machine, input);
+  va_list var_args;
+
+  g_assert (id >= 0);
+
+  va_start (var_args, input);
+  gsm_state_machine_set_input_valist (state_machine, id, var_args);
+  va_end (var_args);
+}
+
+void
+gsm_state_machine_set_input_by_id (GsmStateMachine  *state_machine,
+                                   gint              input,
+                                   ...)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  va_list var_args;
+
+  g_return_if_fail (input >= 0 && input < priv->inputs_by_id->len);
+
+  va_start (var_args, input);
+  gsm_state_machine_set_input_valist (state_machine, input, var_args);
+  va_end (var_args);
+}
+
+void
+gsm_state_machine_set_input_value (GsmStateMachine  *state_machine,
+                                   const gchar      *input,
+                                   const GValue     *value)
+{
+  gint id = gsm_state_machine_lookup_input (state_machine, input);
+
+  g_return_if_fail (id >= 0);
+
+  gsm_state_machine_set_input_value_by_id (state_machine, id, value);
+}
+
+/* Whether @value is acceptable for an input with the given @pspec, i.e.
+ * it is in range or part of the enum. Logs a critical otherwise. */
+gboolean
+gsm_state_machine_value_validate (GParamSpec   *pspec,
+                                  const GValue *value)
+{
+  GValue validated = G_VALUE_INIT;
+  g_autofree gchar *contents = NULL;
+  gboolean modified;
+
+  g_value_init (&validated, G_VALUE_TYPE (value));
+  g_value_copy (value, &validated);
+  modified = g_param_value_validate (pspec, &validated);
+  g_value_unset (&validated);
+
+  if (!modified)
+    return TRUE;
+
+  contents = g_strdup_value_contents (value);
+  g_critical ("Value %s is not valid for input \"%s\"", contents, pspec->name);
+
+  return FALSE;
+}
+
+/* Slow path for param specs other than the standard ones, which may
+ * implement their own validation */
+static gboolean
+_value_validate_boxed (GParamSpec *pspec,
+                       gint64      v_integer,
+                       gdouble     v_double)
+{
+  GValue value = G_VALUE_INIT;
+  gboolean valid;
+
+  g_value_init (&value, pspec->value_type);
+  switch (G_TYPE_FUNDAMENTAL (pspec->value_type))
+    {
+    case G_TYPE_BOOLEAN:
+      g_value_set_boolean (&value, v_integer != 0);
+      break;
+    case G_TYPE_INT:
+      g_value_set_int (&value, (gint) v_integer);
+      break;
+    case G_TYPE_UINT:
+      g_value_set_uint (&value, (guint) v_integer);
+      break;
+    case G_TYPE_INT64:
+      g_value_set_int64 (&value, v_integer);
+      break;
+    case G_TYPE_DOUBLE:
+      g_value_set_double (&value, v_double);
+      break;
+    case G_TYPE_ENUM:
+      g_value_set_enum (&value, (gint) v_integer);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  valid = gsm_state_machine_value_validate (pspec, &value);
+  g_value_unset (&value);
+
+  return valid;
+}
+
+/* Like gsm_state_machine_value_validate() for the typed setters, checks the
+ * bounds of the standard param specs without going through a GValue.
+ * Integer inputs (including booleans and enums) are passed as a gint64. */
+gboolean
+gsm_state_machine_value_validate_integer (GParamSpec *pspec,
+                                          gint64      value)
+{
+  GType pspec_type = G_PARAM_SPEC_TYPE (pspec);
+  gboolean valid = TRUE;
+
+  if (pspec_type == G_TYPE_PARAM_INT)
+    valid = value >= G_PARAM_SPEC_INT (pspec)->minimum && value <= G_PARAM_SPEC_INT (pspec)->maximum;
+  else if (pspec_type == G_TYPE_PARAM_UINT)
+    valid = value >= G_PARAM_SPEC_UINT (pspec)->minimum && value <= G_PARAM_SPEC_UINT (pspec)->maximum;
+  else if (pspec_type == G_TYPE_PARAM_INT64)
+    valid = value >= G_PARAM_SPEC_INT64 (pspec)->minimum && value <= G_PARAM_SPEC_INT64 (pspec)->maximum;
+  else if (pspec_type == G_TYPE_PARAM_ENUM)
+    valid = g_enum_get_value (G_PARAM_SPEC_ENUM (pspec)->enum_class, value) != NULL;
+  else if (pspec_type != G_TYPE_PARAM_BOOLEAN)
+    return _value_validate_boxed (pspec, value, 0.0);
+
+  if (!valid)
+    g_critical ("Value %" G_GINT64_FORMAT " is not valid for input \"%s\"", value, pspec->name);
+
+  return valid;
+}
+
+gboolean
+gsm_state_machine_value_validate_double (GParamSpec *pspec,
+                                         gdouble     value)
+{
+  gboolean valid = TRUE;
+
+  /* Same as the validation of GParamSpecDouble, which lets NaN pass */
+  if (G_PARAM_SPEC_TYPE (pspec) == G_TYPE_PARAM_DOUBLE)
+    valid = !(value < G_PARAM_SPEC_DOUBLE (pspec)->minimum || value > G_PARAM_SPEC_DOUBLE (pspec)->maximum);
+  else
+    return _value_validate_boxed (pspec, 0, value);
+
+  if (!valid)
+    g_critical ("Value %g is not valid for input \"%s\"", value, pspec->name);
+
+  return valid;
+}
+
+/* Whether setting @value would not be a change of the input */
+static gboolean
+_input_value_unchanged (GsmStateMachineValue *input_value,
+                        const GValue         *value)
+{
+  if (g_param_values_cmp (input_value->pspec, &input_value->value, value) == 0)
+    return TRUE;
+
+  if (input_value->tolerance > 0.0)
+    return ABS (_value_get_number (value) - _value_get_number (&input_value->value)) <= input_value->tolerance;
+
+  return FALSE;
+}
+
+/**
+ * gsm_state_machine_set_input_tolerance:
+ * @state_machine: a #GsmStateMachine
+ * @input: the name of a numeric input
+ * @tolerance: the deadband, or 0 to only ignore identical values
+ *
+ * Sets the amount by which a numeric input has to differ from its current
+ * value for an update to be accepted. Smaller changes are dropped and
+ * counted in gsm_state_machine_get_n_suppressed_inputs(). Identical values
+ * are always dropped.
+ */
+void
+gsm_state_machine_set_input_tolerance (GsmStateMachine  *state_machine,
+                                       const gchar      *input,
+                                       gdouble           tolerance)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
+
+  g_return_if_fail (!priv->def->sealed);
+
+  input_value = g_hash_table_lookup (priv->def->inputs, input);
+  g_return_if_fail (input_value != NULL);
+  g_return_if_fail (_value_type_is_numeric (input_value->pspec->value_type));
+  g_return_if_fail (tolerance >= 0.0);
+
+  input_value->tolerance = tolerance;
+  ((GsmStateMachineValue *) g_ptr_array_index (priv->inputs_by_id, input_value->idx))->tolerance = tolerance;
+}
+
+gdouble
+gsm_state_machine_get_input_tolerance (GsmStateMachine  *state_machine,
+                                       const gchar      *input)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
+
+  input_value = g_hash_table_lookup (priv->def->inputs, input);
+  g_return_val_if_fail (input_value != NULL, 0.0);
+
+  return input_value->tolerance;
+}
+
+/**
+ * gsm_state_machine_get_n_suppressed_inputs:
+ * @state_machine: a #GsmStateMachine
+ * @input: (nullable): the name of an input, or %NULL for all inputs
+ *
+ * Returns: the number of input updates that were dropped because the
+ *   value did not change (or stayed within the tolerance).
+ */
+guint64
+gsm_state_machine_get_n_suppressed_inputs (GsmStateMachine  *state_machine,
+                                           const gchar      *input)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
+
+  if (!input)
+    return priv->n_suppressed_inputs;
+
+  input_value = g_hash_table_lookup (priv->def->inputs, input);
+  g_return_val_if_fail (input_value != NULL, 0);
+  input_value = g_ptr_array_index (priv->inputs_by_id, input_value->idx);
+
+  return input_value->n_suppressed;
+}
+
+static void gsm_state_machine_internal_input_suppressed (GsmStateMachine      *state_machine,
+                                                         GsmStateMachineValue *input_value);
+static void gsm_state_machine_internal_input_changed (GsmStateMachine      *state_machine,
+                                                      GsmStateMachineValue *input_value);
+
+/* Used by the GValue based setters. Unchanged values are dropped before
+ * validating, invalid ones are rejected without any change. */
+static void
+gsm_state_machine_internal_set_input (GsmStateMachine      *state_machine,
+                                      GsmStateMachineValue *input_value,
+                                      const GValue         *value)
+{
+  if (_input_value_unchanged (input_value, value))
+    {
+      gsm_state_machine_internal_input_suppressed (state_machine, input_value);
+      return;
+    }
+
+  if (!gsm_state_machine_value_validate (input_value->pspec, value))
+    return;
+
+  g_value_copy (value, &input_value->value);
+  gsm_state_machine_internal_input_changed (state_machine, input_value);
+}
+
+void
+gsm_state_machine_set_input_value_by_id (GsmStateMachine  *state_machine,
+                                         gint              input,
+                                         const GValue     *value)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  g_return_if_fail (input >= 0 && input < priv->inputs_by_id->len);
+
+  gsm_state_machine_internal_set_input (state_machine, g_ptr_array_index (priv->inputs_by_id, input), value);
+}
+
+static void
+gsm_state_machine_internal_input_suppressed (GsmStateMachine      *state_machine,
+                                             GsmStateMachineValue *input_value)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  input_value->n_suppressed += 1;
+  priv->n_suppressed_inputs += 1;
+}
+
+/* Called after the value of the input was modified */
+static void
+gsm_state_machine_internal_input_changed (GsmStateMachine      *state_machine,
+                                          GsmStateMachineValue *input_value)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  gboolean output_changed = FALSE;
+
+  priv->generation += 1;
+  gsm_state_machine_internal_mark_input_dirty (state_machine, input_value);
+
+  /* Signals and the update are deferred until the batch is committed */
+  if (priv->update_depth > 0)
+    {
+      if (!input_value->changed)
+        {
+          input_value->changed = TRUE;
+          g_ptr_array_add (priv->changed_inputs, input_value);
+        }
+      return;
+    }
+
+  g_signal_emit (state_machine, signals[SIGNAL_INPUT_CHANGED], input_value->name,
+                 g_quark_to_string (input_value->name), &input_value->value);
+
+  for (guint i = 0; i < priv->current_outputs->len; i++)
+    {
+      /* Output value was updated if the pointers are identical. */
+      if (&input_value->value != g_ptr_array_index (priv->current_outputs, i))
+        continue;
+
+      g_signal_emit (state_machine,
+                     signals[SIGNAL_OUTPUT_CHANGED],
+                     g_array_index (priv->def->outputs_quark, GQuark, i),
+                     g_quark_to_string (g_array_index (priv->def->outputs_quark, GQuark, i)),
+                     &input_value->value, FALSE, FALSE);
+      output_changed = TRUE;
+    }
+
+  /* The conditions are evaluated lazily on the next update, which is
+   * only needed now if the input can trigger a transition. That update
+   * publishes the output together with the state it settles in. */
+  if (gsm_state_machine_internal_input_is_sensitive (state_machine, input_value))
+    {
+      gsm_state_machine_internal_queue_update (state_machine);
+      return;
+    }
+
+  if (output_changed && !gsm_state_machine_internal_update_pending (state_machine))
+    gsm_state_machine_internal_publish (state_machine);
+}
+
+
+/* Typed accessors, these work directly on the storage of the input
+ * without a name lookup or collecting varargs. */
+static GsmStateMachineValue*
+gsm_state_machine_internal_typed_input (GsmStateMachine *state_machine,
+                                        gint             input,
+                                        GType            fundamental)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
+
+  if (input < 0 || input >= priv->inputs_by_id->len)
+    {
+      g_critical ("Input %d does not exist", input);
+      return NULL;
+    }
+
+  input_value = g_ptr_array_index (priv->inputs_by_id, input);
+  if (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (&input_value->value)) != fundamental)
+    {
+      g_critical ("Input %s is of type %s, not %s",
+                  g_quark_to_string (input_value->name),
+                  G_VALUE_TYPE_NAME (&input_value->value),
+                  g_type_name (fundamental));
+      return NULL;
+    }
+
+  return input_value;
+}
+
+static inline gboolean
+_input_number_unchanged (GsmStateMachineValue *input_value,
+                         gdouble               old_value,
+                         gdouble               new_value)
+{
+  return input_value->tolerance > 0.0 && ABS (new_value - old_value) <= input_value->tolerance;
+}
+
+/**
+ * gsm_state_machine_set_input_boolean:
+ * @state_machine: a #GsmStateMachine
+ * @input: the id of a boolean input
+ * @value: the new value
+ *
+ * Sets a boolean input. This and the other typed setters are equivalent
+ * to gsm_state_machine_set_input_value_by_id(), including the rejection of
+ * values that are not valid for the #GParamSpec of the input, but compare
+ * and store the value in place instead of going through a #GValue.
+ */
+void
+gsm_state_machine_set_input_boolean (GsmStateMachine  *state_machine,
+                                     gint              input,
+                                     gboolean          value)
+{
+  GsmStateMachineValue *input_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_BOOLEAN);
+  if (!input_value)
+    return;
+
+  if (g_value_get_boolean (&input_value->value) == !!value)
+    {
+      gsm_state_machine_internal_input_suppressed (state_machine, input_value);
+      return;
+    }
+
+  if (!gsm_state_machine_value_validate_integer (input_value->pspec, !!value))
+    return;
+
+  g_value_set_boolean (&input_value->value, value);
+  gsm_state_machine_internal_input_changed (state_machine, input_value);
+}
+
+void
+gsm_state_machine_set_input_int (GsmStateMachine  *state_machine,
+                                 gint              input,
+                                 gint              value)
+{
+  GsmStateMachineValue *input_value;
+  gint old_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_INT);
+  if (!input_value)
+    return;
+
+  old_value = g_value_get_int (&input_value->value);
+  if (old_value == value || _input_number_unchanged (input_value, old_value, value))
+    {
+      gsm_state_machine_internal_input_suppressed (state_machine, input_value);
+      return;
+    }
+
+  if (!gsm_state_machine_value_validate_integer (input_value->pspec, value))
+    return;
+
+  g_value_set_int (&input_value->value, value);
+  gsm_state_machine_internal_input_changed (state_machine, input_value);
+}
+
+void
+gsm_state_machine_set_input_uint (GsmStateMachine  *state_machine,
+                                  gint              input,
+                                  guint             value)
+{
+  GsmStateMachineValue *input_value;
+  guint old_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_UINT);
+  if (!input_value)
+    return;
+
+  old_value = g_value_get_uint (&input_value->value);
+  if (old_value == value || _input_number_unchanged (input_value, old_value, value))
+    {
+      gsm_state_machine_internal_input_suppressed (state_machine, input_value);
+      return;
+    }
+
+  if (!gsm_state_machine_value_validate_integer (input_value->pspec, value))
+    return;
+
+  g_value_set_uint (&input_value->value, value);
+  gsm_state_machine_internal_input_changed (state_machine, input_value);
+}
+
+void
+gsm_state_machine_set_input_int64 (GsmStateMachine  *state_machine,
+                                   gint              input,
+                                   gint64            value)
+{
+  GsmStateMachineValue *input_value;
+  gint64 old_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_INT64);
+  if (!input_value)
+    return;
+
+  old_value = g_value_get_int64 (&input_value->value);
+  if (old_value == value || _input_number_unchanged (input_value, old_value, value))
+    {
+      gsm_state_machine_internal_input_suppressed (state_machine, input_value);
+      return;
+    }
+
+  if (!gsm_state_machine_value_validate_integer (input_value->pspec, value))
+    return;
+
+  g_value_set_int64 (&input_value->value, value);
+  gsm_state_machine_internal_input_changed (state_machine, input_value);
+}
+
+void
+gsm_state_machine_set_input_double (GsmStateMachine  *state_machine,
+                                    gint              input,
+                                    gdouble           value)
+{
+  GsmStateMachineValue *input_value;
+  gdouble old_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_DOUBLE);
+  if (!input_value)
+    return;
+
+  /* Values within the epsilon of the param spec compare equal, just like
+   * with g_param_values_cmp() */
+  old_value = g_value_get_double (&input_value->value);
+  if (old_value == value || _input_number_unchanged (input_value, old_value, value) ||
+      (G_PARAM_SPEC_TYPE (input_value->pspec) == G_TYPE_PARAM_DOUBLE &&
+       ABS (value - old_value) <= G_PARAM_SPEC_DOUBLE (input_value->pspec)->epsilon))
+    {
+      gsm_state_machine_internal_input_suppressed (state_machine, input_value);
+      return;
+    }
+
+  if (!gsm_state_machine_value_validate_double (input_value->pspec, value))
+    return;
+
+  g_value_set_double (&input_value->value, value);
+  gsm_state_machine_internal_input_changed (state_machine, input_value);
+}
+
+void
+gsm_state_machine_set_input_enum (GsmStateMachine  *state_machine,
+                                  gint              input,
+                                  gint              value)
+{
+  GsmStateMachineValue *input_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_ENUM);
+  if (!input_value)
+    return;
+
+  if (g_value_get_enum (&input_value->value) == value)
+    {
+      gsm_state_machine_internal_input_suppressed (state_machine, input_value);
+      return;
+    }
+
+  if (!gsm_state_machine_value_validate_integer (input_value->pspec, value))
+    return;
+
+  g_value_set_enum (&input_value->value, value);
+  gsm_state_machine_internal_input_changed (state_machine, input_value);
+}
+
+gboolean
+gsm_state_machine_get_input_boolean (GsmStateMachine  *state_machine,
+                                     gint              input)
+{
+  GsmStateMachineValue *input_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_BOOLEAN);
+
+  return input_value ? g_value_get_boolean (&input_value->value) : FALSE;
+}
+
+gint
+gsm_state_machine_get_input_int (GsmStateMachine  *state_machine,
+                                 gint              input)
+{
+  GsmStateMachineValue *input_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_INT);
+
+  return input_value ? g_value_get_int (&input_value->value) : 0;
+}
+
+guint
+gsm_state_machine_get_input_uint (GsmStateMachine  *state_machine,
+                                  gint              input)
+{
+  GsmStateMachineValue *input_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_UINT);
+
+  return input_value ? g_value_get_uint (&input_value->value) : 0;
+}
+
+gint64
+gsm_state_machine_get_input_int64 (GsmStateMachine  *state_machine,
+                                   gint              input)
+{
+  GsmStateMachineValue *input_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_INT64);
+
+  return input_value ? g_value_get_int64 (&input_value->value) : 0;
+}
+
+gdouble
+gsm_state_machine_get_input_double (GsmStateMachine  *state_machine,
+                                    gint              input)
+{
+  GsmStateMachineValue *input_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_DOUBLE);
+
+  return input_value ? g_value_get_double (&input_value->value) : 0.0;
+}
+
+gint
+gsm_state_machine_get_input_enum (GsmStateMachine  *state_machine,
+                                  gint              input)
+{
+  GsmStateMachineValue *input_value;
+
+  input_value = gsm_state_machine_internal_typed_input (state_machine, input, G_TYPE_ENUM);
+
+  return input_value ? g_value_get_enum (&input_value->value) : 0;
+}
+
+/**
+ * gsm_state_machine_begin_update:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Starts a batch of input changes. Until the matching
+ * gsm_state_machine_commit_update() call the inputs are stored, but no
+ * signals are emitted and the machine is not updated. This guarantees
+ * that no transition is done with only a part of the inputs changed.
+ *
+ * Batches can be nested, only the outermost commit has an effect.
+ */
+void
+gsm_state_machine_begin_update (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  g_return_if_fail (GSM_IS_STATE_MACHINE (state_machine));
+
+  priv->update_depth += 1;
+}
+
+/**
+ * gsm_state_machine_commit_update:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Ends a batch started with gsm_state_machine_begin_update(). Emits
+ * #GsmStateMachine::input-changed once for each changed input, followed
+ * by #GsmStateMachine::output-changed for outputs mapped to them and
+ * queues a single update if required.
+ */
+void
+gsm_state_machine_commit_update (GsmStateMachine  *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  g_autoptr(GPtrArray) changed = NULL;
+  gboolean queue_update;
+  gboolean output_changed = FALSE;
+
+  g_return_if_fail (GSM_IS_STATE_MACHINE (state_machine));
+  g_return_if_fail (priv->update_depth > 0);
+
+  priv->update_depth -= 1;
+  if (priv->update_depth > 0)
+    return;
+
+  /* Handlers may start a new batch */
+  changed = priv->changed_inputs;
+  priv->changed_inputs = g_ptr_array_new ();
+
+  queue_update = priv->update_deferred;
+  priv->update_deferred = FALSE;
+
+  for (guint i = 0; i < changed->len; i++)
+    {
+      GsmStateMachineValue *input_value = g_ptr_array_index (changed, i);
+
+      input_value->changed = FALSE;
+      queue_update |= gsm_state_machine_internal_input_is_sensitive (state_machine, input_value);
+
+      g_signal_emit (state_machine, signals[SIGNAL_INPUT_CHANGED], input_value->name,
+                     g_quark_to_string (input_value->name), &input_value->value);
+    }
+
+  for (guint i = 0; i < priv->current_outputs->len && changed->len > 0; i++)
+    {
+      GValue *output = g_ptr_array_index (priv->current_outputs, i);
+
+      for (guint j = 0; j < changed->len; j++)
+        {
+          GsmStateMachineValue *input_value = g_ptr_array_index (changed, j);
+
+          if (&input_value->value != output)
+            continue;
+
+          g_signal_emit (state_machine,
+                         signals[SIGNAL_OUTPUT_CHANGED],
+                         g_array_index (priv->def->outputs_quark, GQuark, i),
+                         g_quark_to_string (g_array_index (priv->def->outputs_quark, GQuark, i)),
+                         output, FALSE, FALSE);
+          output_changed = TRUE;
+          break;
+        }
+    }
+
+  if (queue_update)
+    gsm_state_machine_internal_queue_update (state_machine);
+  else if (output_changed && !gsm_state_machine_internal_update_pending (state_machine))
+    gsm_state_machine_internal_publish (state_machine);
+}
+
+static GsmStateMachinePostbox*
+_machine_get_postbox (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachinePostbox *postbox;
+  guint n_inputs;
+  guint n_words;
+
+  postbox = g_atomic_pointer_get (&priv->postbox);
+  if (G_LIKELY (postbox))
+    return postbox;
+
+  /* Only the very first post allocates; if two threads race, one wins */
+  n_inputs = priv->def->inputs_by_id->len;
+  n_words = (n_inputs + 31) / 32;
+  postbox = g_malloc0 (sizeof (GsmStateMachinePostbox) + n_words * sizeof (guint) + n_inputs * sizeof (guint64));
+  postbox->n_inputs = n_inputs;
+  postbox->values = (guint64 *) (postbox + 1);
+  postbox->pending = (guint *) (postbox->values + n_inputs);
+  for (guint i = 0; i < POST_RING_SIZE; i++)
+    postbox->ring[i].sequence = i;
+
+  if (!g_atomic_pointer_compare_and_exchange (&priv->postbox, NULL, postbox))
+    {
+      g_free (postbox);
+      postbox = g_atomic_pointer_get (&priv->postbox);
+    }
+
+  return postbox;
+}
+
+/* Only the first post after a drain wakes up the context */
+static void
+_machine_post_wakeup (GsmStateMachine *state_machine)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+
+  if (!g_atomic_int_compare_and_exchange (&priv->post_pending, 0, 1))
+    return;
+
+  if (priv->scheduler)
+    {
+      /* The scheduler drops the reference once it drained the machine */
+      g_object_ref (state_machine);
+      gsm_scheduler_post (priv->scheduler, &priv->scheduler_post);
+    }
+  else
+    {
+      g_main_context_wakeup (priv->context);
+    }
+}
+
+static void
+_machine_post_input (GsmStateMachine *state_machine,
+                     gint             input,
+                     GType            fundamental,
+                     guint64          raw)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachinePostbox *postbox;
+  GsmStateMachineValue *input_value;
+  gdouble v_double;
+  gboolean valid = TRUE;
+
+  g_return_if_fail (priv->def->sealed);
+
+  input_value = gsm_instance_internal_typed_input (priv->def, input, fundamental);
+  if (!input_value)
+    return;
+
+  /* Rejected here, so that the critical points at the posting thread */
+  if (fundamental == G_TYPE_DOUBLE)
+    {
+      memcpy (&v_double, &raw, sizeof (gdouble));
+      valid = gsm_state_machine_value_validate_double (input_value->pspec, v_double);
+    }
+  else
+    {
+      valid = gsm_state_machine_value_validate_integer (input_value->pspec, (gint64) raw);
+    }
+
+  if (!valid)
+    return;
+
+  postbox = _machine_get_postbox (state_machine);
+  g_return_if_fail (input < postbox->n_inputs);
+
+  /* The value is visible before the pending bit, a drain that sees the bit
+   * reads this or a later value. */
+  __atomic_store_n (&postbox->values[input], raw, __ATOMIC_RELEASE);
+  g_atomic_int_or (&postbox->pending[input / 32], 1u << (input % 32));
+
+  _machine_post_wakeup (state_machine);
+}
+
+/* Applies a posted value through the typed setters, so suppression and the
+ * tolerance work just like for inputs set on the machine's thread. */
+static void
+_machine_apply_posted_input (GsmStateMachine *state_machine,
+                             gint             input,
+                             guint64          raw)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value = g_ptr_array_index (priv->inputs_by_id, input);
+  gdouble v_double;
+
+  switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (&input_value->value)))
+    {
+    case G_TYPE_BOOLEAN:
+      gsm_state_machine_set_input_boolean (state_machine, input, raw != 0);
+      break;
+    case G_TYPE_INT:
+      gsm_state_machine_set_input_int (state_machine, input, (gint) raw);
+      break;
+    case G_TYPE_UINT:
+      gsm_state_machine_set_input_uint (state_machine, input, (guint) raw);
+      break;
+    case G_TYPE_INT64:
+      gsm_state_machine_set_input_int64 (state_machine, input, (gint64) raw);
+      break;
+    case G_TYPE_DOUBLE:
+      memcpy (&v_double, &raw, sizeof (gdouble));
+      gsm_state_machine_set_input_double (state_machine, input, v_double);
+      break;
+    case G_TYPE_ENUM:
+      gsm_state_machine_set_input_enum (state_machine, input, (gint) raw);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+void
+gsm_state_machine_drain_posted (GsmStateMachine *state_machine)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachinePostbox *postbox = g_atomic_pointer_get (&priv->postbox);
+  guint buckets[POST_RING_SIZE];
+  guint n_events = 0;
 
-  priv->running = running;
+  /* Cleared first, posts from now on wake up the context again */
+  g_atomic_int_set (&priv->post_pending, 0);
 
-  if (priv->running)
-    gsm_state_machine_internal_queue_update (state_machine);
-  else
+  if (!postbox)
+    return;
+
+  /* Events are taken before the inputs, so that every input posted before
+   * one of the events is applied before it is queued. */
+  while (n_events < POST_RING_SIZE)
     {
-      if (priv->idle_source_id)
-        g_source_remove (priv->idle_source_id);
-      priv->idle_source_id = 0;
+      GsmStateMachinePostSlot *slot = &postbox->ring[postbox->head % POST_RING_SIZE];
+
+      if (g_atomic_int_get (&slot->sequence) != postbox->head + 1)
+        break;
+
+      buckets[n_events++] = slot->bucket;
+      g_atomic_int_set (&slot->sequence, postbox->head + POST_RING_SIZE);
+      postbox->head += 1;
     }
-}
 
-void
-gsm_state_machine_add_event (GsmStateMachine  *state_machine,
-                             const gchar      *event)
-{
-  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GQuark event_quark = g_quark_from_string (event);
+  gsm_state_machine_begin_update (state_machine);
 
-  if (_machine_has_condition (state_machine, event_quark) || _machine_has_event (state_machine, event_quark))
+  for (guint w = 0; w * 32 < postbox->n_inputs; w++)
     {
-      g_critical ("A condition or event with the name %s already exists", event);
-      return;
+      /* Taken as a whole, an and with 0 is an exchange */
+      guint bits = g_atomic_int_and (&postbox->pending[w], 0);
+
+      while (bits)
+        {
+          guint input = w * 32 + __builtin_ctz (bits);
+
+          bits &= bits - 1;
+          _machine_apply_posted_input (state_machine, input,
+                                       __atomic_load_n (&postbox->values[input], __ATOMIC_ACQUIRE));
+        }
     }
 
-  g_array_append_val (priv->events, event_quark);
+  for (guint i = 0; i < n_events; i++)
+    gsm_state_machine_queue_event_by_id (state_machine, buckets[i] - 1);
+
+  gsm_state_machine_commit_update (state_machine);
 }
 
-void
-gsm_state_machine_queue_event (GsmStateMachine  *state_machine,
-                               const gchar      *event)
+/**
+ * gsm_state_machine_post_event:
+ * @state_machine: a #GsmStateMachine
+ * @event: the id of the event
+ *
+ * Queues an event from any thread. Unlike gsm_state_machine_queue_event()
+ * the event is only added to the event queue once the main context of the
+ * machine runs, inputs posted before it by the same thread are applied
+ * first. Posting never blocks and only the very first post to a machine
+ * allocates.
+ *
+ * The caller must hold a reference on the machine and its definition must
+ * have been sealed with gsm_state_machine_get_definition() on the thread of
+ * the machine before other threads start posting, it is read without
+ * locking.
+ *
+ * Returns: %FALSE if too many events are in flight already, which means
+ *   that the main context of the machine is not keeping up.
+ */
+gboolean
+gsm_state_machine_post_event (GsmStateMachine *state_machine,
+                              gint             event)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GQuark event_quark = g_quark_try_string (event);
+  GsmStateMachinePostbox *postbox;
+  GsmStateMachinePostSlot *slot;
+  guint pos;
 
-  if (!event_quark || !_machine_has_event (state_machine, event_quark))
+  g_return_val_if_fail (GSM_IS_STATE_MACHINE (state_machine), FALSE);
+  g_return_val_if_fail (priv->def->sealed, FALSE);
+  g_return_val_if_fail (event >= 0 && event < priv->def->events->len, FALSE);
+
+  postbox = _machine_get_postbox (state_machine);
+
+  /* Claim a slot by moving the tail over it */
+  pos = g_atomic_int_get (&postbox->tail);
+  while (TRUE)
     {
-      g_critical ("The event %s has not been registered\n", event);
-      return;
+      gint diff;
+
+      slot = &postbox->ring[pos % POST_RING_SIZE];
+      diff = (gint) (g_atomic_int_get (&slot->sequence) - pos);
+
+      if (diff < 0)
+        return FALSE;
+
+      if (diff == 0 && g_atomic_int_compare_and_exchange (&postbox->tail, pos, pos + 1))
+        break;
+
+      pos = g_atomic_int_get (&postbox->tail);
     }
 
-  priv->pending_events = g_list_append (priv->pending_events, GINT_TO_POINTER (event_quark));
+  slot->bucket = event + 1;
+  g_atomic_int_set (&slot->sequence, pos + 1);
 
-  gsm_state_machine_internal_queue_update (state_machine);
+  _machine_post_wakeup (state_machine);
+
+  return TRUE;
 }
 
+/**
+ * gsm_state_machine_post_input_boolean:
+ * @state_machine: a #GsmStateMachine
+ * @input: the id of a boolean input
+ * @value: the new value
+ *
+ * Sets a boolean input from any thread. The value is applied once the main
+ * context of the machine runs, if the input is posted again before that
+ * only the last value is applied. Invalid values are rejected right away.
+ * Posting never blocks and only the very first post to a machine allocates,
+ * see gsm_state_machine_post_event().
+ */
 void
-gsm_state_machine_add_input (GsmStateMachine  *state_machine,
-                             GParamSpec       *pspec)
+gsm_state_machine_post_input_boolean (GsmStateMachine *state_machine,
+                                      gint             input,
+                                      gboolean         value)
 {
-  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GsmStateMachineValue *value = NULL;
-
-  g_assert (g_hash_table_lookup (priv->inputs, pspec->name) == NULL);
+  g_return_if_fail (GSM_IS_STATE_MACHINE (state_machine));
 
-  value = gsm_state_machine_value_new ();
-  value->pspec = g_param_spec_ref_sink (pspec);
-  value->idx   = g_hash_table_size (priv->inputs);
-  g_value_init (&value->value, G_PARAM_SPEC_VALUE_TYPE (value->pspec));
-  g_value_copy (g_param_spec_get_default_value (pspec), &value->value);
-
-  g_hash_table_insert (priv->inputs, (gpointer) pspec->name, value);
+  _machine_post_input (state_machine, input, G_TYPE_BOOLEAN, !!value);
 }
 
 void
-gsm_state_machine_add_output (GsmStateMachine  *state_machine,
-                              GParamSpec       *pspec)
+gsm_state_machine_post_input_int (GsmStateMachine *state_machine,
+                                  gint             input,
+                                  gint             value)
 {
-  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GsmStateMachineValue *value = NULL;
-  GQuark quark;
+  g_return_if_fail (GSM_IS_STATE_MACHINE (state_machine));
 
-  g_assert (g_hash_table_lookup (priv->outputs, pspec->name) == NULL);
-
-  value = gsm_state_machine_value_new ();
-  value->pspec = g_param_spec_ref_sink (pspec);
-  value->idx   = g_hash_table_size (priv->outputs);
-  g_value_init (&value->value, G_PARAM_SPEC_VALUE_TYPE (pspec));
-  g_value_copy (g_param_spec_get_default_value (pspec), &value->value);
+  _machine_post_input (state_machine, input, G_TYPE_INT, (guint64) value);
+}
 
-  g_hash_table_insert (priv->outputs, (gpointer) pspec->name, value);
+void
+gsm_state_machine_post_input_uint (GsmStateMachine *state_machine,
+                                   gint             input,
+                                   guint            value)
+{
+  g_return_if_fail (GSM_IS_STATE_MACHINE (state_machine));
 
-  /* Set default value in global table and the ALL group */
-  g_assert (priv->current_outputs->len == value->idx);
-  g_ptr_array_add (priv->current_outputs, &value->value);
+  _machine_post_input (state_machine, input, G_TYPE_UINT, value);
+}
 
-  g_assert (priv->all_state->outputs->len == value->idx);
-  g_ptr_array_add (priv->all_state->outputs, &value->value);
+void
+gsm_state_machine_post_input_int64 (GsmStateMachine *state_machine,
+                                    gint             input,
+                                    gint64           value)
+{
+  g_return_if_fail (GSM_IS_STATE_MACHINE (state_machine));
 
-  quark = g_quark_from_static_string (pspec->name);
-  g_array_append_val (priv->outputs_quark, quark);
+  _machine_post_input (state_machine, input, G_TYPE_INT64, (guint64) value);
 }
 
 void
-gsm_state_machine_map_output (GsmStateMachine  *state_machine,
-                              gint              state,
-                              const gchar      *output,
-                              const gchar      *input)
+gsm_state_machine_post_input_double (GsmStateMachine *state_machine,
+                                     gint             input,
+                                     gdouble          value)
 {
-  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GsmStateMachineState *sm_state = NULL;
-  GsmStateMachineValue *output_value;
-  GsmStateMachineValue *input_value;
+  guint64 raw;
 
-  sm_state = g_hash_table_lookup (priv->states, GINT_TO_POINTER (state));
-  g_assert (sm_state);
+  g_return_if_fail (GSM_IS_STATE_MACHINE (state_machine));
 
-  gsm_state_machine_state_ensure_outputs (sm_state, priv->outputs);
+  memcpy (&raw, &value, sizeof (gdouble));
+  _machine_post_input (state_machine, input, G_TYPE_DOUBLE, raw);
+}
 
-  output_value = g_hash_table_lookup (priv->outputs, output);
-  input_value = g_hash_table_lookup (priv->inputs, input);
+void
+gsm_state_machine_post_input_enum (GsmStateMachine *state_machine,
+                                   gint             input,
+                                   gint             value)
+{
+  g_return_if_fail (GSM_IS_STATE_MACHINE (state_machine));
 
-  g_ptr_array_remove_fast (sm_state->owned_values, sm_state->outputs->pdata[output_value->idx]);
-  sm_state->outputs->pdata[output_value->idx] = (gpointer) &input_value->value;
+  _machine_post_input (state_machine, input, G_TYPE_ENUM, (guint64) value);
 }
 
 #if 0
-void             gsm_state_machine_map_output_default  (GsmStateMachine  *state_machine,
-                                                        const gchar      *output,
-                                                        const gchar      *input);
-#endif
-
-#if 0
-void             gsm_state_machine_get_input           (GsmStateMachine  *state_machine,
+void             gsm_state_machine_get_output          (GsmStateMachine  *state_machine,
                                                         const gchar      *output,
                                                         ...);
 #endif
 
 void
-gsm_state_machine_get_input_value (GsmStateMachine  *state_machine,
-                                   const gchar      *input,
-                                   GValue           *out)
+gsm_state_machine_get_output_value (GsmStateMachine  *state_machine,
+                                    const gchar      *output,
+                                    GValue           *out)
 {
-  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GsmStateMachineValue *input_value;
+  gint id = gsm_state_machine_lookup_output (state_machine, output);
 
-  input_value = g_hash_table_lookup (priv->inputs, input);
+  g_return_if_fail (id >= 0);
 
-  g_value_init (out, G_VALUE_TYPE (&input_value->value));
-  g_value_copy (&input_value->value, out);
+  gsm_state_machine_get_output_value_by_id (state_machine, id, out);
 }
 
 void
-gsm_state_machine_set_input (GsmStateMachine  *state_machine,
-                             const gchar      *input,
-                             ...)
+gsm_state_machine_get_output_value_by_id (GsmStateMachine  *state_machine,
+                                          gint              output,
+                                          GValue           *out)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GsmStateMachineValue *input_value;
-  g_autofree gchar *error = NULL;
-  GValue value;
-  va_list var_args;
-
-  input_value = g_hash_table_lookup (priv->inputs, input);
-  g_assert (input_value);
+  GsmStateMachineValue *output_value;
 
-  va_start (var_args, input);
+  g_return_if_fail (output >= 0 && output < priv->def->outputs_by_id->len);
+  output_value = g_ptr_array_index (priv->def->outputs_by_id, output);
 
-  G_VALUE_COLLECT_INIT (&value, input_value->pspec->value_type, var_args,
-                        0, &error);
-  if (error)
-    {
-      g_warning ("%s: %s", G_STRFUNC, error);
-      g_value_unset (&value);
-    }
-  else
-    {
-      gsm_state_machine_set_input_value (state_machine, input, &value);
-    }
-  va_end (var_args);
+  g_value_init (out, G_VALUE_TYPE (&output_value->value));
+  g_value_copy (g_ptr_array_index (priv->current_outputs, output_value->idx), out);
 }
 
-void
-gsm_state_machine_set_input_value (GsmStateMachine  *state_machine,
-                                   const gchar      *input,
-                                   const GValue     *value)
+/**
+ * gsm_state_machine_peek_input_value:
+ * @state_machine: a #GsmStateMachine
+ * @input: the id of the input
+ *
+ * Like gsm_state_machine_get_input_value_by_id(), but without copying
+ * the value.
+ *
+ * Returns: (transfer none): the value of the input, it is updated in place
+ *   when the input changes.
+ */
+const GValue*
+gsm_state_machine_peek_input_value (GsmStateMachine  *state_machine,
+                                    gint              input)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
   GsmStateMachineValue *input_value;
 
-  input_value = g_hash_table_lookup (priv->inputs, input);
-
-  g_value_copy (value, &input_value->value);
+  g_return_val_if_fail (input >= 0 && input < priv->inputs_by_id->len, NULL);
+  input_value = g_ptr_array_index (priv->inputs_by_id, input);
 
-  g_signal_emit (state_machine, signals[SIGNAL_INPUT_CHANGED], g_quark_from_string (input), input, value);
+  return &input_value->value;
+}
 
-  for (guint i = 0; i < priv->current_outputs->len; i++)
-    {
-      /* Output value was updated if the pointers are identical. */
-      if (&input_value->value != g_ptr_array_index (priv->current_outputs, i))
-        continue;
+/**
+ * gsm_state_machine_peek_output_value:
+ * @state_machine: a #GsmStateMachine
+ * @output: the id of the output
+ *
+ * Like gsm_state_machine_get_output_value_by_id(), but without copying
+ * the value. Use gsm_state_machine_get_generation() to find out whether
+ * it needs to be fetched again.
+ *
+ * Returns: (transfer none): the current value of the output, only valid
+ *   until the machine is updated or modified.
+ */
+const GValue*
+gsm_state_machine_peek_output_value (GsmStateMachine  *state_machine,
+                                     gint              output)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
 
-      g_signal_emit (state_machine,
-                     signals[SIGNAL_OUTPUT_CHANGED],
-                     g_array_index (priv->outputs_quark, GQuark, i),
-                     g_quark_to_string (g_array_index (priv->outputs_quark, GQuark, i)),
-                     &input_value->value, FALSE, FALSE);
-    }
+  g_return_val_if_fail (output >= 0 && output < priv->def->outputs_by_id->len, NULL);
 
-  gsm_state_machine_internal_queue_update (state_machine);
+  return g_ptr_array_index (priv->current_outputs, output);
 }
 
-
-#if 0
-void             gsm_state_machine_get_output          (GsmStateMachine  *state_machine,
-                                                        const gchar      *output,
-                                                        ...);
-#endif
-
-void
-gsm_state_machine_get_output_value (GsmStateMachine  *state_machine,
-                                    const gchar      *output,
-                                    GValue           *out)
+/**
+ * gsm_state_machine_get_generation:
+ * @state_machine: a #GsmStateMachine
+ *
+ * Returns a counter that is incremented whenever the state, an input or
+ * an output changes. If it is the same as during an earlier read, none of
+ * the values can have changed in between.
+ *
+ * Returns: the current generation
+ */
+guint64
+gsm_state_machine_get_generation (GsmStateMachine  *state_machine)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
-  GsmStateMachineValue *output_value;
 
-  output_value = g_hash_table_lookup (priv->outputs, output);
-
-  g_value_init (out, G_VALUE_TYPE (&output_value->value));
-  g_value_copy (g_ptr_array_index (priv->current_outputs, output_value->idx), out);
+  return priv->generation;
 }
 
 void
@@ -1321,7 +3560,7 @@ gsm_state_machine_set_output (GsmStateMachine  *state_machine,
   GValue value;
   va_list var_args;
 
-  output_value = g_hash_table_lookup (priv->outputs, output);
+  output_value = g_hash_table_lookup (priv->def->outputs, output);
   g_assert (output_value);
 
   va_start (var_args, output);
@@ -1349,32 +3588,33 @@ gsm_state_machine_set_output_value (GsmStateMachine  *state_machine,
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
   GsmStateMachineState *sm_state;
   GsmStateMachineValue *output_value;
-  GValue *new;
+  GsmStateMachineOutputValue *new;
 
-  output_value = g_hash_table_lookup (priv->outputs, output);
+  g_return_if_fail (!priv->def->sealed);
 
-  sm_state = g_hash_table_lookup (priv->states, GINT_TO_POINTER (state));
+  sm_state = g_hash_table_lookup (priv->def->states, GINT_TO_POINTER (state));
   g_assert (sm_state);
 
-  gsm_state_machine_state_ensure_outputs (sm_state, priv->outputs);
+  gsm_state_machine_state_ensure_outputs (sm_state, priv->def->outputs);
 
-  output_value = g_hash_table_lookup (priv->outputs, output);
+  output_value = g_hash_table_lookup (priv->def->outputs, output);
 
   g_ptr_array_remove_fast (sm_state->owned_values, sm_state->outputs->pdata[output_value->idx]);
 
-  new = g_new0 (GValue, 1);
+  new = g_new0 (GsmStateMachineOutputValue, 1);
+  new->input = -1;
   g_ptr_array_add (sm_state->owned_values, new);
 
-  g_value_init (new, G_PARAM_SPEC_VALUE_TYPE (output_value->pspec));
-  g_value_copy (value, new);
+  g_value_init (&new->value, G_PARAM_SPEC_VALUE_TYPE (output_value->pspec));
+  g_value_copy (value, &new->value);
   sm_state->outputs->pdata[output_value->idx] = new;
 
   while (sm_state->leader)
     sm_state = sm_state->leader;
 
   /* If we are currently in this state, then the output may have changed */
-  if (state == priv->state)
-    gsm_state_machine_internal_update_outputs (state_machine, sm_state);
+  if (state == priv->instance->current_state->value)
+    gsm_state_machine_internal_update_outputs (state_machine, sm_state, FALSE, FALSE);
 }
 
 
@@ -1388,12 +3628,21 @@ gsm_state_machine_create_condition (GsmStateMachine      *state_machine,
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
   GsmStateMachineCondition *condition = NULL;
+  GsmStateMachineValue *input_value;
   guint conditions_len = g_strv_length (conditions);
 
+  g_return_if_fail (!priv->def->sealed);
+
+  input_value = g_hash_table_lookup (priv->def->inputs, input);
+  g_return_if_fail (input_value != NULL);
+
   condition = gsm_state_machine_condition_new ();
+  condition->idx = priv->def->input_conditions->len;
   condition->type = type;
   condition->input = g_quark_from_string (input);
+  condition->input_idx = input_value->idx;
   condition->getter = func;
+  condition->first_index = priv->def->condition_quarks->len;
 
   for (guint i = 0; i < conditions_len; i++)
     {
@@ -1423,9 +3672,20 @@ gsm_state_machine_create_condition (GsmStateMachine      *state_machine,
 
       g_array_append_val (condition->conditions, quark);
       g_array_append_val (condition->conditions_neg, quark_neg);
+
+      g_array_append_val (priv->def->condition_quarks, quark);
+      g_hash_table_insert (priv->def->condition_indices, GUINT_TO_POINTER (quark), GUINT_TO_POINTER (priv->def->condition_quarks->len));
+      g_array_append_val (priv->def->condition_quarks, quark_neg);
+      g_hash_table_insert (priv->def->condition_indices, GUINT_TO_POINTER (quark_neg), GUINT_TO_POINTER (priv->def->condition_quarks->len));
     }
 
-  g_ptr_array_add (priv->input_conditions, condition);
+
+  g_ptr_array_add (priv->def->input_conditions, condition);
+  g_ptr_array_add (input_value->conditions, condition);
+  priv->instance = gsm_instance_internal_resize (priv->instance);
+
+  /* Force evaluation of the new condition on the next update */
+  gsm_state_machine_internal_mark_input_dirty (state_machine, g_ptr_array_index (priv->inputs_by_id, input_value->idx));
 }
 
 static GQuark
@@ -1448,6 +3708,12 @@ _state_machine_enum_condition (GQuark condition, GsmConditionType type, const GV
   const gchar *prefix;
 
   enum_class_value = g_enum_get_value (enum_class, enum_value);
+  if (!enum_class_value)
+    {
+      g_critical ("Value %d is not part of the enum of input \"%s\"",
+                  enum_value, g_quark_to_string (condition));
+      return 0;
+    }
   value_nick = enum_class_value->value_nick;
 
   /* XXX: This is kinda ugly, right? Maybe we need some sort of API change ... */
@@ -1468,6 +3734,33 @@ _state_machine_enum_condition (GQuark condition, GsmConditionType type, const GV
   return g_quark_try_string (detailed_condition);
 }
 
+/* Precomputes the value to condition mapping so that evaluating the
+ * condition neither allocates nor interns strings. Only done if the enum
+ * is reasonably dense, otherwise the getter is used. */
+static void
+gsm_state_machine_condition_build_enum_table (GsmStateMachineCondition *condition,
+                                              GEnumClass               *enum_class)
+{
+  guint range;
+
+  g_assert (condition->conditions->len == enum_class->n_values);
+
+  range = (guint) enum_class->maximum - (guint) enum_class->minimum;
+  if (range >= 4 * enum_class->n_values + 64)
+    return;
+  range += 1;
+
+  condition->enum_min = enum_class->minimum;
+  condition->enum_table_len = range;
+  condition->enum_table = g_new (gint, range);
+  for (guint i = 0; i < range; i++)
+    condition->enum_table[i] = -1;
+
+  /* The first nick wins for aliased values, same as g_enum_get_value () */
+  for (guint i = enum_class->n_values; i > 0; i--)
+    condition->enum_table[(guint) enum_class->values[i - 1].value - (guint) enum_class->minimum] = i - 1;
+}
+
 void
 gsm_state_machine_create_default_condition (GsmStateMachine      *state_machine,
                                             const gchar          *input,
@@ -1477,7 +3770,9 @@ gsm_state_machine_create_default_condition (GsmStateMachine      *state_machine,
   GsmStateMachineValue *input_value;
   g_autoptr(GPtrArray) conditions = NULL;
 
-  input_value = g_hash_table_lookup (priv->inputs, input);
+  g_return_if_fail (!priv->def->sealed);
+
+  input_value = g_hash_table_lookup (priv->def->inputs, input);
 
   if (g_type_is_a (G_PARAM_SPEC_VALUE_TYPE (input_value->pspec), G_TYPE_BOOLEAN))
     {
@@ -1511,6 +3806,10 @@ gsm_state_machine_create_default_condition (GsmStateMachine      *state_machine,
                                           (const GStrv) conditions->pdata,
                                           type,
                                           _state_machine_enum_condition);
+
+      gsm_state_machine_condition_build_enum_table (g_ptr_array_index (priv->def->input_conditions,
+                                                                       priv->def->input_conditions->len - 1),
+                                                    enum_class);
     }
   else
     {
@@ -1518,6 +3817,78 @@ gsm_state_machine_create_default_condition (GsmStateMachine      *state_machine,
     }
 }
 
+/**
+ * gsm_state_machine_create_threshold_condition:
+ * @state_machine: a #GsmStateMachine
+ * @input: the name of a numeric input
+ * @thresholds: (array zero-terminated=1): the thresholds in ascending order
+ * @type: %GSM_CONDITION_TYPE_GEQ or %GSM_CONDITION_TYPE_LEQ
+ * @hysteresis: how far the value needs to fall below a threshold again
+ *   before it is considered crossed
+ *
+ * Creates range conditions for a numeric input. The thresholds are given
+ * as strings and used in the name of the conditions, i.e. the threshold
+ * "80.0" of the "temp" input results in the conditions `>=temp::80.0` and
+ * `<temp::80.0` for %GSM_CONDITION_TYPE_GEQ.
+ */
+void
+gsm_state_machine_create_threshold_condition (GsmStateMachine      *state_machine,
+                                              const gchar          *input,
+                                              const GStrv           thresholds,
+                                              GsmConditionType      type,
+                                              gdouble               hysteresis)
+{
+  GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
+  GsmStateMachineValue *input_value;
+  GsmStateMachineCondition *condition;
+  g_autoptr(GPtrArray) conditions = NULL;
+  g_autofree gdouble *values = NULL;
+  guint n_thresholds = g_strv_length (thresholds);
+
+  g_return_if_fail (!priv->def->sealed);
+
+  input_value = g_hash_table_lookup (priv->def->inputs, input);
+  g_return_if_fail (input_value != NULL);
+  g_return_if_fail (_value_type_is_numeric (G_PARAM_SPEC_VALUE_TYPE (input_value->pspec)));
+  g_return_if_fail (type == GSM_CONDITION_TYPE_GEQ || type == GSM_CONDITION_TYPE_LEQ);
+  g_return_if_fail (n_thresholds > 0);
+  g_return_if_fail (hysteresis >= 0.0);
+
+  values = g_new (gdouble, n_thresholds);
+  conditions = g_ptr_array_new_with_free_func (g_free);
+
+  for (guint i = 0; i < n_thresholds; i++)
+    {
+      gchar *end;
+
+      values[i] = g_ascii_strtod (thresholds[i], &end);
+      if (end == thresholds[i] || *end != '\0')
+        {
+          g_critical ("Threshold \"%s\" of input %s is not a number", thresholds[i], input);
+          return;
+        }
+
+      if (i > 0 && values[i] <= values[i - 1])
+        {
+          g_critical ("Thresholds of input %s are not in ascending order", input);
+          return;
+        }
+
+      g_ptr_array_add (conditions, g_strconcat (input, "::", thresholds[i], NULL));
+    }
+  g_ptr_array_add (conditions, NULL);
+
+  gsm_state_machine_create_condition (state_machine,
+                                      input,
+                                      (const GStrv) conditions->pdata,
+                                      type,
+                                      NULL);
+
+  condition = g_ptr_array_index (priv->def->input_conditions, priv->def->input_conditions->len - 1);
+  condition->thresholds = g_steal_pointer (&values);
+  condition->hysteresis = hysteresis;
+}
+
 void
 gsm_state_machine_add_edge (GsmStateMachine  *state_machine,
                             gint              start_state,
@@ -1566,29 +3937,99 @@ gsm_state_machine_add_edge_strv (GsmStateMachine  *state_machine,
                                  gint              start_state,
                                  gint              target_state,
                                  const GStrv       conditions)
+{
+  gsm_state_machine_internal_add_edge (state_machine, start_state, target_state, 0, conditions);
+}
+
+/**
+ * gsm_state_machine_add_timeout_edge:
+ * @state_machine: a #GsmStateMachine
+ * @start_state: the state (or group) the edge starts at
+ * @target_state: the target state (or group)
+ * @timeout: time in milliseconds, must not be 0
+ * @...: %NULL terminated list of conditions
+ *
+ * Adds an edge that is taken once @start_state has been active for @timeout
+ * milliseconds and the conditions are met. Timeout edges cannot have an
+ * event and are only used if no untimed edge applies; if several timeout
+ * edges apply, the one with the shortest timeout is taken. Timeout edges
+ * with the same timeout must not overlap, just like untimed edges.
+ *
+ * The time is measured from entering the current state, so the timer starts
+ * again on any transition (including transitions within @start_state when it
+ * is a group).
+ */
+void
+gsm_state_machine_add_timeout_edge (GsmStateMachine  *state_machine,
+                                    gint              start_state,
+                                    gint              target_state,
+                                    guint             timeout,
+                                    ...)
+{
+  const gchar *condition;
+  g_autoptr(GPtrArray) conditions = NULL;
+  va_list var_args;
+
+  conditions = g_ptr_array_new ();
+
+  va_start (var_args, timeout);
+  while ((condition = va_arg (var_args, const gchar*)))
+    g_ptr_array_add (conditions, (gchar*) condition);
+  va_end (var_args);
+
+  g_ptr_array_add (conditions, NULL);
+
+  gsm_state_machine_add_timeout_edge_strv (state_machine,
+                                          start_state,
+                                          target_state,
+                                          timeout,
+                                          (GStrv) conditions->pdata);
+}
+
+void
+gsm_state_machine_add_timeout_edge_strv (GsmStateMachine  *state_machine,
+                                         gint              start_state,
+                                         gint              target_state,
+                                         guint             timeout,
+                                         const GStrv       conditions)
+{
+  g_return_if_fail (timeout > 0);
+
+  gsm_state_machine_internal_add_edge (state_machine, start_state, target_state, timeout, conditions);
+}
+
+static void
+gsm_state_machine_internal_add_edge (GsmStateMachine  *state_machine,
+                                     gint              start_state,
+                                     gint              target_state,
+                                     guint             timeout,
+                                     const GStrv       conditions)
 {
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
   GsmStateMachineState *sm_state;
   GsmStateMachineTransition *transition;
   guint conditions_len = g_strv_length (conditions);
 
+  g_return_if_fail (!priv->def->sealed);
   g_return_if_fail (start_state != target_state);
 
-  sm_state = g_hash_table_lookup (priv->states, GINT_TO_POINTER (start_state));
+  sm_state = g_hash_table_lookup (priv->def->states, GINT_TO_POINTER (start_state));
   g_assert (sm_state);
 
   /* Check the target state (or group) exists */
-  g_assert (g_hash_table_lookup (priv->states, GINT_TO_POINTER (target_state)));
+  g_assert (g_hash_table_lookup (priv->def->states, GINT_TO_POINTER (target_state)));
 
-  transition = gsm_state_machine_transition_new ();
+  transition = gsm_state_machine_transition_new (priv->def->condition_quarks->len);
   transition->target_state = target_state;
+  transition->timeout = timeout;
 
-  /* Build the conditions quark list */
+  /* Build the conditions set */
   for (gint i = 0; i < conditions_len; i++)
     {
       GQuark condition = g_quark_from_string (conditions[i]);
+      gint index = _machine_condition_index (state_machine, condition);
 
-      if (!_machine_has_condition (state_machine, condition))
+      if (index < 0)
         {
           if (!_machine_has_event (state_machine, condition))
             {
@@ -1605,10 +4046,16 @@ gsm_state_machine_add_edge_strv (GsmStateMachine  *state_machine,
             }
         }
       else
-        g_array_append_val (transition->conditions, condition);
+        gsm_bitset_set (transition->conditions, index);
     }
 
-  g_array_sort (transition->conditions, _condition_cmp);
+  if (transition->timeout && transition->event)
+    {
+      g_critical ("Timeout edges cannot have an event, rejecting edge with event %s",
+                  g_quark_to_string (transition->event));
+      gsm_state_machine_transition_destroy (transition);
+      return;
+    }
 
   gsm_state_machine_state_add_transition (state_machine, sm_state, transition);
 }
@@ -1648,13 +4095,15 @@ gsm_state_machine_create_group_array (GsmStateMachine  *state_machine,
   GsmStateMachinePrivate *priv = GSM_STATE_MACHINE_PRIVATE (state_machine);
   GsmStateMachineState *group;
   GsmStateMachineState *leader;
+
+  g_return_val_if_fail (!priv->def->sealed, 0);
   g_assert (count > 0);
   g_assert (children);
 
-  priv->last_group--;
+  priv->def->last_group--;
 
-  group = gsm_state_machine_state_new (g_quark_from_string (name), priv->last_group);
-  leader = g_hash_table_lookup (priv->states, GINT_TO_POINTER (children[0]));
+  group = gsm_state_machine_state_new (g_quark_from_string (name), priv->def->last_group);
+  leader = g_hash_table_lookup (priv->def->states, GINT_TO_POINTER (children[0]));
 
   /* Put the new group on the same level as the leader, then move the leader. */
   gsm_state_machine_state_reparent (group, leader->parent);
@@ -1665,11 +4114,12 @@ gsm_state_machine_create_group_array (GsmStateMachine  *state_machine,
     {
       GsmStateMachineState *state;
 
-      state = g_hash_table_lookup (priv->states, GINT_TO_POINTER (children[i]));
+      state = g_hash_table_lookup (priv->def->states, GINT_TO_POINTER (children[i]));
       gsm_state_machine_state_reparent (state, group);
     }
 
-  g_hash_table_insert (priv->states, GINT_TO_POINTER (group->value), group);
+  g_hash_table_insert (priv->def->states, GINT_TO_POINTER (group->value), group);
+  priv->def->compiled = FALSE;
 
   return group->value;
 }
@@ -1708,28 +4158,26 @@ _add_transitions_to_dot (GsmStateMachine      *state_machine,
   for (guint i = 0; i < state->transitions->len; i++)
     {
       GsmStateMachineTransition *transition = g_ptr_array_index (state->transitions, i);
-      GsmStateMachineState *target = g_hash_table_lookup (priv->states, GINT_TO_POINTER (transition->target_state));
+      GsmStateMachineState *target = g_hash_table_lookup (priv->def->states, GINT_TO_POINTER (transition->target_state));
       GsmStateMachineState *real_target, *real_state;
       g_autoptr(GPtrArray) conditions = g_ptr_array_new ();
       g_autofree gchar *label = NULL;
 
-      real_target = target;
-      while (real_target->leader)
-        real_target = real_target->leader;
+      real_target = target->real;
 
       /* Ignore tranistions to ourselves */
       if (state == real_target)
         continue;
 
-      real_state = state;
-      while (real_state->leader)
-        real_state = real_state->leader;
+      real_state = state->real;
 
       if (transition->event)
         g_ptr_array_add (conditions, (gpointer) g_quark_to_string (transition->event));
 
-      for (guint j = 0; j < transition->conditions->len; j++)
-        g_ptr_array_add (conditions, (gpointer) g_quark_to_string (g_array_index (transition->conditions, GQuark, j)));
+      for (gint index = gsm_bitset_next (transition->conditions, 0);
+           index >= 0;
+           index = gsm_bitset_next (transition->conditions, index + 1))
+        g_ptr_array_add (conditions, (gpointer) g_quark_to_string (g_array_index (priv->def->condition_quarks, GQuark, index)));
 
       g_ptr_array_add (conditions, NULL);
       label = g_strjoinv (" &\n", (GStrv) conditions->pdata);
@@ -1773,8 +4221,10 @@ gsm_state_machine_to_dot_file (GsmStateMachine  *state_machine,
   g_ptr_array_add (chunks, g_strdup ("digraph finite_state_machine {"));
   g_ptr_array_add (chunks, g_strdup ("  compound=true;"));
 
-  _add_nodes_to_dot (state_machine, priv->all_state, chunks);
-  _add_transitions_to_dot (state_machine, priv->all_state, chunks);
+  gsm_state_machine_definition_compile (priv->def);
+
+  _add_nodes_to_dot (state_machine, priv->def->all_state, chunks);
+  _add_transitions_to_dot (state_machine, priv->def->all_state, chunks);
 
   g_ptr_array_add (chunks, g_strdup ("}"));
   g_ptr_array_add (chunks, NULL);
@@ -20,7 +20,9 @@
 
 #pragma once
 
-#include "gsm.h"
+#include "gsm-enum-types.h"
+#include "gsm-scheduler.h"
+#include "gsm-clock.h"
 #include <glib-object.h>
 
 G_BEGIN_DECLS
@@ -36,8 +38,68 @@ typedef enum {
   GSM_CONDITION_TYPE_LEQ,
 } GsmConditionType;
 
+/**
+ * GsmUpdateMode:
+ * @GSM_UPDATE_MODE_SINGLE_STEP: At most one transition is done per dispatch.
+ * @GSM_UPDATE_MODE_RUN_TO_COMPLETION: Transitions are done until the machine
+ *   is stable or the step budget (#GsmStateMachine:max-steps) is used up.
+ */
+typedef enum {
+  GSM_UPDATE_MODE_SINGLE_STEP,
+  GSM_UPDATE_MODE_RUN_TO_COMPLETION,
+} GsmUpdateMode;
+
+/**
+ * GsmStepResult:
+ * @GSM_STEP_RESULT_STABLE: Nothing was done, the machine is stable.
+ * @GSM_STEP_RESULT_TRANSITION: A transition into a new state was done.
+ * @GSM_STEP_RESULT_EVENT_DROPPED: A pending event was processed, but it did
+ *   not cause a transition.
+ */
+typedef enum {
+  GSM_STEP_RESULT_STABLE,
+  GSM_STEP_RESULT_TRANSITION,
+  GSM_STEP_RESULT_EVENT_DROPPED,
+} GsmStepResult;
+
+/**
+ * GsmEventOverflowPolicy:
+ * @GSM_EVENT_OVERFLOW_DROP_OLDEST: The oldest pending event is dropped to
+ *   make room for the new one.
+ * @GSM_EVENT_OVERFLOW_DROP_NEWEST: The new event is dropped silently.
+ * @GSM_EVENT_OVERFLOW_REJECT: The new event is rejected, i.e. queueing it
+ *   returns %FALSE.
+ * @GSM_EVENT_OVERFLOW_COALESCE: An event that is already pending is never
+ *   queued a second time. Other events are rejected if the queue is full.
+ *
+ * What happens to events queued while the event queue is at capacity.
+ */
+typedef enum {
+  GSM_EVENT_OVERFLOW_DROP_OLDEST,
+  GSM_EVENT_OVERFLOW_DROP_NEWEST,
+  GSM_EVENT_OVERFLOW_REJECT,
+  GSM_EVENT_OVERFLOW_COALESCE,
+} GsmEventOverflowPolicy;
+
 typedef GQuark (*GsmConditionFunc) (GQuark condition, GsmConditionType type, const GValue *value);
 
+/**
+ * GsmStateMachineDefinition:
+ *
+ * The sealed, immutable definition of a #GsmStateMachine that can be
+ * shared by many machines.
+ */
+typedef struct _GsmStateMachineDefinition GsmStateMachineDefinition;
+
+#define GSM_TYPE_STATE_MACHINE_DEFINITION (gsm_state_machine_definition_get_type())
+
+GType                      gsm_state_machine_definition_get_type       (void) G_GNUC_CONST;
+GsmStateMachineDefinition *gsm_state_machine_definition_ref            (GsmStateMachineDefinition *definition);
+void                       gsm_state_machine_definition_unref          (GsmStateMachineDefinition *definition);
+GType                      gsm_state_machine_definition_get_state_type (GsmStateMachineDefinition *definition);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsmStateMachineDefinition, gsm_state_machine_definition_unref)
+
 #define GSM_TYPE_STATE_MACHINE (gsm_state_machine_get_type())
 
 G_DECLARE_DERIVABLE_TYPE (GsmStateMachine, gsm_state_machine, GSM, STATE_MACHINE, GObject)
@@ -57,6 +119,9 @@ struct _GsmStateMachineClass
 #define GSM_STATES_ALL (-1)
 
 GsmStateMachine *gsm_state_machine_new                 (GType state_type);
+GsmStateMachine *gsm_state_machine_new_from_definition (GsmStateMachineDefinition *definition);
+
+GsmStateMachineDefinition *gsm_state_machine_get_definition (GsmStateMachine  *state_machine);
 
 gint             gsm_state_machine_get_state           (GsmStateMachine  *state_machine);
 GType            gsm_state_machine_get_state_type      (GsmStateMachine  *state_machine);
@@ -65,15 +130,51 @@ gboolean         gsm_state_machine_get_running         (GsmStateMachine  *state_
 void             gsm_state_machine_set_running         (GsmStateMachine  *state_machine,
                                                         gboolean          running);
 
-void             gsm_state_machine_add_event           (GsmStateMachine  *state_machine,
+GMainContext    *gsm_state_machine_get_main_context    (GsmStateMachine  *state_machine);
+GsmScheduler    *gsm_state_machine_get_scheduler       (GsmStateMachine  *state_machine);
+GsmClock        *gsm_state_machine_get_clock           (GsmStateMachine  *state_machine);
+gint             gsm_state_machine_get_priority        (GsmStateMachine  *state_machine);
+void             gsm_state_machine_set_priority        (GsmStateMachine  *state_machine,
+                                                        gint              priority);
+
+GsmUpdateMode    gsm_state_machine_get_update_mode     (GsmStateMachine  *state_machine);
+void             gsm_state_machine_set_update_mode     (GsmStateMachine  *state_machine,
+                                                        GsmUpdateMode     mode);
+
+guint            gsm_state_machine_get_max_steps       (GsmStateMachine  *state_machine);
+void             gsm_state_machine_set_max_steps       (GsmStateMachine  *state_machine,
+                                                        guint             max_steps);
+
+GsmStepResult    gsm_state_machine_step                (GsmStateMachine  *state_machine);
+gboolean         gsm_state_machine_settle              (GsmStateMachine  *state_machine,
+                                                        guint             max_steps,
+                                                        guint            *n_transitions);
+
+gint             gsm_state_machine_add_event           (GsmStateMachine  *state_machine,
                                                         const gchar      *event);
-void             gsm_state_machine_queue_event          (GsmStateMachine  *state_machine,
+gint             gsm_state_machine_lookup_event        (GsmStateMachine  *state_machine,
                                                         const gchar      *event);
-
-void             gsm_state_machine_add_input           (GsmStateMachine  *state_machine,
+gboolean         gsm_state_machine_queue_event         (GsmStateMachine  *state_machine,
+                                                        const gchar      *event);
+gboolean         gsm_state_machine_queue_event_by_id   (GsmStateMachine  *state_machine,
+                                                        gint              event);
+guint            gsm_state_machine_get_n_pending_events (GsmStateMachine *state_machine);
+
+guint            gsm_state_machine_get_event_capacity  (GsmStateMachine  *state_machine);
+void             gsm_state_machine_set_event_capacity  (GsmStateMachine  *state_machine,
+                                                        guint             capacity);
+GsmEventOverflowPolicy gsm_state_machine_get_event_overflow_policy (GsmStateMachine       *state_machine);
+void             gsm_state_machine_set_event_overflow_policy (GsmStateMachine       *state_machine,
+                                                              GsmEventOverflowPolicy policy);
+
+gint             gsm_state_machine_add_input           (GsmStateMachine  *state_machine,
                                                         GParamSpec       *pspec);
-void             gsm_state_machine_add_output          (GsmStateMachine  *state_machine,
+gint             gsm_state_machine_add_output          (GsmStateMachine  *state_machine,
                                                         GParamSpec       *pspec);
+gint             gsm_state_machine_lookup_input        (GsmStateMachine  *state_machine,
+                                                        const gchar      *input);
+gint             gsm_state_machine_lookup_output       (GsmStateMachine  *state_machine,
+                                                        const gchar      *output);
 
 void             gsm_state_machine_map_output          (GsmStateMachine  *state_machine,
                                                         gint              state,
@@ -93,6 +194,9 @@ void             gsm_state_machine_get_input           (GsmStateMachine  *state_
 void             gsm_state_machine_get_input_value     (GsmStateMachine  *state_machine,
                                                         const gchar      *input,
                                                         GValue           *out);
+void             gsm_state_machine_get_input_value_by_id (GsmStateMachine *state_machine,
+                                                          gint             input,
+                                                          GValue          *out);
 
 void             gsm_state_machine_set_input           (GsmStateMachine  *state_machine,
                                                         const gchar      *input,
@@ -100,6 +204,76 @@ void             gsm_state_machine_set_input           (GsmStateMachine  *state_
 void             gsm_state_machine_set_input_value     (GsmStateMachine  *state_machine,
                                                         const gchar      *input,
                                                         const GValue     *value);
+void             gsm_state_machine_set_input_by_id     (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        ...);
+void             gsm_state_machine_set_input_value_by_id (GsmStateMachine *state_machine,
+                                                          gint             input,
+                                                          const GValue    *value);
+
+void             gsm_state_machine_set_input_boolean   (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gboolean          value);
+void             gsm_state_machine_set_input_int       (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gint              value);
+void             gsm_state_machine_set_input_uint      (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        guint             value);
+void             gsm_state_machine_set_input_int64     (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gint64            value);
+void             gsm_state_machine_set_input_double    (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gdouble           value);
+void             gsm_state_machine_set_input_enum      (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gint              value);
+
+gboolean         gsm_state_machine_get_input_boolean   (GsmStateMachine  *state_machine,
+                                                        gint              input);
+gint             gsm_state_machine_get_input_int       (GsmStateMachine  *state_machine,
+                                                        gint              input);
+guint            gsm_state_machine_get_input_uint      (GsmStateMachine  *state_machine,
+                                                        gint              input);
+gint64           gsm_state_machine_get_input_int64     (GsmStateMachine  *state_machine,
+                                                        gint              input);
+gdouble          gsm_state_machine_get_input_double    (GsmStateMachine  *state_machine,
+                                                        gint              input);
+gint             gsm_state_machine_get_input_enum      (GsmStateMachine  *state_machine,
+                                                        gint              input);
+
+void             gsm_state_machine_set_input_tolerance (GsmStateMachine  *state_machine,
+                                                        const gchar      *input,
+                                                        gdouble           tolerance);
+gdouble          gsm_state_machine_get_input_tolerance (GsmStateMachine  *state_machine,
+                                                        const gchar      *input);
+guint64          gsm_state_machine_get_n_suppressed_inputs (GsmStateMachine *state_machine,
+                                                            const gchar     *input);
+
+void             gsm_state_machine_begin_update        (GsmStateMachine  *state_machine);
+void             gsm_state_machine_commit_update       (GsmStateMachine  *state_machine);
+
+gboolean         gsm_state_machine_post_event          (GsmStateMachine  *state_machine,
+                                                        gint              event);
+void             gsm_state_machine_post_input_boolean  (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gboolean          value);
+void             gsm_state_machine_post_input_int      (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gint              value);
+void             gsm_state_machine_post_input_uint     (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        guint             value);
+void             gsm_state_machine_post_input_int64    (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gint64            value);
+void             gsm_state_machine_post_input_double   (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gdouble           value);
+void             gsm_state_machine_post_input_enum     (GsmStateMachine  *state_machine,
+                                                        gint              input,
+                                                        gint              value);
 
 #if 0
 void             gsm_state_machine_get_output          (GsmStateMachine  *state_machine,
@@ -109,6 +283,15 @@ void             gsm_state_machine_get_output          (GsmStateMachine  *state_
 void             gsm_state_machine_get_output_value    (GsmStateMachine  *state_machine,
                                                         const gchar      *output,
                                                         GValue           *out);
+void             gsm_state_machine_get_output_value_by_id (GsmStateMachine *state_machine,
+                                                           gint             output,
+                                                           GValue          *out);
+
+const GValue*    gsm_state_machine_peek_input_value    (GsmStateMachine  *state_machine,
+                                                        gint              input);
+const GValue*    gsm_state_machine_peek_output_value   (GsmStateMachine  *state_machine,
+                                                        gint              output);
+guint64          gsm_state_machine_get_generation      (GsmStateMachine  *state_machine);
 
 void             gsm_state_machine_set_output          (GsmStateMachine  *state_machine,
                                                         gint              state,
@@ -129,6 +312,11 @@ void             gsm_state_machine_create_condition    (GsmStateMachine      *st
 void             gsm_state_machine_create_default_condition (GsmStateMachine      *state_machine,
                                                              const gchar          *input,
                                                              GsmConditionType      type);
+void             gsm_state_machine_create_threshold_condition (GsmStateMachine      *state_machine,
+                                                               const gchar          *input,
+                                                               const GStrv           thresholds,
+                                                               GsmConditionType      type,
+                                                               gdouble               hysteresis);
 
 
 void             gsm_state_machine_add_edge            (GsmStateMachine  *state_machine,
@@ -146,6 +334,18 @@ void             gsm_state_machine_add_edge_strv       (GsmStateMachine  *state_
                                                         gint              target_state,
                                                         const GStrv       conditions);
 
+void             gsm_state_machine_add_timeout_edge    (GsmStateMachine  *state_machine,
+                                                        gint              start_state,
+                                                        gint              target_state,
+                                                        guint             timeout,
+                                                        ...) G_GNUC_NULL_TERMINATED;
+
+void             gsm_state_machine_add_timeout_edge_strv (GsmStateMachine  *state_machine,
+                                                          gint              start_state,
+                                                          gint              target_state,
+                                                          guint             timeout,
+                                                          const GStrv       conditions);
+
 gint             gsm_state_machine_create_group        (GsmStateMachine  *state_machine,
                                                         const gchar*      name,
                                                         gint              count,
@@ -0,0 +1,332 @@
+/* gsm-timer-wheel.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <string.h>
+
+#include "gsm-timer-wheel.h"
+
+/* A timer is stored on the highest level at which its expiry differs from
+ * the current time, in the slot given by the expiry at that level. All
+ * higher levels are equal, so the slot is always ahead of the current
+ * position of the level and the timer is due to move down (or expire)
+ * exactly when the wheel reaches the start of the slot. */
+
+#define LEVEL_SHIFT(level) ((level) * GSM_TIMER_WHEEL_BITS)
+#define WHEEL_RANGE_SHIFT  LEVEL_SHIFT (GSM_TIMER_WHEEL_LEVELS)
+
+void
+gsm_timer_wheel_init (GsmTimerWheel *wheel,
+                      gint64         now)
+{
+  memset (wheel, 0, sizeof (GsmTimerWheel));
+  wheel->now = now;
+}
+
+static void
+_queue_clear (GQueue *queue)
+{
+  GList *link;
+
+  while ((link = g_queue_pop_head_link (queue)))
+    ((GsmTimer *) link->data)->queue = NULL;
+}
+
+void
+gsm_timer_wheel_clear (GsmTimerWheel *wheel)
+{
+  for (guint level = 0; level < GSM_TIMER_WHEEL_LEVELS; level++)
+    {
+      for (guint slot = 0; slot < GSM_TIMER_WHEEL_SLOTS; slot++)
+        _queue_clear (&wheel->slots[level][slot]);
+      wheel->occupied[level] = 0;
+    }
+
+  _queue_clear (&wheel->overflow);
+  wheel->n_timers = 0;
+}
+
+void
+gsm_timer_init (GsmTimer     *timer,
+                GsmTimerFunc  func,
+                gpointer      user_data)
+{
+  memset (timer, 0, sizeof (GsmTimer));
+  timer->link.data = timer;
+  timer->func = func;
+  timer->user_data = user_data;
+}
+
+gboolean
+gsm_timer_is_armed (GsmTimer *timer)
+{
+  return timer->queue != NULL;
+}
+
+static gboolean
+_queue_is_slot (GsmTimerWheel *wheel,
+                GQueue        *queue)
+{
+  return queue >= &wheel->slots[0][0] &&
+         queue < &wheel->slots[0][0] + GSM_TIMER_WHEEL_LEVELS * GSM_TIMER_WHEEL_SLOTS;
+}
+
+static void
+_wheel_place (GsmTimerWheel *wheel,
+              GsmTimer      *timer)
+{
+  guint64 diff = (guint64) timer->expires ^ (guint64) wheel->now;
+  guint level;
+  guint slot;
+
+  g_assert (timer->expires > wheel->now);
+
+  level = (63 - __builtin_clzll (diff)) / GSM_TIMER_WHEEL_BITS;
+  if (level >= GSM_TIMER_WHEEL_LEVELS)
+    {
+      timer->queue = &wheel->overflow;
+    }
+  else
+    {
+      slot = (timer->expires >> LEVEL_SHIFT (level)) & (GSM_TIMER_WHEEL_SLOTS - 1);
+      timer->queue = &wheel->slots[level][slot];
+      wheel->occupied[level] |= G_GUINT64_CONSTANT (1) << slot;
+    }
+
+  g_queue_push_tail_link (timer->queue, &timer->link);
+}
+
+/**
+ * gsm_timer_wheel_add:
+ * @wheel: a #GsmTimerWheel
+ * @timer: an unarmed #GsmTimer
+ * @expires: the tick at which the timer fires
+ *
+ * Arms the timer, expiry times that are not in the future are moved to the
+ * next tick.
+ */
+void
+gsm_timer_wheel_add (GsmTimerWheel *wheel,
+                     GsmTimer      *timer,
+                     gint64         expires)
+{
+  g_assert (timer->queue == NULL);
+
+  timer->expires = MAX (expires, wheel->now + 1);
+  _wheel_place (wheel, timer);
+  wheel->n_timers += 1;
+}
+
+void
+gsm_timer_wheel_remove (GsmTimerWheel *wheel,
+                        GsmTimer      *timer)
+{
+  if (!timer->queue)
+    return;
+
+  g_queue_unlink (timer->queue, &timer->link);
+
+  /* Expired timers that are about to be fired are not counted anymore */
+  if (_queue_is_slot (wheel, timer->queue) || timer->queue == &wheel->overflow)
+    wheel->n_timers -= 1;
+
+  /* Keep the next event accurate */
+  if (timer->queue->head == NULL && _queue_is_slot (wheel, timer->queue))
+    {
+      guint idx = timer->queue - &wheel->slots[0][0];
+
+      wheel->occupied[idx / GSM_TIMER_WHEEL_SLOTS] &= ~(G_GUINT64_CONSTANT (1) << (idx % GSM_TIMER_WHEEL_SLOTS));
+    }
+
+  timer->queue = NULL;
+}
+
+/* Finds the first occupied slot ahead of the current position (or the
+ * overflow queue), returns the tick at which it is reached. */
+static gint64
+_wheel_next_queue (GsmTimerWheel  *wheel,
+                   GQueue        **queue)
+{
+  gint64 next = G_MAXINT64;
+
+  for (guint level = 0; level < GSM_TIMER_WHEEL_LEVELS; level++)
+    {
+      guint pos = (wheel->now >> LEVEL_SHIFT (level)) & (GSM_TIMER_WHEEL_SLOTS - 1);
+      guint64 ahead;
+      guint slot;
+      gint64 tick;
+
+      if (pos == GSM_TIMER_WHEEL_SLOTS - 1)
+        continue;
+
+      ahead = wheel->occupied[level] & (G_MAXUINT64 << (pos + 1));
+      if (!ahead)
+        continue;
+
+      slot = __builtin_ctzll (ahead);
+      tick = (wheel->now >> LEVEL_SHIFT (level + 1)) << LEVEL_SHIFT (level + 1);
+      tick |= (gint64) slot << LEVEL_SHIFT (level);
+      if (tick < next)
+        {
+          next = tick;
+          *queue = &wheel->slots[level][slot];
+        }
+    }
+
+  if (wheel->overflow.head)
+    {
+      gint64 tick = ((wheel->now >> WHEEL_RANGE_SHIFT) + 1) << WHEEL_RANGE_SHIFT;
+
+      if (tick < next)
+        {
+          next = tick;
+          *queue = &wheel->overflow;
+        }
+    }
+
+  g_assert (next != G_MAXINT64);
+
+  return next;
+}
+
+/**
+ * gsm_timer_wheel_next_event:
+ * @wheel: a #GsmTimerWheel
+ *
+ * Returns: the next tick at which a timer expires or needs to be moved to
+ *   a lower level, or -1 if there are no timers.
+ */
+gint64
+gsm_timer_wheel_next_event (GsmTimerWheel *wheel)
+{
+  GQueue *queue;
+
+  if (wheel->n_timers == 0)
+    return -1;
+
+  return _wheel_next_queue (wheel, &queue);
+}
+
+/**
+ * gsm_timer_wheel_next_expiry:
+ * @wheel: a #GsmTimerWheel
+ *
+ * Unlike gsm_timer_wheel_next_event() this is exact, but needs to look at
+ * all timers of a slot.
+ *
+ * Returns: the tick at which the next timer expires, or -1 if there are no
+ *   timers.
+ */
+gint64
+gsm_timer_wheel_next_expiry (GsmTimerWheel *wheel)
+{
+  GQueue *queue;
+  gint64 expires = G_MAXINT64;
+
+  if (wheel->n_timers == 0)
+    return -1;
+
+  /* Slots do not overlap, so the first one holds the next timer */
+  _wheel_next_queue (wheel, &queue);
+  for (GList *link = queue->head; link; link = link->next)
+    expires = MIN (expires, ((GsmTimer *) link->data)->expires);
+
+  return expires;
+}
+
+static void
+_wheel_cascade (GsmTimerWheel *wheel,
+                GQueue        *queue,
+                GQueue        *expired)
+{
+  GQueue pending = G_QUEUE_INIT;
+  GList *link;
+
+  /* Steal all timers first, they may be placed into the same queue again */
+  pending = *queue;
+  g_queue_init (queue);
+
+  while ((link = g_queue_pop_head_link (&pending)))
+    {
+      GsmTimer *timer = link->data;
+
+      if (timer->expires <= wheel->now)
+        {
+          timer->queue = expired;
+          g_queue_push_tail_link (expired, link);
+          wheel->n_timers -= 1;
+        }
+      else
+        {
+          _wheel_place (wheel, timer);
+        }
+    }
+}
+
+/**
+ * gsm_timer_wheel_advance:
+ * @wheel: a #GsmTimerWheel
+ * @now: the current tick
+ *
+ * Moves the wheel forward and calls the function of all timers that expired
+ * in the order of their expiry. The functions may add and remove timers.
+ */
+void
+gsm_timer_wheel_advance (GsmTimerWheel *wheel,
+                         gint64         now)
+{
+  GQueue expired = G_QUEUE_INIT;
+  GList *link;
+
+  while (TRUE)
+    {
+      gint64 next = gsm_timer_wheel_next_event (wheel);
+      gint64 prev = wheel->now;
+
+      if (next < 0 || next > now)
+        break;
+
+      wheel->now = next;
+
+      if ((prev >> WHEEL_RANGE_SHIFT) != (next >> WHEEL_RANGE_SHIFT))
+        _wheel_cascade (wheel, &wheel->overflow, &expired);
+
+      /* From the top, so that timers can move down multiple levels */
+      for (guint level = GSM_TIMER_WHEEL_LEVELS; level > 0; level--)
+        {
+          guint pos = (next >> LEVEL_SHIFT (level - 1)) & (GSM_TIMER_WHEEL_SLOTS - 1);
+
+          if (!(wheel->occupied[level - 1] & (G_GUINT64_CONSTANT (1) << pos)))
+            continue;
+
+          wheel->occupied[level - 1] &= ~(G_GUINT64_CONSTANT (1) << pos);
+          _wheel_cascade (wheel, &wheel->slots[level - 1][pos], &expired);
+        }
+    }
+
+  wheel->now = MAX (wheel->now, now);
+
+  while ((link = g_queue_pop_head_link (&expired)))
+    {
+      GsmTimer *timer = link->data;
+
+      timer->queue = NULL;
+      timer->func (timer->user_data);
+    }
+}
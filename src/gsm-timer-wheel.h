@@ -0,0 +1,81 @@
+/* gsm-timer-wheel.h
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Private helper, a hierarchical timer wheel with a resolution of one tick.
+ * Each level has 64 slots covering 64 times the range of the level below;
+ * timers are moved down a level whenever the wheel reaches their slot. Only
+ * the slots that contain timers are visited, so advancing over a long idle
+ * period is cheap. */
+
+#define GSM_TIMER_WHEEL_BITS   6
+#define GSM_TIMER_WHEEL_SLOTS  (1 << GSM_TIMER_WHEEL_BITS)
+#define GSM_TIMER_WHEEL_LEVELS 4
+
+typedef void (*GsmTimerFunc) (gpointer user_data);
+
+/* Embedded into the owner of the timer */
+typedef struct
+{
+  GList         link;
+  GQueue       *queue;
+  gint64        expires;
+
+  GsmTimerFunc  func;
+  gpointer      user_data;
+} GsmTimer;
+
+typedef struct
+{
+  gint64  now;
+  guint   n_timers;
+
+  guint64 occupied[GSM_TIMER_WHEEL_LEVELS];
+  GQueue  slots[GSM_TIMER_WHEEL_LEVELS][GSM_TIMER_WHEEL_SLOTS];
+  /* Timers beyond the range of the highest level */
+  GQueue  overflow;
+} GsmTimerWheel;
+
+void     gsm_timer_wheel_init         (GsmTimerWheel *wheel,
+                                       gint64         now);
+void     gsm_timer_wheel_clear        (GsmTimerWheel *wheel);
+
+void     gsm_timer_init               (GsmTimer      *timer,
+                                       GsmTimerFunc   func,
+                                       gpointer       user_data);
+gboolean gsm_timer_is_armed           (GsmTimer      *timer);
+
+void     gsm_timer_wheel_add          (GsmTimerWheel *wheel,
+                                       GsmTimer      *timer,
+                                       gint64         expires);
+void     gsm_timer_wheel_remove       (GsmTimerWheel *wheel,
+                                       GsmTimer      *timer);
+
+gint64   gsm_timer_wheel_next_event   (GsmTimerWheel *wheel);
+gint64   gsm_timer_wheel_next_expiry  (GsmTimerWheel *wheel);
+void     gsm_timer_wheel_advance      (GsmTimerWheel *wheel,
+                                       gint64         now);
+
+G_END_DECLS
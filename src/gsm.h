@@ -26,6 +26,13 @@ G_BEGIN_DECLS
 # include "gsm-version.h"
 #undef GSM_INSIDE
 
+#include "gsm-clock.h"
+#include "gsm-scheduler.h"
 #include "gsm-state-machine.h"
+#include "gsm-instance.h"
+#include "gsm-batch.h"
+#include "gsm-executor.h"
+#include "gsm-snapshot.h"
+#include "gsm-enum-types.h"
 
 G_END_DECLS
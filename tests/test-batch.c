@@ -0,0 +1,198 @@
+/* test-batch.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include "gsm-state-machine.h"
+#include "gsm-instance.h"
+#include "gsm-batch.h"
+#include "test-state-machine.h"
+#include "test-enum-types.h"
+
+#define N_INSTANCES 1000
+
+/* The shared template with an additional timeout edge that depends on a
+ * condition: B -> A after 50ms if bool-in is set. */
+static GsmStateMachine*
+create_template (void)
+{
+  GsmStateMachine *sm = test_create_template ();
+
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_B, TEST_STATE_A, 50, "bool-in", NULL);
+
+  return sm;
+}
+
+static void
+test_basic (void)
+{
+  g_autoptr(GsmStateMachine) sm = create_template ();
+  g_autoptr(GsmBatch) batch = NULL;
+  g_autoptr(GArray) changed = g_array_new (FALSE, FALSE, sizeof (guint));
+  GsmStateMachineDefinition *def;
+  gint bool_in = gsm_state_machine_lookup_input (sm, "bool-in");
+  gint int_in = gsm_state_machine_lookup_input (sm, "int-in");
+  gint go = gsm_state_machine_lookup_event (sm, "go");
+
+  def = gsm_state_machine_get_definition (sm);
+  batch = gsm_batch_new (def, 100, 0);
+  g_assert (gsm_batch_get_definition (batch) == def);
+  g_assert_cmpuint (gsm_batch_get_n_instances (batch), ==, 100);
+
+  /* The batch keeps the definition alive */
+  g_clear_object (&sm);
+
+  g_assert_cmpuint (gsm_batch_step (batch, 0, changed), ==, 0);
+  g_assert_cmpuint (changed->len, ==, 0);
+  for (guint i = 0; i < 100; i++)
+    g_assert_cmpint (gsm_batch_get_state (batch, i), ==, TEST_STATE_INIT);
+
+  /* Only the instances with a changed input move */
+  gsm_batch_set_input_boolean (batch, 3, bool_in, TRUE);
+  gsm_batch_set_input_boolean (batch, 70, bool_in, TRUE);
+  g_assert_cmpuint (gsm_batch_step (batch, 1000, changed), ==, 2);
+  g_assert_cmpuint (changed->len, ==, 2);
+  g_assert_cmpuint (g_array_index (changed, guint, 0), ==, 3);
+  g_assert_cmpuint (g_array_index (changed, guint, 1), ==, 70);
+  g_assert_cmpint (gsm_batch_get_state (batch, 3), ==, TEST_STATE_A);
+  g_assert_cmpint (gsm_batch_get_state (batch, 4), ==, TEST_STATE_INIT);
+  g_assert_cmpuint (gsm_batch_step (batch, 1000, NULL), ==, 0);
+
+  g_assert_cmpint (gsm_batch_handle_event (batch, 4, go, 2000), ==, GSM_STEP_RESULT_EVENT_DROPPED);
+  g_assert_cmpint (gsm_batch_handle_event (batch, 3, go, 2000), ==, GSM_STEP_RESULT_TRANSITION);
+  g_assert_cmpint (gsm_batch_get_state (batch, 3), ==, TEST_STATE_B);
+
+  /* The timeout edge only applies once the state was active long enough */
+  g_assert_cmpuint (gsm_batch_step (batch, 51999, NULL), ==, 0);
+  g_assert_cmpuint (gsm_batch_step (batch, 52000, NULL), ==, 1);
+  g_assert_cmpint (gsm_batch_get_state (batch, 3), ==, TEST_STATE_A);
+
+  /* Invalid inputs */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not gint*");
+  gsm_batch_set_input_int (batch, 0, bool_in, 1);
+  g_test_assert_expected_messages ();
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not valid for input \"int-in\"*");
+  gsm_batch_set_input_int (batch, 0, int_in, 200);
+  g_test_assert_expected_messages ();
+  g_assert_cmpuint (gsm_batch_step (batch, 60000, NULL), ==, 0);
+}
+
+/* A batch behaves the same as separate instances */
+static void
+test_matches_instances (void)
+{
+  g_autoptr(GsmStateMachine) sm = create_template ();
+  g_autoptr(GPtrArray) instances = g_ptr_array_new_with_free_func ((GDestroyNotify) gsm_instance_free);
+  g_autoptr(GsmBatch) batch = NULL;
+  g_autoptr(GArray) changed = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_autoptr(GRand) rand = g_rand_new_with_seed (42);
+  GsmStateMachineDefinition *def;
+  gint bool_in = gsm_state_machine_lookup_input (sm, "bool-in");
+  gint int_in = gsm_state_machine_lookup_input (sm, "int-in");
+  gint go = gsm_state_machine_lookup_event (sm, "go");
+  gint64 now = 0;
+
+  def = gsm_state_machine_get_definition (sm);
+  batch = gsm_batch_new (def, N_INSTANCES, now);
+  for (guint i = 0; i < N_INSTANCES; i++)
+    g_ptr_array_add (instances, gsm_instance_new (def, NULL, NULL, now));
+
+  for (guint round = 0; round < 50; round++)
+    {
+      guint n_steps = 0;
+
+      now += 20000;
+
+      for (guint i = 0; i < N_INSTANCES; i++)
+        {
+          GsmInstance *instance = g_ptr_array_index (instances, i);
+
+          if (g_rand_int_range (rand, 0, 3) == 0)
+            {
+              gboolean b = g_rand_boolean (rand);
+
+              gsm_instance_set_input_boolean (instance, bool_in, b);
+              gsm_batch_set_input_boolean (batch, i, bool_in, b);
+            }
+
+          if (g_rand_int_range (rand, 0, 3) == 0)
+            {
+              gint n = g_rand_int_range (rand, 0, 101);
+
+              gsm_instance_set_input_int (instance, int_in, n);
+              gsm_batch_set_input_int (batch, i, int_in, n);
+            }
+        }
+
+      /* Each step changes exactly the instances that do a transition */
+      do
+        {
+          guint next = 0;
+
+          g_array_set_size (changed, 0);
+          gsm_batch_step (batch, now, changed);
+
+          for (guint i = 0; i < N_INSTANCES; i++)
+            {
+              GsmInstance *instance = g_ptr_array_index (instances, i);
+
+              if (gsm_instance_step (instance, now) == GSM_STEP_RESULT_TRANSITION)
+                {
+                  g_assert_cmpuint (next, <, changed->len);
+                  g_assert_cmpuint (g_array_index (changed, guint, next), ==, i);
+                  next += 1;
+                }
+
+              g_assert_cmpint (gsm_batch_get_state (batch, i), ==, gsm_instance_get_state (instance));
+            }
+          g_assert_cmpuint (next, ==, changed->len);
+
+          g_assert_cmpuint (++n_steps, <, 32);
+        }
+      while (changed->len > 0);
+
+      for (guint i = 0; i < N_INSTANCES; i++)
+        {
+          GsmInstance *instance = g_ptr_array_index (instances, i);
+
+          if (g_rand_boolean (rand))
+            continue;
+
+          g_assert_cmpint (gsm_batch_handle_event (batch, i, go, now), ==,
+                           gsm_instance_handle_event (instance, go, now));
+          g_assert_cmpint (gsm_batch_get_state (batch, i), ==, gsm_instance_get_state (instance));
+        }
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gsm-batch/basic",
+                   test_basic);
+
+  g_test_add_func ("/gsm-batch/matches-instances",
+                   test_matches_instances);
+
+  g_test_run ();
+}
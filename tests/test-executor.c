@@ -0,0 +1,339 @@
+/* test-executor.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include "gsm-state-machine.h"
+#include "gsm-instance.h"
+#include "gsm-executor.h"
+#include "test-state-machine.h"
+#include "test-enum-types.h"
+
+#define N_INSTANCES 2000
+#define N_THREADS 4
+
+typedef struct
+{
+  gint  busy;
+  guint n_transitions;
+} Tracker;
+
+/* A transition is always bracketed by both callbacks on the same thread;
+ * if another thread stepped the instance at the same time the flag would
+ * already be set. */
+static void
+state_exit_cb (GsmInstance *instance, gint state, gint new_state, gboolean intermediate, gpointer user_data)
+{
+  Tracker *tracker = user_data;
+
+  g_assert (g_atomic_int_compare_and_exchange (&tracker->busy, 0, 1));
+}
+
+static void
+state_enter_cb (GsmInstance *instance, gint state, gint old_state, gboolean intermediate, gpointer user_data)
+{
+  Tracker *tracker = user_data;
+
+  tracker->n_transitions += 1;
+  g_assert (g_atomic_int_compare_and_exchange (&tracker->busy, 1, 0));
+}
+
+static const GsmInstanceCallbacks callbacks = {
+  .state_exit = state_exit_cb,
+  .state_enter = state_enter_cb,
+};
+
+static void
+test_basic (void)
+{
+  g_autoptr(GsmStateMachine) sm = test_create_template ();
+  g_autoptr(GsmExecutor) executor = NULL;
+  GsmStateMachineDefinition *def;
+  GsmInstance *instance;
+  Tracker tracker = { 0, };
+  gint bool_in = gsm_state_machine_lookup_input (sm, "bool-in");
+  gint go = gsm_state_machine_lookup_event (sm, "go");
+  guint id;
+
+  def = gsm_state_machine_get_definition (sm);
+  executor = gsm_executor_new (N_THREADS, 0);
+  g_assert_cmpuint (gsm_executor_get_n_threads (executor), ==, N_THREADS);
+
+  for (guint i = 0; i < 10; i++)
+    gsm_executor_add (executor, gsm_instance_new (def, NULL, NULL, 0));
+  id = gsm_executor_add (executor, gsm_instance_new (def, &callbacks, &tracker, 0));
+  g_assert_cmpuint (id, ==, 10);
+  g_assert_cmpuint (gsm_executor_get_n_instances (executor), ==, 11);
+
+  /* New instances are settled in the first run, nothing is queued after */
+  g_assert_cmpuint (gsm_executor_run (executor, 0), ==, 11);
+  g_assert_cmpuint (gsm_executor_run (executor, 1000), ==, 0);
+
+  instance = gsm_executor_get_instance (executor, id);
+  gsm_instance_set_input_boolean (instance, bool_in, TRUE);
+  gsm_executor_queue (executor, id);
+  gsm_executor_queue (executor, id);
+  g_assert_cmpuint (gsm_executor_run (executor, 2000), ==, 1);
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_A);
+
+  gsm_instance_set_input_boolean (instance, bool_in, FALSE);
+  g_assert_cmpint (gsm_instance_handle_event (instance, go, 3000), ==, GSM_STEP_RESULT_TRANSITION);
+  gsm_executor_queue (executor, id);
+  g_assert_cmpuint (gsm_executor_run (executor, 3000), ==, 1);
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_B);
+
+  /* The executor takes care of the timeout edge */
+  g_assert_cmpuint (gsm_executor_run (executor, 102999), ==, 0);
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_B);
+  g_assert_cmpuint (gsm_executor_run (executor, 103000), ==, 1);
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_INIT);
+  g_assert_cmpuint (tracker.n_transitions, ==, 3);
+}
+
+/* Holds up the first worker that transitions an instance until a second
+ * worker transitioned one as well, which it can only do by stealing. */
+typedef struct
+{
+  GMutex   mutex;
+  GCond    cond;
+  GThread *first;
+  gboolean waited;
+  gboolean other_seen;
+} StealCheck;
+
+static void
+steal_check_enter_cb (GsmInstance *instance, gint state, gint old_state, gboolean intermediate, gpointer user_data)
+{
+  StealCheck *check = user_data;
+  gint64 end_time = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+
+  g_mutex_lock (&check->mutex);
+
+  if (!check->first)
+    check->first = g_thread_self ();
+
+  if (check->first != g_thread_self ())
+    {
+      check->other_seen = TRUE;
+      g_cond_broadcast (&check->cond);
+    }
+  else if (!check->waited)
+    {
+      check->waited = TRUE;
+      while (!check->other_seen)
+        if (!g_cond_wait_until (&check->cond, &check->mutex, end_time))
+          break;
+    }
+
+  g_mutex_unlock (&check->mutex);
+}
+
+static const GsmInstanceCallbacks steal_check_callbacks = {
+  .state_enter = steal_check_enter_cb,
+};
+
+static void
+test_stealing (void)
+{
+  g_autoptr(GsmStateMachine) sm = test_create_template ();
+  g_autoptr(GsmExecutor) executor = NULL;
+  GsmStateMachineDefinition *def;
+  StealCheck check = { 0, };
+  gint bool_in = gsm_state_machine_lookup_input (sm, "bool-in");
+  guint n_queued = 0;
+  guint64 n_stolen;
+
+  g_mutex_init (&check.mutex);
+  g_cond_init (&check.cond);
+
+  def = gsm_state_machine_get_definition (sm);
+  executor = gsm_executor_new (N_THREADS, 0);
+
+  for (guint i = 0; i < N_INSTANCES; i++)
+    gsm_executor_add (executor, gsm_instance_new (def, &steal_check_callbacks, &check, 0));
+  g_assert_cmpuint (gsm_executor_run (executor, 0), ==, N_INSTANCES);
+  n_stolen = gsm_executor_get_n_stolen (executor);
+
+  /* All the work is in the queue of the first worker */
+  for (guint i = 0; i < N_INSTANCES; i += N_THREADS)
+    {
+      gsm_instance_set_input_boolean (gsm_executor_get_instance (executor, i), bool_in, TRUE);
+      gsm_executor_queue (executor, i);
+      n_queued += 1;
+    }
+
+  g_assert_cmpuint (gsm_executor_run (executor, 1000), ==, n_queued);
+  g_assert (check.other_seen);
+  g_assert_cmpuint (gsm_executor_get_n_stolen (executor), >, n_stolen);
+
+  for (guint i = 0; i < N_INSTANCES; i++)
+    g_assert_cmpint (gsm_instance_get_state (gsm_executor_get_instance (executor, i)), ==,
+                     i % N_THREADS == 0 ? TEST_STATE_A : TEST_STATE_INIT);
+
+  g_cond_clear (&check.cond);
+  g_mutex_clear (&check.mutex);
+}
+
+/* Every shard fires the timers of its own instances */
+static void
+test_shard_timers (void)
+{
+  g_autoptr(GsmStateMachine) sm = test_create_template ();
+  g_autoptr(GsmExecutor) executor = NULL;
+  GsmStateMachineDefinition *def;
+  gint bool_in = gsm_state_machine_lookup_input (sm, "bool-in");
+  gint go = gsm_state_machine_lookup_event (sm, "go");
+
+  def = gsm_state_machine_get_definition (sm);
+  executor = gsm_executor_new (N_THREADS, 0);
+
+  for (guint i = 0; i < N_THREADS; i++)
+    gsm_executor_add (executor, gsm_instance_new (def, NULL, NULL, 0));
+  g_assert_cmpuint (gsm_executor_run (executor, 0), ==, N_THREADS);
+
+  /* Instance i (in shard i) enters B at i * 10ms */
+  for (guint i = 0; i < N_THREADS; i++)
+    {
+      GsmInstance *instance = gsm_executor_get_instance (executor, i);
+      gint64 now = i * 10000;
+
+      gsm_instance_set_input_boolean (instance, bool_in, TRUE);
+      g_assert (gsm_instance_settle (instance, now, 0));
+      gsm_instance_set_input_boolean (instance, bool_in, FALSE);
+      g_assert_cmpint (gsm_instance_handle_event (instance, go, now), ==, GSM_STEP_RESULT_TRANSITION);
+      gsm_executor_queue (executor, i);
+      g_assert_cmpuint (gsm_executor_run (executor, now), ==, 1);
+      g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_B);
+    }
+
+  /* Nothing is queued, the timers fire one shard after the other */
+  for (guint i = 0; i < N_THREADS; i++)
+    {
+      gint64 deadline = i * 10000 + 100000;
+
+      g_assert_cmpuint (gsm_executor_run (executor, deadline - 1000), ==, 0);
+      g_assert_cmpuint (gsm_executor_run (executor, deadline), ==, 1);
+
+      for (guint j = 0; j < N_THREADS; j++)
+        g_assert_cmpint (gsm_instance_get_state (gsm_executor_get_instance (executor, j)), ==,
+                         j <= i ? TEST_STATE_INIT : TEST_STATE_B);
+    }
+
+  g_assert_cmpuint (gsm_executor_run (executor, 1000000), ==, 0);
+}
+
+/* The instances end up the same as when settled on a single thread */
+static void
+test_matches_instances (void)
+{
+  g_autoptr(GsmStateMachine) sm = test_create_template ();
+  g_autoptr(GsmExecutor) executor = NULL;
+  g_autoptr(GPtrArray) reference = g_ptr_array_new_with_free_func ((GDestroyNotify) gsm_instance_free);
+  g_autoptr(GRand) rand = g_rand_new_with_seed (42);
+  g_autofree Tracker *trackers = g_new0 (Tracker, N_INSTANCES);
+  GsmStateMachineDefinition *def;
+  gint bool_in = gsm_state_machine_lookup_input (sm, "bool-in");
+  gint int_in = gsm_state_machine_lookup_input (sm, "int-in");
+  gint go = gsm_state_machine_lookup_event (sm, "go");
+  gint64 now = 0;
+
+  def = gsm_state_machine_get_definition (sm);
+  executor = gsm_executor_new (N_THREADS, now);
+
+  for (guint i = 0; i < N_INSTANCES; i++)
+    {
+      gsm_executor_add (executor, gsm_instance_new (def, &callbacks, &trackers[i], now));
+      g_ptr_array_add (reference, gsm_instance_new (def, NULL, NULL, now));
+    }
+
+  for (guint round = 0; round < 50; round++)
+    {
+      /* Only one shard has work in some rounds, so it needs to be stolen */
+      guint shard = round % 2 ? N_THREADS : g_rand_int_range (rand, 0, N_THREADS);
+
+      now += 20000;
+
+      for (guint i = 0; i < N_INSTANCES; i++)
+        {
+          GsmInstance *instance = gsm_executor_get_instance (executor, i);
+          GsmInstance *ref = g_ptr_array_index (reference, i);
+
+          if (shard != N_THREADS && i % N_THREADS != shard)
+            continue;
+
+          if (g_rand_int_range (rand, 0, 3) == 0)
+            {
+              gboolean b = g_rand_boolean (rand);
+
+              gsm_instance_set_input_boolean (instance, bool_in, b);
+              gsm_instance_set_input_boolean (ref, bool_in, b);
+            }
+
+          if (g_rand_int_range (rand, 0, 3) == 0)
+            {
+              gint n = g_rand_int_range (rand, 0, 101);
+
+              gsm_instance_set_input_int (instance, int_in, n);
+              gsm_instance_set_input_int (ref, int_in, n);
+            }
+
+          if (g_rand_int_range (rand, 0, 3) == 0)
+            {
+              gsm_instance_handle_event (instance, go, now);
+              gsm_instance_handle_event (ref, go, now);
+            }
+
+          gsm_executor_queue (executor, i);
+        }
+
+      gsm_executor_run (executor, now);
+
+      for (guint i = 0; i < N_INSTANCES; i++)
+        {
+          GsmInstance *ref = g_ptr_array_index (reference, i);
+
+          g_assert (gsm_instance_settle (ref, now, 0));
+          g_assert_cmpint (gsm_instance_get_state (gsm_executor_get_instance (executor, i)), ==,
+                           gsm_instance_get_state (ref));
+        }
+    }
+
+  g_test_message ("%" G_GUINT64_FORMAT " instances were stolen", gsm_executor_get_n_stolen (executor));
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gsm-executor/basic",
+                   test_basic);
+
+  g_test_add_func ("/gsm-executor/stealing",
+                   test_stealing);
+
+  g_test_add_func ("/gsm-executor/shard-timers",
+                   test_shard_timers);
+
+  g_test_add_func ("/gsm-executor/matches-instances",
+                   test_matches_instances);
+
+  g_test_run ();
+}
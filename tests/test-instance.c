@@ -0,0 +1,238 @@
+/* test-instance.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include "gsm-state-machine.h"
+#include "gsm-instance.h"
+#include "test-state-machine.h"
+#include "test-enum-types.h"
+
+#define N_INSTANCES 1000
+
+typedef struct
+{
+  guint n_enter;
+  guint n_exit;
+  gint  last_old;
+} Counters;
+
+static void
+state_exit_cb (GsmInstance *instance, gint state, gint new_state, gboolean intermediate, gpointer user_data)
+{
+  Counters *counters = user_data;
+
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, state);
+  counters->n_exit += 1;
+}
+
+static void
+state_enter_cb (GsmInstance *instance, gint state, gint old_state, gboolean intermediate, gpointer user_data)
+{
+  Counters *counters = user_data;
+
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, state);
+  g_assert_cmpint (counters->n_exit, ==, counters->n_enter + 1);
+  counters->n_enter += 1;
+  counters->last_old = old_state;
+}
+
+static const GsmInstanceCallbacks callbacks = {
+  .state_exit = state_exit_cb,
+  .state_enter = state_enter_cb,
+};
+
+static void
+test_basic (void)
+{
+  g_autoptr(GsmStateMachine) sm = test_create_template ();
+  g_autoptr(GsmInstance) instance = NULL;
+  g_autoptr(GsmInstance) early = NULL;
+  GsmStateMachineDefinition *def;
+  Counters counters = { 0, };
+  gint bool_in = gsm_state_machine_lookup_input (sm, "bool-in");
+  gint go = gsm_state_machine_lookup_event (sm, "go");
+
+  def = gsm_state_machine_get_definition (sm);
+  instance = gsm_instance_new (def, &callbacks, &counters, 0);
+  early = gsm_instance_new (def, NULL, NULL, -200000);
+  g_assert (gsm_instance_get_definition (instance) == def);
+  g_assert (gsm_instance_get_user_data (instance) == &counters);
+
+  /* Instances keep the definition alive */
+  g_clear_object (&sm);
+
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_INIT);
+  g_assert (gsm_instance_settle (instance, 0, 0));
+  g_assert_cmpint (counters.n_enter, ==, 0);
+
+  /* Events that do not apply are dropped */
+  g_assert_cmpint (gsm_instance_handle_event (instance, go, 0), ==, GSM_STEP_RESULT_EVENT_DROPPED);
+
+  gsm_instance_set_input_boolean (instance, bool_in, TRUE);
+  g_assert_cmpint (gsm_instance_step (instance, 1000), ==, GSM_STEP_RESULT_TRANSITION);
+  g_assert_cmpint (gsm_instance_step (instance, 1000), ==, GSM_STEP_RESULT_STABLE);
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_A);
+  g_assert_cmpint (counters.n_enter, ==, 1);
+  g_assert_cmpint (counters.last_old, ==, TEST_STATE_INIT);
+  g_assert_cmpint (gsm_instance_get_next_deadline (instance, 1000), ==, G_MAXINT64);
+
+  g_assert_cmpint (gsm_instance_handle_event (instance, go, 2000), ==, GSM_STEP_RESULT_TRANSITION);
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_B);
+  g_assert_cmpint (gsm_instance_get_next_deadline (instance, 2000), ==, 102000);
+
+  /* The timeout edge only applies once the state was active long enough */
+  gsm_instance_set_input_boolean (instance, bool_in, FALSE);
+  g_assert (gsm_instance_settle (instance, 101999, 0));
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_B);
+  g_assert (gsm_instance_settle (instance, 102000, 0));
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_INIT);
+  g_assert_cmpint (counters.n_enter, ==, 3);
+  g_assert_cmpint (counters.n_exit, ==, 3);
+
+  /* Any time can be a deadline, including 0 */
+  gsm_instance_set_input_boolean (early, bool_in, TRUE);
+  g_assert (gsm_instance_settle (early, -200000, 0));
+  g_assert_cmpint (gsm_instance_handle_event (early, go, -100000), ==, GSM_STEP_RESULT_TRANSITION);
+  g_assert_cmpint (gsm_instance_get_next_deadline (early, -100000), ==, 0);
+
+  /* Invalid inputs */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not gint*");
+  gsm_instance_set_input_int (instance, bool_in, 1);
+  g_test_assert_expected_messages ();
+}
+
+/* Values the pspec does not accept are rejected instead of aborting */
+static void
+test_invalid_values (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  g_autoptr(GsmInstance) instance = NULL;
+  gint enum_in, int_in;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  enum_in = gsm_state_machine_add_input (sm,
+                                         g_param_spec_enum ("enum-in", "EnumIn", "A test input enum",
+                                                            TEST_TYPE_STATE_MACHINE, TEST_STATE_INIT, 0));
+  int_in = gsm_state_machine_add_input (sm,
+                                        g_param_spec_int ("int-in", "IntIn", "A test input int", 0, 100, 0, 0));
+  gsm_state_machine_create_default_condition (sm, "enum-in", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_create_threshold_condition (sm, "int-in", (const GStrv) (const gchar*[]) { "50", NULL },
+                                                GSM_CONDITION_TYPE_GEQ, 0.0);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "enum-in::b", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, ">=int-in::50", NULL);
+
+  instance = gsm_instance_new (gsm_state_machine_get_definition (sm), NULL, NULL, 0);
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not valid for input \"enum-in\"*");
+  gsm_instance_set_input_enum (instance, enum_in, 42);
+  g_test_assert_expected_messages ();
+  g_assert (gsm_instance_settle (instance, 0, 0));
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_INIT);
+
+  gsm_instance_set_input_enum (instance, enum_in, TEST_STATE_B);
+  g_assert (gsm_instance_settle (instance, 0, 0));
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_A);
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not valid for input \"int-in\"*");
+  gsm_instance_set_input_int (instance, int_in, 1000);
+  g_test_assert_expected_messages ();
+  g_assert (gsm_instance_settle (instance, 0, 0));
+  g_assert_cmpint (gsm_instance_get_state (instance), ==, TEST_STATE_A);
+}
+
+/* Instances of a definition behave the same as full machines */
+static void
+test_matches_machine (void)
+{
+  g_autoptr(GsmStateMachine) sm = test_create_template ();
+  g_autoptr(GPtrArray) machines = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(GPtrArray) instances = g_ptr_array_new_with_free_func ((GDestroyNotify) gsm_instance_free);
+  g_autoptr(GRand) rand = g_rand_new_with_seed (42);
+  g_autoptr(GsmClock) clock = gsm_clock_new_virtual (0);
+  GsmStateMachineDefinition *def;
+  gint bool_in = gsm_state_machine_lookup_input (sm, "bool-in");
+  gint int_in = gsm_state_machine_lookup_input (sm, "int-in");
+  gint go = gsm_state_machine_lookup_event (sm, "go");
+
+  def = gsm_state_machine_get_definition (sm);
+
+  for (guint i = 0; i < N_INSTANCES; i++)
+    {
+      g_ptr_array_add (machines, g_object_new (GSM_TYPE_STATE_MACHINE,
+                                               "definition", def,
+                                               "clock", clock,
+                                               NULL));
+      g_ptr_array_add (instances, gsm_instance_new (def, NULL, NULL, 0));
+    }
+
+  for (guint round = 0; round < 20; round++)
+    {
+      gint64 now;
+
+      gsm_clock_advance (clock, 30000);
+      now = gsm_clock_get_time (clock);
+
+      for (guint i = 0; i < N_INSTANCES; i++)
+        {
+          GsmStateMachine *m = g_ptr_array_index (machines, i);
+          GsmInstance *instance = g_ptr_array_index (instances, i);
+          gboolean b = g_rand_int_range (rand, 0, 4) == 0;
+          gint n = g_rand_int_range (rand, 0, 101);
+
+          gsm_state_machine_set_input_boolean (m, bool_in, b);
+          gsm_state_machine_set_input_int (m, int_in, n);
+          gsm_instance_set_input_boolean (instance, bool_in, b);
+          gsm_instance_set_input_int (instance, int_in, n);
+
+          g_assert (gsm_state_machine_settle (m, 0, NULL));
+          g_assert (gsm_instance_settle (instance, now, 0));
+          g_assert_cmpint (gsm_state_machine_get_state (m), ==, gsm_instance_get_state (instance));
+
+          if (g_rand_boolean (rand))
+            {
+              gsm_state_machine_queue_event_by_id (m, go);
+              g_assert (gsm_state_machine_settle (m, 0, NULL));
+              gsm_instance_handle_event (instance, go, now);
+              g_assert (gsm_instance_settle (instance, now, 0));
+              g_assert_cmpint (gsm_state_machine_get_state (m), ==, gsm_instance_get_state (instance));
+            }
+        }
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gsm-instance/basic",
+                   test_basic);
+
+  g_test_add_func ("/gsm-instance/invalid-values",
+                   test_invalid_values);
+
+  g_test_add_func ("/gsm-instance/matches-machine",
+                   test_matches_machine);
+
+  g_test_run ();
+}
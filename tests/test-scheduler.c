@@ -0,0 +1,196 @@
+/* test-scheduler.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include "gsm-state-machine.h"
+#include "test-state-machine.h"
+#include "test-enum-types.h"
+
+#define N_MACHINES 100
+
+static GsmStateMachine*
+create_machine (GsmScheduler *scheduler)
+{
+  GsmStateMachine *sm;
+
+  sm = g_object_new (GSM_TYPE_STATE_MACHINE,
+                     "state-type", TEST_TYPE_STATE_MACHINE,
+                     "scheduler", scheduler,
+                     NULL);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_INIT, "!bool-in", NULL);
+
+  return sm;
+}
+
+static void
+test_batch (void)
+{
+  g_autoptr(GMainContext) ctx = g_main_context_new ();
+  g_autoptr(GsmScheduler) scheduler = NULL;
+  g_autoptr(GPtrArray) machines = g_ptr_array_new_with_free_func (g_object_unref);
+
+  scheduler = gsm_scheduler_new (ctx);
+  gsm_scheduler_set_time_budget (scheduler, 0);
+  g_assert (gsm_scheduler_get_main_context (scheduler) == ctx);
+
+  for (guint i = 0; i < N_MACHINES; i++)
+    {
+      GsmStateMachine *sm = create_machine (scheduler);
+
+      g_assert (gsm_state_machine_get_main_context (sm) == ctx);
+      gsm_state_machine_set_running (sm, TRUE);
+      g_ptr_array_add (machines, sm);
+    }
+
+  g_assert_cmpint (gsm_scheduler_get_n_queued (scheduler), ==, N_MACHINES);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_scheduler_get_n_queued (scheduler), ==, 0);
+
+  for (guint i = 0; i < N_MACHINES; i++)
+    gsm_state_machine_set_input (g_ptr_array_index (machines, i), "bool-in", TRUE);
+
+  /* Queueing twice has no effect */
+  gsm_state_machine_set_input (g_ptr_array_index (machines, 0), "bool-in", TRUE);
+  g_assert_cmpint (gsm_scheduler_get_n_queued (scheduler), ==, N_MACHINES);
+
+  /* One transition per machine per batch, each is queued again afterwards */
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_scheduler_get_n_queued (scheduler), ==, N_MACHINES);
+  for (guint i = 0; i < N_MACHINES; i++)
+    g_assert_cmpint (gsm_state_machine_get_state (g_ptr_array_index (machines, i)), ==, TEST_STATE_A);
+
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  for (guint i = 0; i < N_MACHINES; i++)
+    g_assert_cmpint (gsm_state_machine_get_state (g_ptr_array_index (machines, i)), ==, TEST_STATE_B);
+
+  /* Stopped and destroyed machines leave the queue */
+  for (guint i = 0; i < N_MACHINES; i++)
+    gsm_state_machine_set_input (g_ptr_array_index (machines, i), "bool-in", FALSE);
+  gsm_state_machine_set_running (g_ptr_array_index (machines, 0), FALSE);
+  g_ptr_array_remove_index (machines, 1);
+  g_assert_cmpint (gsm_scheduler_get_n_queued (scheduler), ==, N_MACHINES - 2);
+
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (g_ptr_array_index (machines, 0)), ==, TEST_STATE_B);
+  for (guint i = 1; i < machines->len; i++)
+    g_assert_cmpint (gsm_state_machine_get_state (g_ptr_array_index (machines, i)), ==, TEST_STATE_INIT);
+}
+
+static void
+slow_state_enter (GsmStateMachine *sm, gint new_state, gint old_state, gboolean intermediate)
+{
+  g_usleep (10);
+}
+
+static void
+test_time_budget (void)
+{
+  g_autoptr(GMainContext) ctx = g_main_context_new ();
+  g_autoptr(GsmScheduler) scheduler = NULL;
+  g_autoptr(GPtrArray) machines = g_ptr_array_new_with_free_func (g_object_unref);
+
+  scheduler = gsm_scheduler_new (ctx);
+  gsm_scheduler_set_time_budget (scheduler, 1);
+
+  for (guint i = 0; i < 3; i++)
+    {
+      GsmStateMachine *sm = create_machine (scheduler);
+
+      gsm_state_machine_set_running (sm, TRUE);
+      g_ptr_array_add (machines, sm);
+    }
+  while (g_main_context_iteration (ctx, FALSE)) {}
+
+  /* The first machine uses up the budget of the batch */
+  g_signal_connect (g_ptr_array_index (machines, 0), "state-enter", G_CALLBACK (slow_state_enter), NULL);
+
+  for (guint i = 0; i < machines->len; i++)
+    gsm_state_machine_set_input (g_ptr_array_index (machines, i), "bool-in", TRUE);
+
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_scheduler_get_n_queued (scheduler), ==, 3);
+  g_assert_cmpint (gsm_state_machine_get_state (g_ptr_array_index (machines, 0)), ==, TEST_STATE_A);
+  g_assert_cmpint (gsm_state_machine_get_state (g_ptr_array_index (machines, 1)), ==, TEST_STATE_INIT);
+
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  for (guint i = 0; i < machines->len; i++)
+    g_assert_cmpint (gsm_state_machine_get_state (g_ptr_array_index (machines, i)), ==, TEST_STATE_B);
+}
+
+static void
+test_timers (void)
+{
+  g_autoptr(GMainContext) ctx = g_main_context_new ();
+  g_autoptr(GsmScheduler) scheduler = NULL;
+  g_autoptr(GPtrArray) machines = g_ptr_array_new_with_free_func (g_object_unref);
+  gint64 start;
+
+  scheduler = gsm_scheduler_new (ctx);
+
+  for (guint i = 0; i < N_MACHINES; i++)
+    {
+      GsmStateMachine *sm = create_machine (scheduler);
+
+      /* Alternating timeouts, so that every second machine is still waiting */
+      gsm_state_machine_add_timeout_edge (sm, TEST_STATE_INIT, TEST_STATE_A, i % 2 ? 20 : 1000, "!bool-in", NULL);
+      gsm_state_machine_set_running (sm, TRUE);
+      g_ptr_array_add (machines, sm);
+    }
+
+  start = g_get_monotonic_time ();
+  while (gsm_state_machine_get_state (g_ptr_array_index (machines, N_MACHINES - 1)) != TEST_STATE_A)
+    g_main_context_iteration (ctx, TRUE);
+  g_assert_cmpint (g_get_monotonic_time () - start, >=, 20000);
+
+  /* Earlier timers have fired, but the batch may have been cut short */
+  while (g_main_context_iteration (ctx, FALSE)) {}
+
+  for (guint i = 0; i < N_MACHINES; i++)
+    g_assert_cmpint (gsm_state_machine_get_state (g_ptr_array_index (machines, i)), ==, (i % 2 ? TEST_STATE_A : TEST_STATE_INIT));
+
+  /* Pending timers are cancelled with their machine */
+  g_ptr_array_set_size (machines, 0);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gsm-scheduler/batch",
+                   test_batch);
+
+  g_test_add_func ("/gsm-scheduler/time-budget",
+                   test_time_budget);
+
+  g_test_add_func ("/gsm-scheduler/timers",
+                   test_timers);
+
+  g_test_run ();
+}
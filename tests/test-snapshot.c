@@ -0,0 +1,226 @@
+/* test-snapshot.c
+ *
+ * Copyright 2018 Benjamin Berg <bberg@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include "gsm-state-machine.h"
+#include "gsm-snapshot.h"
+#include "test-state-machine.h"
+#include "test-enum-types.h"
+
+#define N_ROUNDS 10000
+
+typedef struct
+{
+  GsmSnapshot *snapshot;
+  gint         level_out;
+  gint         done;
+  guint        n_reads;
+} ReaderData;
+
+/* INIT -> A once int-in reaches 50 and back on "reset". The int-out output
+ * follows int-in in A, level-out is 1.0 in INIT and 2.0 in A. */
+static GsmStateMachine*
+create_machine (void)
+{
+  GsmStateMachine *sm;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_int ("int-in", "IntIn", "A test input int", 0, 100, 0, 0));
+  gsm_state_machine_add_output (sm,
+                                g_param_spec_int ("int-out", "IntOut", "A test output int", 0, 100, 42, 0));
+  gsm_state_machine_add_output (sm,
+                                g_param_spec_double ("level-out", "LevelOut", "A test output double", 0, 10, 1, 0));
+  gsm_state_machine_add_output (sm,
+                                g_param_spec_string ("str-out", "StrOut", "A test output string", "", 0));
+  gsm_state_machine_create_threshold_condition (sm, "int-in", (const GStrv) (const gchar*[]) { "50", NULL },
+                                                GSM_CONDITION_TYPE_GEQ, 10.0);
+  gsm_state_machine_add_event (sm, "reset");
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, ">=int-in::50", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "reset", NULL);
+  gsm_state_machine_map_output (sm, TEST_STATE_A, "int-out", "int-in");
+  gsm_state_machine_set_output (sm, TEST_STATE_A, "level-out", 2.0);
+
+  return sm;
+}
+
+static void
+test_basic (void)
+{
+  g_autoptr(GsmStateMachine) sm = create_machine ();
+  g_autoptr(GsmSnapshot) snapshot = NULL;
+  gint input = gsm_state_machine_lookup_input (sm, "int-in");
+  gint int_out = gsm_state_machine_lookup_output (sm, "int-out");
+  gint level_out = gsm_state_machine_lookup_output (sm, "level-out");
+  gint str_out = gsm_state_machine_lookup_output (sm, "str-out");
+
+  /* Filled right away, nothing new afterwards */
+  snapshot = gsm_snapshot_new (sm);
+  g_assert_false (gsm_snapshot_read (snapshot));
+  g_assert_cmpint (gsm_snapshot_get_state (snapshot), ==, TEST_STATE_INIT);
+  g_assert_cmpuint (gsm_snapshot_get_n_transitions (snapshot), ==, 0);
+  g_assert_cmpuint (gsm_snapshot_get_n_outputs (snapshot), ==, 3);
+  g_assert_cmpint (g_value_get_int (gsm_snapshot_get_output_value (snapshot, int_out)), ==, 42);
+  g_assert_cmpfloat (g_value_get_double (gsm_snapshot_get_output_value (snapshot, level_out)), ==, 1.0);
+  g_assert_null (gsm_snapshot_get_output_value (snapshot, str_out));
+
+  /* The definition is sealed */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*sealed*");
+  gsm_state_machine_add_event (sm, "other");
+  g_test_assert_expected_messages ();
+
+  /* Only settled updates are published */
+  gsm_state_machine_set_input_int (sm, input, 60);
+  g_assert_false (gsm_snapshot_read (snapshot));
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_true (gsm_snapshot_read (snapshot));
+  g_assert_cmpint (gsm_snapshot_get_state (snapshot), ==, TEST_STATE_A);
+  g_assert_cmpuint (gsm_snapshot_get_n_transitions (snapshot), ==, 1);
+  g_assert_cmpint (g_value_get_int (gsm_snapshot_get_output_value (snapshot, int_out)), ==, 60);
+  g_assert_cmpfloat (g_value_get_double (gsm_snapshot_get_output_value (snapshot, level_out)), ==, 2.0);
+
+  /* Mapped outputs are published right away if no update is pending */
+  gsm_state_machine_set_input_int (sm, input, 70);
+  g_assert_true (gsm_snapshot_read (snapshot));
+  g_assert_cmpint (g_value_get_int (gsm_snapshot_get_output_value (snapshot, int_out)), ==, 70);
+  g_assert_cmpuint (gsm_snapshot_get_n_transitions (snapshot), ==, 1);
+
+  /* Settling without a change does not publish again */
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_false (gsm_snapshot_read (snapshot));
+
+  /* With a transition pending, the output change is only published
+   * together with the state the machine settles in */
+  gsm_state_machine_queue_event (sm, "reset");
+  gsm_state_machine_set_input_int (sm, input, 0);
+  g_assert_false (gsm_snapshot_read (snapshot));
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_true (gsm_snapshot_read (snapshot));
+  g_assert_cmpint (gsm_snapshot_get_state (snapshot), ==, TEST_STATE_INIT);
+  g_assert_cmpuint (gsm_snapshot_get_n_transitions (snapshot), ==, 2);
+  g_assert_cmpint (g_value_get_int (gsm_snapshot_get_output_value (snapshot, int_out)), ==, 42);
+
+  /* The budget running out on the last transition still publishes */
+  gsm_state_machine_set_input_int (sm, input, 60);
+  g_assert_true (gsm_state_machine_settle (sm, 1, NULL));
+  g_assert_true (gsm_snapshot_read (snapshot));
+  g_assert_cmpint (gsm_snapshot_get_state (snapshot), ==, TEST_STATE_A);
+  g_assert_cmpuint (gsm_snapshot_get_n_transitions (snapshot), ==, 3);
+
+  gsm_state_machine_set_input_int (sm, input, 0);
+  gsm_state_machine_queue_event (sm, "reset");
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+
+  /* The snapshot outlives the machine */
+  g_clear_object (&sm);
+  g_assert_true (gsm_snapshot_read (snapshot));
+  g_assert_false (gsm_snapshot_read (snapshot));
+  g_assert_cmpint (gsm_snapshot_get_state (snapshot), ==, TEST_STATE_INIT);
+  g_assert_cmpuint (gsm_snapshot_get_n_transitions (snapshot), ==, 4);
+  g_assert_cmpint (g_value_get_int (gsm_snapshot_get_output_value (snapshot, int_out)), ==, 42);
+}
+
+static gpointer
+reader_thread (gpointer user_data)
+{
+  ReaderData *data = user_data;
+  guint64 last_transitions = 0;
+
+  while (!g_atomic_int_get (&data->done))
+    {
+      gint state;
+      guint64 n_transitions;
+      gdouble level;
+
+      if (!gsm_snapshot_read (data->snapshot))
+        continue;
+
+      /* Every read must be one consistent settled update */
+      state = gsm_snapshot_get_state (data->snapshot);
+      n_transitions = gsm_snapshot_get_n_transitions (data->snapshot);
+      level = g_value_get_double (gsm_snapshot_get_output_value (data->snapshot, data->level_out));
+
+      g_assert_cmpuint (n_transitions, >=, last_transitions);
+      g_assert_cmpint (state, ==, n_transitions % 2 ? TEST_STATE_A : TEST_STATE_INIT);
+      g_assert_cmpfloat (level, ==, state == TEST_STATE_A ? 2.0 : 1.0);
+
+      last_transitions = n_transitions;
+      data->n_reads += 1;
+    }
+
+  return NULL;
+}
+
+static void
+test_threads (void)
+{
+  g_autoptr(GsmStateMachine) sm = create_machine ();
+  g_autoptr(GsmSnapshot) snapshot = NULL;
+  ReaderData data = { 0, };
+  GThread *thread;
+  gint input = gsm_state_machine_lookup_input (sm, "int-in");
+
+  snapshot = gsm_snapshot_new (sm);
+  data.snapshot = gsm_snapshot_new (sm);
+  data.level_out = gsm_state_machine_lookup_output (sm, "level-out");
+
+  thread = g_thread_new ("reader", reader_thread, &data);
+
+  for (guint i = 0; i < N_ROUNDS; i++)
+    {
+      gsm_state_machine_set_input_int (sm, input, 60);
+      gsm_state_machine_settle (sm, 0, NULL);
+
+      gsm_state_machine_set_input_int (sm, input, 0);
+      gsm_state_machine_queue_event (sm, "reset");
+      gsm_state_machine_settle (sm, 0, NULL);
+    }
+
+  g_atomic_int_set (&data.done, TRUE);
+  g_thread_join (thread);
+
+  /* The reader frees its snapshot after the machine */
+  g_clear_object (&sm);
+  gsm_snapshot_read (data.snapshot);
+  g_assert_cmpuint (gsm_snapshot_get_n_transitions (data.snapshot), ==, 2 * N_ROUNDS);
+  g_clear_pointer (&data.snapshot, gsm_snapshot_free);
+
+  g_assert_true (gsm_snapshot_read (snapshot));
+  g_assert_cmpint (gsm_snapshot_get_state (snapshot), ==, TEST_STATE_INIT);
+  g_assert_cmpuint (gsm_snapshot_get_n_transitions (snapshot), ==, 2 * N_ROUNDS);
+  g_test_message ("%u consistent reads", data.n_reads);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gsm-snapshot/basic",
+                   test_basic);
+
+  g_test_add_func ("/gsm-snapshot/threads",
+                   test_threads);
+
+  g_test_run ();
+}
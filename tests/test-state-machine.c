@@ -181,6 +181,54 @@ test_groups (void)
   gsm_state_machine_to_dot_file (sm, "groups.dot");
 }
 
+static void
+test_nested_groups (void)
+{
+  GMainContext *ctx = g_main_context_default ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gint group_ab, group_all;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_add_event (sm, "go-a");
+  gsm_state_machine_add_event (sm, "go-b");
+
+  group_ab = gsm_state_machine_create_group (sm, "group-ab", 2, TEST_STATE_A, TEST_STATE_B);
+  group_all = gsm_state_machine_create_group (sm, "group-all", 2, TEST_STATE_INIT, group_ab);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, group_ab, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, group_ab, TEST_STATE_INIT, "!bool-in", NULL);
+  /* Inherited by all states through two levels of groups */
+  gsm_state_machine_add_edge (sm, group_all, TEST_STATE_B, "go-b", NULL);
+
+  gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_set_input (sm, "bool-in", TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_queue_event (sm, "go-b");
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  /* Edges added while running are picked up */
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_A, "go-a", NULL);
+  gsm_state_machine_queue_event (sm, "go-a");
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input (sm, "bool-in", FALSE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_to_dot_file (sm, "nested-groups.dot");
+}
+
 static void
 test_orthogonal_transitions (void)
 {
@@ -372,7 +420,7 @@ test_events (void)
 }
 
 static void
-test_enum_conditional_eq (void)
+test_event_dispatch (void)
 {
   GMainContext *ctx = g_main_context_default ();
   g_autoptr(GsmStateMachine) sm = NULL;
@@ -380,159 +428,1495 @@ test_enum_conditional_eq (void)
   sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
 
   gsm_state_machine_add_input (sm,
-                               g_param_spec_enum ("enum-eq", "EnumEqual",
-                                                  "A test input enum",
-                                                  TEST_TYPE_STATE_MACHINE,
-                                                  TEST_STATE_INIT, 0));
-  gsm_state_machine_create_default_condition (sm, "enum-eq", GSM_CONDITION_TYPE_EQ);
-
-  gsm_state_machine_add_event (sm, "event");
-
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_INIT, TEST_STATE_A,
-                              "enum-eq::a",
-                              NULL);
-
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_A, TEST_STATE_B,
-                              "enum-eq::b",
-                              NULL);
+                               g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
 
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_B, TEST_STATE_INIT,
-                              "!enum-eq::b",
-                              NULL);
+  for (gint i = 0; i < 8; i++)
+    {
+      g_autofree gchar *event = g_strdup_printf ("event-%d", i);
 
-  /* Fails because !a can mean b */
-  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*Transition*conflicts*");
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_A, TEST_STATE_INIT,
-                              "!enum-eq::a",
-                              NULL);
-  g_test_assert_expected_messages ();
+      gsm_state_machine_add_event (sm, event);
+    }
 
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_A, TEST_STATE_INIT,
-                              "!enum-eq::a",
-                              "!enum-eq::b",
-                              NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "event-3", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_B, "event-5", "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "event-7", NULL);
+  /* Same conditions as an event edge, but without an event */
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "bool-in", NULL);
 
   gsm_state_machine_set_running (sm, TRUE);
 
+  /* Events without a matching edge are dropped */
+  gsm_state_machine_queue_event (sm, "event-5");
+  gsm_state_machine_queue_event (sm, "event-0");
   while (g_main_context_iteration (ctx, FALSE)) {}
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
 
-  gsm_state_machine_set_input (sm, "enum-eq", TEST_STATE_A);
+  gsm_state_machine_queue_event (sm, "event-3");
   while (g_main_context_iteration (ctx, FALSE)) {}
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
 
-  gsm_state_machine_set_input (sm, "enum-eq", TEST_STATE_B);
+  gsm_state_machine_queue_event (sm, "event-7");
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_set_input (sm, "bool-in", TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_queue_event (sm, "event-5");
   while (g_main_context_iteration (ctx, FALSE)) {}
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+}
 
-  gsm_state_machine_set_input (sm, "enum-eq", TEST_STATE_A);
+static void
+log_state_enter (GsmStateMachine *sm, gint new_state, gint old_state, gboolean intermediate, GString *log)
+{
+  g_string_append_printf (log, "+%d%s ", new_state, intermediate ? "i" : "");
+}
+
+static void
+log_state_exit (GsmStateMachine *sm, gint old_state, gint new_state, gboolean intermediate, GString *log)
+{
+  g_string_append_printf (log, "-%d%s ", old_state, intermediate ? "i" : "");
+}
+
+static void
+test_run_to_completion (void)
+{
+  GMainContext *ctx = g_main_context_default ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+  g_autoptr(GString) log = g_string_new (NULL);
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_INIT, "!bool-in", NULL);
+
+  g_signal_connect (sm, "state-enter", G_CALLBACK (log_state_enter), log);
+  g_signal_connect (sm, "state-exit", G_CALLBACK (log_state_exit), log);
+
+  gsm_state_machine_set_update_mode (sm, GSM_UPDATE_MODE_RUN_TO_COMPLETION);
+  gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+
+  /* The whole chain is done in a single dispatch, A is only passed through */
+  gsm_state_machine_set_input (sm, "bool-in", TRUE);
   g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+  g_assert_cmpstr (log->str, ==, "-0i +1i -1 +2 ");
+  g_assert_false (g_main_context_pending (ctx));
+
+  /* With a budget of one step, only one transition happens per dispatch */
+  gsm_state_machine_set_max_steps (sm, 1);
+  gsm_state_machine_set_input (sm, "bool-in", FALSE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  g_string_truncate (log, 0);
+  gsm_state_machine_set_input (sm, "bool-in", TRUE);
   g_main_context_iteration (ctx, FALSE);
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
-
-  gsm_state_machine_to_dot_file (sm, "enum-conditional-eq.dot");
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+  g_assert_cmpstr (log->str, ==, "-0i +1i -1 +2 ");
 }
 
 static void
-test_enum_conditional_leq (void)
+test_step_settle (void)
 {
-  GMainContext *ctx = g_main_context_default ();
   g_autoptr(GsmStateMachine) sm = NULL;
+  guint n_transitions;
 
   sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
 
   gsm_state_machine_add_input (sm,
-                               g_param_spec_enum ("enum-leq", "EnumGreaterEqual",
-                                                  "A test input enum",
-                                                  TEST_TYPE_STATE_MACHINE,
-                                                  TEST_STATE_INIT, 0));
-  gsm_state_machine_create_default_condition (sm, "enum-leq", GSM_CONDITION_TYPE_LEQ);
-
+                               g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
   gsm_state_machine_add_event (sm, "event");
+  gsm_state_machine_add_event (sm, "other");
 
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_INIT, TEST_STATE_A,
-                              ">enum-leq::init",
-                              NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_INIT, "event", NULL);
 
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_A, TEST_STATE_B,
-                              ">enum-leq::a",
-                              NULL);
+  /* Not running, nothing happens without explicit steps */
+  g_assert_cmpint (gsm_state_machine_step (sm), ==, GSM_STEP_RESULT_STABLE);
 
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_B, TEST_STATE_A,
-                              "<=enum-leq::a",
-                              NULL);
+  gsm_state_machine_set_input (sm, "bool-in", TRUE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+  g_assert_cmpint (gsm_state_machine_step (sm), ==, GSM_STEP_RESULT_TRANSITION);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+  g_assert_true (gsm_state_machine_settle (sm, 0, &n_transitions));
+  g_assert_cmpint (n_transitions, ==, 1);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
 
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_A, TEST_STATE_INIT,
-                              "<=enum-leq::init",
-                              NULL);
+  gsm_state_machine_queue_event (sm, "other");
+  g_assert_cmpint (gsm_state_machine_step (sm), ==, GSM_STEP_RESULT_EVENT_DROPPED);
+  g_assert_cmpint (gsm_state_machine_step (sm), ==, GSM_STEP_RESULT_STABLE);
 
-  /* Fails because b implies a and that is set already */
-  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*Transition*conflicts*");
-  gsm_state_machine_add_edge (sm,
-                              TEST_STATE_INIT, TEST_STATE_B,
-                              "<=enum-leq::b",
-                              NULL);
-  g_test_assert_expected_messages ();
+  /* B -> INIT -> A -> B, but the budget only allows two steps */
+  gsm_state_machine_queue_event (sm, "event");
+  g_assert_false (gsm_state_machine_settle (sm, 2, &n_transitions));
+  g_assert_cmpint (n_transitions, ==, 2);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  /* The last step reaches a stable state */
+  g_assert_true (gsm_state_machine_settle (sm, 1, &n_transitions));
+  g_assert_cmpint (n_transitions, ==, 1);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+}
+
+static void
+test_main_context (void)
+{
+  g_autoptr(GMainContext) ctx = g_main_context_new ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+
+  sm = g_object_new (GSM_TYPE_STATE_MACHINE,
+                     "state-type", TEST_TYPE_STATE_MACHINE,
+                     "main-context", ctx,
+                     "priority", G_PRIORITY_HIGH,
+                     NULL);
+  g_assert (gsm_state_machine_get_main_context (sm) == ctx);
+  g_assert_cmpint (gsm_state_machine_get_priority (sm), ==, G_PRIORITY_HIGH);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "!bool-in", NULL);
 
   gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
 
-  /* The machine should not move to begin with */
-  g_main_context_iteration (ctx, FALSE);
+  /* Nothing is dispatched from the default context */
+  gsm_state_machine_set_input (sm, "bool-in", TRUE);
+  while (g_main_context_iteration (NULL, FALSE)) {}
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
 
-  gsm_state_machine_set_input (sm, "enum-leq", TEST_STATE_B);
-  g_main_context_iteration (ctx, FALSE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
-  g_main_context_iteration (ctx, FALSE);
-  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
 
-  gsm_state_machine_set_input (sm, "enum-leq", TEST_STATE_INIT);
-  g_main_context_iteration (ctx, FALSE);
+  /* The source is reused, and inactive while the machine is stopped */
+  gsm_state_machine_set_running (sm, FALSE);
+  gsm_state_machine_set_input (sm, "bool-in", FALSE);
+  g_assert_false (g_main_context_pending (ctx));
+
+  gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+}
+
+static void
+test_event_queue (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  const gchar *burst[] = { "b", "a", "a", "b", "a", "a", "b", "a" };
+  guint n_transitions;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_event (sm, "a");
+  gsm_state_machine_add_event (sm, "b");
+  gsm_state_machine_add_event (sm, "c");
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "a", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "b", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_INIT, "a", NULL);
+
+  /* Unbounded, growing while the ring has wrapped around */
+  gsm_state_machine_queue_event (sm, "a");
+  gsm_state_machine_queue_event (sm, "b");
+  gsm_state_machine_queue_event (sm, "a");
+  gsm_state_machine_queue_event (sm, "a");
+  gsm_state_machine_queue_event (sm, "b");
+  gsm_state_machine_queue_event (sm, "a");
+  for (gint i = 0; i < 4; i++)
+    gsm_state_machine_step (sm);
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
-  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 2);
+
+  for (gint i = 0; i < G_N_ELEMENTS (burst); i++)
+    g_assert_true (gsm_state_machine_queue_event (sm, burst[i]));
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 10);
+
+  g_assert_true (gsm_state_machine_settle (sm, 100, &n_transitions));
+  g_assert_cmpint (n_transitions, ==, 8);
   g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 0);
 
-  gsm_state_machine_to_dot_file (sm, "enum-conditional-leq.dot");
+  gsm_state_machine_set_event_capacity (sm, 2);
+
+  /* The first "a" is dropped, "b" does nothing in INIT */
+  g_assert_cmpint (gsm_state_machine_get_event_overflow_policy (sm), ==, GSM_EVENT_OVERFLOW_DROP_OLDEST);
+  g_assert_true (gsm_state_machine_queue_event (sm, "a"));
+  g_assert_true (gsm_state_machine_queue_event (sm, "b"));
+  g_assert_true (gsm_state_machine_queue_event (sm, "a"));
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 2);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_event_overflow_policy (sm, GSM_EVENT_OVERFLOW_DROP_NEWEST);
+  g_assert_true (gsm_state_machine_queue_event (sm, "b"));
+  g_assert_true (gsm_state_machine_queue_event (sm, "a"));
+  g_assert_true (gsm_state_machine_queue_event (sm, "b"));
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 2);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_set_event_overflow_policy (sm, GSM_EVENT_OVERFLOW_REJECT);
+  g_assert_true (gsm_state_machine_queue_event (sm, "a"));
+  g_assert_true (gsm_state_machine_queue_event (sm, "b"));
+  g_assert_false (gsm_state_machine_queue_event (sm, "a"));
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  gsm_state_machine_set_event_overflow_policy (sm, GSM_EVENT_OVERFLOW_COALESCE);
+  g_assert_true (gsm_state_machine_queue_event (sm, "a"));
+  g_assert_true (gsm_state_machine_queue_event (sm, "a"));
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 1);
+  g_assert_true (gsm_state_machine_queue_event (sm, "b"));
+  g_assert_true (gsm_state_machine_queue_event (sm, "b"));
+  g_assert_false (gsm_state_machine_queue_event (sm, "c"));
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 2);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
 }
 
-int
-main (int argc, char **argv)
+static void
+test_handles (void)
 {
-  g_test_init (&argc, &argv, NULL);
+  g_autoptr(GsmStateMachine) sm = NULL;
+  g_auto(GValue) value = G_VALUE_INIT;
+  gint bool_in, float_in, float_out, go;
 
-  g_test_add_func ("/gsm-state-machine/init",
-                   test_init);
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
 
-  g_test_add_func ("/gsm-state-machine/simple-machine",
-                   test_simple_machine);
+  bool_in = gsm_state_machine_add_input (sm,
+                                         g_param_spec_boolean ("bool", "Bool", "A test input boolean", FALSE, 0));
+  float_in = gsm_state_machine_add_input (sm,
+                                          g_param_spec_float ("float", "Float", "A float input", 0, 100, 0, 0));
+  float_out = gsm_state_machine_add_output (sm,
+                                            g_param_spec_float ("float", "Float", "A float output", 0, 100, 0, 0));
+  gsm_state_machine_create_default_condition (sm, "bool", GSM_CONDITION_TYPE_EQ);
+  go = gsm_state_machine_add_event (sm, "go");
 
-  g_test_add_func ("/gsm-state-machine/groups",
-                   test_groups);
+  g_assert_cmpint (gsm_state_machine_lookup_input (sm, "bool"), ==, bool_in);
+  g_assert_cmpint (gsm_state_machine_lookup_input (sm, "float"), ==, float_in);
+  g_assert_cmpint (gsm_state_machine_lookup_output (sm, "float"), ==, float_out);
+  g_assert_cmpint (gsm_state_machine_lookup_event (sm, "go"), ==, go);
+  g_assert_cmpint (gsm_state_machine_lookup_input (sm, "unknown"), ==, -1);
+  g_assert_cmpint (gsm_state_machine_lookup_event (sm, "bool"), ==, -1);
 
-  g_test_add_func ("/gsm-state-machine/orthogonal-transitions",
-                   test_orthogonal_transitions);
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*already exists*");
+  g_assert_cmpint (gsm_state_machine_add_event (sm, "go"), ==, -1);
+  g_test_assert_expected_messages ();
 
-  g_test_add_func ("/gsm-state-machine/output",
-                   test_output);
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "bool", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "go", NULL);
+  gsm_state_machine_map_output (sm, TEST_STATE_B, "float", "float");
 
-  g_test_add_func ("/gsm-state-machine/events",
-                   test_events);
+  gsm_state_machine_set_input_by_id (sm, float_in, (gfloat) 42);
+  gsm_state_machine_get_input_value_by_id (sm, float_in, &value);
+  g_assert_cmpfloat (g_value_get_float (&value), ==, 42);
 
-  g_test_add_func ("/gsm-state-machine/enum-conditional-eq",
-                   test_enum_conditional_eq);
+  gsm_state_machine_set_input_by_id (sm, bool_in, TRUE);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
 
-  g_test_add_func ("/gsm-state-machine/enum-conditional-leq",
-                   test_enum_conditional_leq);
+  g_assert_true (gsm_state_machine_queue_event_by_id (sm, go));
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  g_value_unset (&value);
+  gsm_state_machine_get_output_value_by_id (sm, float_out, &value);
+  g_assert_cmpfloat (g_value_get_float (&value), ==, 42);
+
+  g_value_set_float (&value, 7);
+  gsm_state_machine_set_input_value_by_id (sm, float_in, &value);
+  g_value_unset (&value);
+  gsm_state_machine_get_output_value (sm, "float", &value);
+  g_assert_cmpfloat (g_value_get_float (&value), ==, 7);
+}
+
+static void
+test_input_sensitivity (void)
+{
+  g_autoptr(GMainContext) ctx = g_main_context_new ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+
+  sm = g_object_new (GSM_TYPE_STATE_MACHINE,
+                     "state-type", TEST_TYPE_STATE_MACHINE,
+                     "main-context", ctx,
+                     NULL);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-a", "BoolA", "A test input boolean", FALSE, 0));
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-b", "BoolB", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-a", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_create_default_condition (sm, "bool-b", GSM_CONDITION_TYPE_EQ);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "bool-a", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "bool-b", NULL);
+
+  gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+
+  /* INIT does not care about bool-b, the change is only picked up later */
+  gsm_state_machine_set_input (sm, "bool-b", TRUE);
+  g_assert_false (g_main_context_pending (ctx));
+
+  gsm_state_machine_set_input (sm, "bool-a", TRUE);
+  g_assert_true (g_main_context_pending (ctx));
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  /* B has no transitions at all */
+  gsm_state_machine_set_input (sm, "bool-a", FALSE);
+  gsm_state_machine_set_input (sm, "bool-b", FALSE);
+  g_assert_false (g_main_context_pending (ctx));
+
+  /* New edges are taken into account */
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_INIT, "!bool-b", NULL);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+}
+
+static void
+test_input_suppression (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gint counter_input_changed = 0;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool", "Bool", "A test input boolean", FALSE, 0));
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_double ("double", "Double", "A double input", 0, 100, 0, 0));
+
+  g_object_connect (sm,
+                    "swapped-signal::input-changed", count_signal, &counter_input_changed,
+                    NULL);
+
+  /* Identical values are dropped */
+  gsm_state_machine_set_input (sm, "bool", FALSE);
+  gsm_state_machine_set_input (sm, "bool", TRUE);
+  gsm_state_machine_set_input (sm, "bool", TRUE);
+  g_assert_cmpint (counter_input_changed, ==, 1);
+  g_assert_cmpuint (gsm_state_machine_get_n_suppressed_inputs (sm, "bool"), ==, 2);
+
+  gsm_state_machine_set_input (sm, "double", 10.0);
+  gsm_state_machine_set_input (sm, "double", 10.0);
+  g_assert_cmpint (counter_input_changed, ==, 2);
+
+  /* Changes within the tolerance of the last accepted value are dropped */
+  gsm_state_machine_set_input_tolerance (sm, "double", 0.5);
+  g_assert_cmpfloat (gsm_state_machine_get_input_tolerance (sm, "double"), ==, 0.5);
+  gsm_state_machine_set_input (sm, "double", 10.3);
+  gsm_state_machine_set_input (sm, "double", 9.6);
+  g_assert_cmpint (counter_input_changed, ==, 2);
+  gsm_state_machine_set_input (sm, "double", 10.6);
+  g_assert_cmpint (counter_input_changed, ==, 3);
+
+  g_assert_cmpuint (gsm_state_machine_get_n_suppressed_inputs (sm, "double"), ==, 3);
+  g_assert_cmpuint (gsm_state_machine_get_n_suppressed_inputs (sm, NULL), ==, 5);
+
+  /* Only numeric inputs have a tolerance */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*numeric*");
+  gsm_state_machine_set_input_tolerance (sm, "bool", 1.0);
+  g_test_assert_expected_messages ();
+}
+
+static void
+test_batched_update (void)
+{
+  g_autoptr(GMainContext) ctx = g_main_context_new ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gint counter_input_changed = 0;
+  gint counter_output_changed = 0;
+
+  sm = g_object_new (GSM_TYPE_STATE_MACHINE,
+                     "state-type", TEST_TYPE_STATE_MACHINE,
+                     "main-context", ctx,
+                     NULL);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-a", "BoolA", "A test input boolean", FALSE, 0));
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-b", "BoolB", "A test input boolean", FALSE, 0));
+  gsm_state_machine_add_output (sm,
+                                g_param_spec_boolean ("bool-a", "BoolA", "A test output boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-a", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_create_default_condition (sm, "bool-b", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_add_event (sm, "go");
+  gsm_state_machine_map_output (sm, TEST_STATE_A, "bool-a", "bool-a");
+
+  /* INIT is only reachable with a half updated input set */
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "go", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "bool-a", "!bool-b", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "bool-a", "bool-b", NULL);
+
+  gsm_state_machine_set_running (sm, TRUE);
+  gsm_state_machine_queue_event (sm, "go");
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  g_object_connect (sm,
+                    "swapped-signal::input-changed", count_signal, &counter_input_changed,
+                    "swapped-signal::output-changed", count_signal, &counter_output_changed,
+                    NULL);
+
+  gsm_state_machine_begin_update (sm);
+  gsm_state_machine_set_input (sm, "bool-a", TRUE);
+  gsm_state_machine_set_input (sm, "bool-a", FALSE);
+  gsm_state_machine_set_input (sm, "bool-a", TRUE);
+
+  /* Nested batches and the main loop running in between do nothing */
+  gsm_state_machine_begin_update (sm);
+  gsm_state_machine_set_input (sm, "bool-b", TRUE);
+  gsm_state_machine_commit_update (sm);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (counter_input_changed, ==, 0);
+  g_assert_cmpint (counter_output_changed, ==, 0);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_commit_update (sm);
+  g_assert_cmpint (counter_input_changed, ==, 2);
+  g_assert_cmpint (counter_output_changed, ==, 1);
+
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+}
+
+static void
+test_typed_inputs (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gint counter_input_changed = 0;
+  gint bool_in, int_in, uint_in, int64_in, double_in, enum_in;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  bool_in = gsm_state_machine_add_input (sm,
+                                         g_param_spec_boolean ("bool", "Bool", "A test input boolean", FALSE, 0));
+  int_in = gsm_state_machine_add_input (sm,
+                                        g_param_spec_int ("int", "Int", "An int input", -100, 100, 0, 0));
+  uint_in = gsm_state_machine_add_input (sm,
+                                         g_param_spec_uint ("uint", "UInt", "An uint input", 0, 100, 0, 0));
+  int64_in = gsm_state_machine_add_input (sm,
+                                          g_param_spec_int64 ("int64", "Int64", "An int64 input", 0, G_MAXINT64, 0, 0));
+  double_in = gsm_state_machine_add_input (sm,
+                                           g_param_spec_double ("double", "Double", "A double input", 0, 100, 0, 0));
+  enum_in = gsm_state_machine_add_input (sm,
+                                         g_param_spec_enum ("enum", "Enum", "A test input enum",
+                                                            TEST_TYPE_STATE_MACHINE, TEST_STATE_INIT, 0));
+  gsm_state_machine_create_default_condition (sm, "bool", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_create_default_condition (sm, "enum", GSM_CONDITION_TYPE_EQ);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "bool", "enum::b", NULL);
+
+  g_object_connect (sm,
+                    "swapped-signal::input-changed", count_signal, &counter_input_changed,
+                    NULL);
+
+  gsm_state_machine_set_input_boolean (sm, bool_in, TRUE);
+  gsm_state_machine_set_input_int (sm, int_in, -5);
+  gsm_state_machine_set_input_uint (sm, uint_in, 5);
+  gsm_state_machine_set_input_int64 (sm, int64_in, G_MAXINT64);
+  gsm_state_machine_set_input_double (sm, double_in, 0.5);
+  gsm_state_machine_set_input_enum (sm, enum_in, TEST_STATE_B);
+  g_assert_cmpint (counter_input_changed, ==, 6);
+
+  g_assert_true (gsm_state_machine_get_input_boolean (sm, bool_in));
+  g_assert_cmpint (gsm_state_machine_get_input_int (sm, int_in), ==, -5);
+  g_assert_cmpuint (gsm_state_machine_get_input_uint (sm, uint_in), ==, 5);
+  g_assert_cmpint (gsm_state_machine_get_input_int64 (sm, int64_in), ==, G_MAXINT64);
+  g_assert_cmpfloat (gsm_state_machine_get_input_double (sm, double_in), ==, 0.5);
+  g_assert_cmpint (gsm_state_machine_get_input_enum (sm, enum_in), ==, TEST_STATE_B);
+
+  /* Same change detection as for GValue based updates */
+  gsm_state_machine_set_input_boolean (sm, bool_in, TRUE);
+  gsm_state_machine_set_input_tolerance (sm, "double", 0.1);
+  gsm_state_machine_set_input_double (sm, double_in, 0.55);
+  g_assert_cmpfloat (gsm_state_machine_get_input_double (sm, double_in), ==, 0.5);
+  g_assert_cmpuint (gsm_state_machine_get_n_suppressed_inputs (sm, NULL), ==, 2);
+  g_assert_cmpint (counter_input_changed, ==, 6);
+
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*Input bool is of type gboolean, not gdouble*");
+  gsm_state_machine_set_input_double (sm, bool_in, 1.0);
+  g_test_assert_expected_messages ();
+}
+
+static void
+test_typed_inputs_invalid (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  GParamSpec *double_pspec;
+  gint counter_input_changed = 0;
+  gint int_in, double_in, enum_in;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  int_in = gsm_state_machine_add_input (sm,
+                                        g_param_spec_int ("int", "Int", "An int input", -100, 100, 0, 0));
+  double_pspec = g_param_spec_double ("double", "Double", "A double input", 0, 100, 0, 0);
+  G_PARAM_SPEC_DOUBLE (double_pspec)->epsilon = 0.01;
+  double_in = gsm_state_machine_add_input (sm, double_pspec);
+  enum_in = gsm_state_machine_add_input (sm,
+                                         g_param_spec_enum ("enum", "Enum", "A test input enum",
+                                                            TEST_TYPE_STATE_MACHINE, TEST_STATE_INIT, 0));
+  gsm_state_machine_create_default_condition (sm, "enum", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "enum::b", NULL);
+
+  g_object_connect (sm,
+                    "swapped-signal::input-changed", count_signal, &counter_input_changed,
+                    NULL);
+
+  /* Values the pspec does not accept are rejected without any change */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not valid for input \"enum\"*");
+  gsm_state_machine_set_input_enum (sm, enum_in, 42);
+  g_test_assert_expected_messages ();
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not valid for input \"int\"*");
+  gsm_state_machine_set_input_int (sm, int_in, 1000);
+  g_test_assert_expected_messages ();
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not valid for input \"double\"*");
+  gsm_state_machine_set_input (sm, "double", -1.0);
+  g_test_assert_expected_messages ();
+
+  g_assert_cmpint (gsm_state_machine_get_input_enum (sm, enum_in), ==, TEST_STATE_INIT);
+  g_assert_cmpint (gsm_state_machine_get_input_int (sm, int_in), ==, 0);
+  g_assert_cmpfloat (gsm_state_machine_get_input_double (sm, double_in), ==, 0.0);
+  g_assert_cmpint (counter_input_changed, ==, 0);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  /* Both paths compare using the epsilon of the pspec */
+  gsm_state_machine_set_input_double (sm, double_in, 0.005);
+  gsm_state_machine_set_input (sm, "double", 0.005);
+  g_assert_cmpuint (gsm_state_machine_get_n_suppressed_inputs (sm, NULL), ==, 2);
+  gsm_state_machine_set_input_double (sm, double_in, 0.5);
+  g_assert_cmpint (counter_input_changed, ==, 1);
+}
+
+static void
+test_peek_values (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  const GValue *value;
+  gint str_in, str_out;
+  guint64 generation;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  str_in = gsm_state_machine_add_input (sm,
+                                        g_param_spec_string ("str", "Str", "A string input", "in", 0));
+  str_out = gsm_state_machine_add_output (sm,
+                                          g_param_spec_string ("str", "Str", "A string output", "out", 0));
+  gsm_state_machine_add_event (sm, "go");
+  gsm_state_machine_map_output (sm, TEST_STATE_A, "str", "str");
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "go", NULL);
+
+  value = gsm_state_machine_peek_output_value (sm, str_out);
+  g_assert_cmpstr (g_value_get_string (value), ==, "out");
+  g_assert_cmpstr (g_value_get_string (gsm_state_machine_peek_input_value (sm, str_in)), ==, "in");
+
+  /* Unrelated changes do not touch the generation */
+  generation = gsm_state_machine_get_generation (sm);
+  gsm_state_machine_settle (sm, 0, NULL);
+  gsm_state_machine_set_input (sm, "str", "in");
+  g_assert_cmpuint (gsm_state_machine_get_generation (sm), ==, generation);
+
+  gsm_state_machine_queue_event (sm, "go");
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpuint (gsm_state_machine_get_generation (sm), >, generation);
+  g_assert_cmpstr (g_value_get_string (gsm_state_machine_peek_output_value (sm, str_out)), ==, "in");
+
+  generation = gsm_state_machine_get_generation (sm);
+  gsm_state_machine_set_input (sm, "str", "changed");
+  g_assert_cmpuint (gsm_state_machine_get_generation (sm), >, generation);
+  g_assert_cmpstr (g_value_get_string (gsm_state_machine_peek_output_value (sm, str_out)), ==, "changed");
+}
+
+static void
+test_threshold_conditions (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gchar *thresholds[] = { "60.0", "80.0", NULL };
+  gchar *unsorted[] = { "80", "60", NULL };
+  gchar *levels[] = { "10", "20", NULL };
+  gint temp, level;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  temp = gsm_state_machine_add_input (sm,
+                                      g_param_spec_double ("temp", "Temp", "A double input", -100, 200, 20, 0));
+  level = gsm_state_machine_add_input (sm,
+                                       g_param_spec_int ("level", "Level", "An int input", 0, 100, 0, 0));
+  gsm_state_machine_create_threshold_condition (sm, "temp", thresholds, GSM_CONDITION_TYPE_GEQ, 5.0);
+  gsm_state_machine_create_threshold_condition (sm, "level", levels, GSM_CONDITION_TYPE_LEQ, 0.0);
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*ascending*");
+  gsm_state_machine_create_threshold_condition (sm, "level", unsorted, GSM_CONDITION_TYPE_LEQ, 0.0);
+  g_test_assert_expected_messages ();
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, ">=temp::60.0", "<temp::80.0", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, ">=temp::80.0", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "<temp::60.0", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_INIT, "<temp::60.0", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_A, ">=temp::60.0", "<=level::10", NULL);
+
+  gsm_state_machine_set_input_int (sm, level, 15);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_set_input_double (sm, temp, 70);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input_double (sm, temp, 80);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  /* Within the hysteresis of the 60 threshold */
+  gsm_state_machine_set_input_double (sm, temp, 58);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  gsm_state_machine_set_input_double (sm, temp, 54);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  /* Going up is immediate, going down is delayed again */
+  gsm_state_machine_set_input_double (sm, temp, 62);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input_double (sm, temp, 57);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input_double (sm, temp, 90);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  /* LEQ includes the threshold itself */
+  gsm_state_machine_set_input_double (sm, temp, 70);
+  gsm_state_machine_set_input_int (sm, level, 11);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  gsm_state_machine_set_input_int (sm, level, 10);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+}
+
+static void
+test_timeout_edges (void)
+{
+  GMainContext *ctx = g_main_context_default ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gint64 start;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_add_event (sm, "reset");
+
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_INIT, TEST_STATE_A, 40, NULL);
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_INIT, TEST_STATE_B, 20, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "reset", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_INIT, "reset", NULL);
+
+  /* Events cannot be used on timeout edges, the edge is rejected */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*cannot have an event*");
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_A, TEST_STATE_B, 20, "reset", NULL);
+  g_test_assert_expected_messages ();
+
+  /* Equal timeouts with overlapping conditions conflict */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*Transition*conflicts*");
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_INIT, TEST_STATE_B, 40, "bool-in", NULL);
+  g_test_assert_expected_messages ();
+
+  start = g_get_monotonic_time ();
+  gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  while (gsm_state_machine_get_state (sm) == TEST_STATE_INIT)
+    g_main_context_iteration (ctx, TRUE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+  g_assert_cmpint (g_get_monotonic_time () - start, >=, 40000);
+
+  /* The rejected edge was not added as an unconditional one */
+  g_usleep (30000);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  /* Timed edges only fire when no other applies, within the state the
+   * timer restarts and the shortest timeout wins. */
+  start = g_get_monotonic_time ();
+  gsm_state_machine_queue_event (sm, "reset");
+  gsm_state_machine_set_input (sm, "bool-in", TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  while (gsm_state_machine_get_state (sm) == TEST_STATE_INIT)
+    g_main_context_iteration (ctx, TRUE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+  g_assert_cmpint (g_get_monotonic_time () - start, >=, 20000);
+}
+
+static GsmStateMachine*
+create_cycling_machine (GsmClock *clock)
+{
+  GsmStateMachine *sm;
+
+  sm = g_object_new (GSM_TYPE_STATE_MACHINE,
+                     "state-type", TEST_TYPE_STATE_MACHINE,
+                     "clock", clock,
+                     NULL);
+
+  /* A cycle of one second */
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_INIT, TEST_STATE_A, 100, NULL);
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_A, TEST_STATE_B, 50, NULL);
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_B, TEST_STATE_INIT, 850, NULL);
+
+  gsm_state_machine_set_running (sm, TRUE);
+  gsm_state_machine_settle (sm, 0, NULL);
+
+  return sm;
+}
+
+static void
+test_virtual_clock (void)
+{
+  g_autoptr(GsmClock) clock = gsm_clock_new_virtual (0);
+  g_autoptr(GsmClock) clock_steps = gsm_clock_new_virtual (0);
+  g_autoptr(GsmStateMachine) sm = NULL;
+  g_autoptr(GsmStateMachine) sm_steps = NULL;
+  gint counter_enter_a = 0;
+  gint counter_enter_a_steps = 0;
+  GRand *rand = g_rand_new_with_seed (42);
+
+  sm = create_cycling_machine (clock);
+  sm_steps = create_cycling_machine (clock_steps);
+  g_assert (gsm_state_machine_get_clock (sm) == clock);
+
+  g_signal_connect_swapped (sm, "state-enter::a", G_CALLBACK (count_signal), &counter_enter_a);
+  g_signal_connect_swapped (sm_steps, "state-enter::a", G_CALLBACK (count_signal), &counter_enter_a_steps);
+
+  g_assert_cmpint (gsm_clock_get_next_deadline (clock), ==, 100000);
+  gsm_clock_advance (clock, 99999);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+  gsm_clock_advance (clock, 1);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+  g_assert_cmpint (gsm_clock_get_next_deadline (clock), ==, 150000);
+
+  /* A day passes without a main loop, the result does not depend on the steps */
+  gsm_clock_advance_to (clock, G_GINT64_CONSTANT (86400000000) + 120000);
+  while (gsm_clock_get_time (clock_steps) < gsm_clock_get_time (clock))
+    {
+      gint64 step = g_rand_int_range (rand, 0, 5000000);
+
+      gsm_clock_advance_to (clock_steps, MIN (gsm_clock_get_time (clock_steps) + step,
+                                              gsm_clock_get_time (clock)));
+    }
+
+  g_assert_cmpint (counter_enter_a, ==, 86401);
+  g_assert_cmpint (counter_enter_a_steps, ==, 86401);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+  g_assert_cmpint (gsm_state_machine_get_state (sm_steps), ==, TEST_STATE_A);
+
+  g_rand_free (rand);
+}
+
+static void
+test_shared_definition (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  g_autoptr(GPtrArray) machines = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(GsmStateMachineDefinition) def = NULL;
+  gint input;
+  gint output;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  input = gsm_state_machine_add_input (sm,
+                                       g_param_spec_int ("int-in", "IntIn", "A test input int", 0, 100, 0, 0));
+  output = gsm_state_machine_add_output (sm,
+                                         g_param_spec_int ("int-out", "IntOut", "A test output int", 0, 100, 42, 0));
+  gsm_state_machine_create_threshold_condition (sm, "int-in", (const GStrv) (const gchar*[]) { "50", NULL },
+                                                GSM_CONDITION_TYPE_GEQ, 10.0);
+  gsm_state_machine_add_event (sm, "reset");
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, ">=int-in::50", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "reset", NULL);
+  gsm_state_machine_map_output (sm, TEST_STATE_A, "int-out", "int-in");
+
+  def = gsm_state_machine_definition_ref (gsm_state_machine_get_definition (sm));
+  g_assert (gsm_state_machine_definition_get_state_type (def) == TEST_TYPE_STATE_MACHINE);
+
+  /* The definition cannot be changed anymore */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*sealed*");
+  gsm_state_machine_add_event (sm, "other");
+  g_test_assert_expected_messages ();
+
+  for (guint i = 0; i < 100; i++)
+    g_ptr_array_add (machines, gsm_state_machine_new_from_definition (def));
+
+  /* The definition is kept alive by the machines */
+  g_clear_object (&sm);
+  g_clear_pointer (&def, gsm_state_machine_definition_unref);
+
+  for (guint i = 0; i < machines->len; i++)
+    {
+      GsmStateMachine *m = g_ptr_array_index (machines, i);
+
+      gsm_state_machine_set_input_int (m, input, i);
+      gsm_state_machine_settle (m, 0, NULL);
+    }
+
+  /* Every machine has its own state, inputs, outputs and hysteresis */
+  for (guint i = 0; i < machines->len; i++)
+    {
+      GsmStateMachine *m = g_ptr_array_index (machines, i);
+
+      g_assert_cmpint (gsm_state_machine_get_state (m), ==, i >= 50 ? TEST_STATE_A : TEST_STATE_INIT);
+      g_assert_cmpint (g_value_get_int (gsm_state_machine_peek_output_value (m, output)), ==, i >= 50 ? i : 42);
+
+      gsm_state_machine_set_input_int (m, input, i - i / 10);
+      gsm_state_machine_queue_event (m, "reset");
+      gsm_state_machine_settle (m, 0, NULL);
+    }
+
+  for (guint i = 0; i < machines->len; i++)
+    {
+      GsmStateMachine *m = g_ptr_array_index (machines, i);
+      gboolean above = i >= 50 && i - i / 10 + 10 >= 50;
+
+      g_assert_cmpint (gsm_state_machine_get_state (m), ==, above ? TEST_STATE_A : TEST_STATE_INIT);
+    }
+}
+
+static void
+test_enum_conditional_eq (void)
+{
+  GMainContext *ctx = g_main_context_default ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_enum ("enum-eq", "EnumEqual",
+                                                  "A test input enum",
+                                                  TEST_TYPE_STATE_MACHINE,
+                                                  TEST_STATE_INIT, 0));
+  gsm_state_machine_create_default_condition (sm, "enum-eq", GSM_CONDITION_TYPE_EQ);
+
+  gsm_state_machine_add_event (sm, "event");
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_INIT, TEST_STATE_A,
+                              "enum-eq::a",
+                              NULL);
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_A, TEST_STATE_B,
+                              "enum-eq::b",
+                              NULL);
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_B, TEST_STATE_INIT,
+                              "!enum-eq::b",
+                              NULL);
+
+  /* Fails because !a can mean b */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*Transition*conflicts*");
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_A, TEST_STATE_INIT,
+                              "!enum-eq::a",
+                              NULL);
+  g_test_assert_expected_messages ();
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_A, TEST_STATE_INIT,
+                              "!enum-eq::a",
+                              "!enum-eq::b",
+                              NULL);
+
+  gsm_state_machine_set_running (sm, TRUE);
+
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_set_input (sm, "enum-eq", TEST_STATE_A);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input (sm, "enum-eq", TEST_STATE_B);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  gsm_state_machine_set_input (sm, "enum-eq", TEST_STATE_A);
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_to_dot_file (sm, "enum-conditional-eq.dot");
+}
+
+static void
+test_enum_conditional_leq (void)
+{
+  GMainContext *ctx = g_main_context_default ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_enum ("enum-leq", "EnumGreaterEqual",
+                                                  "A test input enum",
+                                                  TEST_TYPE_STATE_MACHINE,
+                                                  TEST_STATE_INIT, 0));
+  gsm_state_machine_create_default_condition (sm, "enum-leq", GSM_CONDITION_TYPE_LEQ);
+
+  gsm_state_machine_add_event (sm, "event");
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_INIT, TEST_STATE_A,
+                              ">enum-leq::init",
+                              NULL);
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_A, TEST_STATE_B,
+                              ">enum-leq::a",
+                              NULL);
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_B, TEST_STATE_A,
+                              "<=enum-leq::a",
+                              NULL);
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_A, TEST_STATE_INIT,
+                              "<=enum-leq::init",
+                              NULL);
+
+  /* Fails because b implies a and that is set already */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*Transition*conflicts*");
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_INIT, TEST_STATE_B,
+                              "<=enum-leq::b",
+                              NULL);
+  g_test_assert_expected_messages ();
+
+  gsm_state_machine_set_running (sm, TRUE);
+
+  /* The machine should not move to begin with */
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_set_input (sm, "enum-leq", TEST_STATE_B);
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  gsm_state_machine_set_input (sm, "enum-leq", TEST_STATE_INIT);
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+  g_main_context_iteration (ctx, FALSE);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_to_dot_file (sm, "enum-conditional-leq.dot");
+}
+
+static void
+test_enum_conditional_geq (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gint input;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  input = gsm_state_machine_add_input (sm,
+                                       g_param_spec_enum ("enum-geq", "EnumGreaterEqual",
+                                                          "A test input enum",
+                                                          TEST_TYPE_STATE_MACHINE,
+                                                          TEST_STATE_INIT, 0));
+  gsm_state_machine_create_default_condition (sm, "enum-geq", GSM_CONDITION_TYPE_GEQ);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, ">=enum-geq::a", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, ">=enum-geq::b", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_A, "<enum-geq::b", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "<enum-geq::a", NULL);
+
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  /* b implies a, so both edges are taken */
+  gsm_state_machine_set_input_enum (sm, input, TEST_STATE_B);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  gsm_state_machine_set_input_enum (sm, input, TEST_STATE_A);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input_enum (sm, input, TEST_STATE_INIT);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+}
+
+static void
+test_enum_conditional_sparse (void)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gint geq, eq;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  geq = gsm_state_machine_add_input (sm,
+                                     g_param_spec_enum ("sparse-geq", "SparseGreaterEqual",
+                                                        "A test input enum with gaps",
+                                                        TEST_TYPE_SPARSE,
+                                                        TEST_SPARSE_LOW, 0));
+  eq = gsm_state_machine_add_input (sm,
+                                    g_param_spec_enum ("sparse-eq", "SparseEqual",
+                                                       "A test input enum with gaps",
+                                                       TEST_TYPE_SPARSE,
+                                                       TEST_SPARSE_LOW, 0));
+  gsm_state_machine_create_default_condition (sm, "sparse-geq", GSM_CONDITION_TYPE_GEQ);
+  gsm_state_machine_create_default_condition (sm, "sparse-eq", GSM_CONDITION_TYPE_EQ);
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, ">=sparse-geq::mid", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, ">=sparse-geq::high", "sparse-eq::mid", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_B, TEST_STATE_INIT, "<sparse-geq::mid", NULL);
+
+  gsm_state_machine_set_input_enum (sm, geq, TEST_SPARSE_MID);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  /* Values after a gap map to the right condition */
+  gsm_state_machine_set_input_enum (sm, geq, TEST_SPARSE_HIGH);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input_enum (sm, eq, TEST_SPARSE_HIGH);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input_enum (sm, eq, TEST_SPARSE_MID);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  gsm_state_machine_set_input_enum (sm, geq, TEST_SPARSE_LOW);
+  g_assert_true (gsm_state_machine_settle (sm, 0, NULL));
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+}
+
+static gint counted_condition_calls = 0;
+
+static GQuark
+counted_boolean_condition (GQuark condition, GsmConditionType type, const GValue *value)
+{
+  counted_condition_calls += 1;
+
+  return g_value_get_boolean (value) ? condition : 0;
+}
+
+static void
+test_incremental_conditions (void)
+{
+  GMainContext *ctx = g_main_context_default ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gchar *cond_a[] = { "bool-a", NULL };
+  gchar *cond_b[] = { "bool-b", NULL };
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-a", "BoolA", "A test input boolean", FALSE, 0));
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-b", "BoolB", "A test input boolean", FALSE, 0));
+  gsm_state_machine_create_condition (sm, "bool-a", cond_a, GSM_CONDITION_TYPE_EQ, counted_boolean_condition);
+  gsm_state_machine_create_condition (sm, "bool-b", cond_b, GSM_CONDITION_TYPE_EQ, counted_boolean_condition);
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_INIT, TEST_STATE_A,
+                              "bool-a", "!bool-b",
+                              NULL);
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_A, TEST_STATE_B,
+                              "bool-b",
+                              NULL);
+
+  counted_condition_calls = 0;
+  gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+  g_assert_cmpint (counted_condition_calls, ==, 2);
+
+  /* Only the changed input is evaluated again */
+  gsm_state_machine_set_input (sm, "bool-a", TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+  g_assert_cmpint (counted_condition_calls, ==, 3);
+
+  gsm_state_machine_set_input (sm, "bool-b", TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+  g_assert_cmpint (counted_condition_calls, ==, 4);
+
+  /* Going back and forth keeps the active set consistent; B is not
+   * sensitive to bool-a so it is only evaluated with the next update. */
+  gsm_state_machine_set_input (sm, "bool-a", FALSE);
+  gsm_state_machine_set_input (sm, "bool-a", TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (counted_condition_calls, ==, 4);
+  gsm_state_machine_settle (sm, 0, NULL);
+  g_assert_cmpint (counted_condition_calls, ==, 5);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+}
+
+static void
+test_many_conditions (void)
+{
+  GMainContext *ctx = g_main_context_default ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  /* Enough conditions to need more than one word per condition set */
+  for (gint i = 0; i < 50; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("bool-%d", i);
+
+      gsm_state_machine_add_input (sm,
+                                   g_param_spec_boolean (name, "Bool", "A test input boolean", FALSE, 0));
+      gsm_state_machine_create_default_condition (sm, name, GSM_CONDITION_TYPE_EQ);
+    }
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_INIT, TEST_STATE_A,
+                              "bool-1", "bool-49",
+                              NULL);
+
+  gsm_state_machine_add_edge (sm,
+                              TEST_STATE_A, TEST_STATE_B,
+                              "!bool-49", "bool-40",
+                              NULL);
+
+  gsm_state_machine_set_running (sm, TRUE);
+
+  gsm_state_machine_set_input (sm, "bool-49", TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_INIT);
+
+  gsm_state_machine_set_input (sm, "bool-1", TRUE);
+  gsm_state_machine_set_input (sm, "bool-40", TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_A);
+
+  gsm_state_machine_set_input (sm, "bool-49", FALSE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  gsm_state_machine_to_dot_file (sm, "many-conditions.dot");
+}
+
+static void
+test_post (void)
+{
+  g_autoptr(GMainContext) ctx = g_main_context_new ();
+  g_autoptr(GsmStateMachine) sm = NULL;
+  gint counter_input_changed = 0;
+  gint bool_in, int_in, double_in, go;
+
+  sm = g_object_new (GSM_TYPE_STATE_MACHINE,
+                     "state-type", TEST_TYPE_STATE_MACHINE,
+                     "main-context", ctx,
+                     NULL);
+
+  bool_in = gsm_state_machine_add_input (sm,
+                                         g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  int_in = gsm_state_machine_add_input (sm,
+                                        g_param_spec_int ("int-in", "IntIn", "A test input int", 0, 100, 0, 0));
+  double_in = gsm_state_machine_add_input (sm,
+                                           g_param_spec_double ("double-in", "DoubleIn", "A test input double", 0, 1, 0, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
+  go = gsm_state_machine_add_event (sm, "go");
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "go", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "bool-in", NULL);
+
+  gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+
+  g_signal_connect_swapped (sm, "input-changed", G_CALLBACK (count_signal), &counter_input_changed);
+
+  /* Posting requires a sealed definition */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*sealed*");
+  g_assert_false (gsm_state_machine_post_event (sm, go));
+  g_test_assert_expected_messages ();
+  gsm_state_machine_get_definition (sm);
+
+  /* Nothing happens until the context runs, repeated posts are coalesced */
+  gsm_state_machine_post_input_int (sm, int_in, 10);
+  gsm_state_machine_post_input_int (sm, int_in, 20);
+  gsm_state_machine_post_input_double (sm, double_in, 0.5);
+  gsm_state_machine_post_input_boolean (sm, bool_in, TRUE);
+  g_assert_true (gsm_state_machine_post_event (sm, go));
+  g_assert_cmpint (gsm_state_machine_get_input_int (sm, int_in), ==, 0);
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 0);
+
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (counter_input_changed, ==, 3);
+  g_assert_cmpint (gsm_state_machine_get_input_int (sm, int_in), ==, 20);
+  g_assert_cmpfloat (gsm_state_machine_get_input_double (sm, double_in), ==, 0.5);
+  g_assert_cmpint (gsm_state_machine_get_state (sm), ==, TEST_STATE_B);
+
+  /* The number of events in flight is bounded */
+  while (gsm_state_machine_post_event (sm, go))
+    ;
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 0);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 0);
+  g_assert_true (gsm_state_machine_post_event (sm, go));
+
+  /* Invalid inputs */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not gint*");
+  gsm_state_machine_post_input_int (sm, bool_in, 1);
+  g_test_assert_expected_messages ();
+
+  /* Out of range values are rejected before they are published */
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*not valid for input \"int-in\"*");
+  gsm_state_machine_post_input_int (sm, int_in, 200);
+  g_test_assert_expected_messages ();
+  counter_input_changed = 0;
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_assert_cmpint (counter_input_changed, ==, 0);
+  g_assert_cmpint (gsm_state_machine_get_input_int (sm, int_in), ==, 20);
+}
+
+#define N_POST_THREADS 4
+#define N_POSTS 10000
+
+typedef struct
+{
+  GsmStateMachine *sm;
+  gint             input;
+  gint             event;
+  gint            *n_done;
+} PostThread;
+
+static gpointer
+post_thread (gpointer user_data)
+{
+  PostThread *data = user_data;
+
+  for (gint i = 1; i <= N_POSTS; i++)
+    {
+      gsm_state_machine_post_input_int (data->sm, data->input, i);
+
+      if (i % 10 == 0)
+        while (!gsm_state_machine_post_event (data->sm, data->event))
+          g_thread_yield ();
+    }
+
+  g_atomic_int_inc (data->n_done);
+  g_main_context_wakeup (gsm_state_machine_get_main_context (data->sm));
+
+  return NULL;
+}
+
+static void
+count_transitions (gint *counter)
+{
+  *counter += 1;
+}
+
+static void
+check_post_threads (GMainContext *ctx,
+                    GsmScheduler *scheduler)
+{
+  g_autoptr(GsmStateMachine) sm = NULL;
+  PostThread data[N_POST_THREADS];
+  GThread *threads[N_POST_THREADS];
+  gint n_done = 0;
+  gint n_transitions = 0;
+
+  sm = g_object_new (GSM_TYPE_STATE_MACHINE,
+                     "state-type", TEST_TYPE_STATE_MACHINE,
+                     "main-context", ctx,
+                     "scheduler", scheduler,
+                     NULL);
+
+  gsm_state_machine_add_event (sm, "go");
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "go", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_INIT, "go", NULL);
+
+  for (gint i = 0; i < N_POST_THREADS; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("int-%d", i);
+
+      data[i].sm = sm;
+      data[i].input = gsm_state_machine_add_input (sm, g_param_spec_int (name, name, "A test input int", 0, N_POSTS, 0, 0));
+      data[i].event = gsm_state_machine_lookup_event (sm, "go");
+      data[i].n_done = &n_done;
+    }
+
+  gsm_state_machine_set_update_mode (sm, GSM_UPDATE_MODE_RUN_TO_COMPLETION);
+  gsm_state_machine_set_running (sm, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+  g_signal_connect_swapped (sm, "state-enter", G_CALLBACK (count_transitions), &n_transitions);
+  gsm_state_machine_get_definition (sm);
+
+  for (gint i = 0; i < N_POST_THREADS; i++)
+    threads[i] = g_thread_new ("post", post_thread, &data[i]);
+
+  while (g_atomic_int_get (&n_done) < N_POST_THREADS)
+    g_main_context_iteration (ctx, TRUE);
+  while (g_main_context_iteration (ctx, FALSE)) {}
+
+  for (gint i = 0; i < N_POST_THREADS; i++)
+    {
+      g_thread_join (threads[i]);
+      g_assert_cmpint (gsm_state_machine_get_input_int (sm, data[i].input), ==, N_POSTS);
+    }
+
+  /* Every event was applied exactly once */
+  g_assert_cmpint (n_transitions, ==, N_POST_THREADS * N_POSTS / 10);
+  g_assert_cmpint (gsm_state_machine_get_n_pending_events (sm), ==, 0);
+}
+
+static void
+test_post_threads (void)
+{
+  g_autoptr(GMainContext) ctx = g_main_context_new ();
+  g_autoptr(GsmScheduler) scheduler = NULL;
+
+  check_post_threads (ctx, NULL);
+
+  scheduler = gsm_scheduler_new (ctx);
+  check_post_threads (ctx, scheduler);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gsm-state-machine/init",
+                   test_init);
+
+  g_test_add_func ("/gsm-state-machine/simple-machine",
+                   test_simple_machine);
+
+  g_test_add_func ("/gsm-state-machine/groups",
+                   test_groups);
+
+  g_test_add_func ("/gsm-state-machine/nested-groups",
+                   test_nested_groups);
+
+  g_test_add_func ("/gsm-state-machine/orthogonal-transitions",
+                   test_orthogonal_transitions);
+
+  g_test_add_func ("/gsm-state-machine/output",
+                   test_output);
+
+  g_test_add_func ("/gsm-state-machine/events",
+                   test_events);
+
+  g_test_add_func ("/gsm-state-machine/event-dispatch",
+                   test_event_dispatch);
+
+  g_test_add_func ("/gsm-state-machine/run-to-completion",
+                   test_run_to_completion);
+
+  g_test_add_func ("/gsm-state-machine/step-settle",
+                   test_step_settle);
+
+  g_test_add_func ("/gsm-state-machine/main-context",
+                   test_main_context);
+
+  g_test_add_func ("/gsm-state-machine/event-queue",
+                   test_event_queue);
+
+  g_test_add_func ("/gsm-state-machine/handles",
+                   test_handles);
+
+  g_test_add_func ("/gsm-state-machine/input-sensitivity",
+                   test_input_sensitivity);
+
+  g_test_add_func ("/gsm-state-machine/input-suppression",
+                   test_input_suppression);
+
+  g_test_add_func ("/gsm-state-machine/batched-update",
+                   test_batched_update);
+
+  g_test_add_func ("/gsm-state-machine/typed-inputs",
+                   test_typed_inputs);
+
+  g_test_add_func ("/gsm-state-machine/typed-inputs-invalid",
+                   test_typed_inputs_invalid);
+
+  g_test_add_func ("/gsm-state-machine/peek-values",
+                   test_peek_values);
+
+  g_test_add_func ("/gsm-state-machine/threshold-conditions",
+                   test_threshold_conditions);
+
+  g_test_add_func ("/gsm-state-machine/timeout-edges",
+                   test_timeout_edges);
+
+  g_test_add_func ("/gsm-state-machine/virtual-clock",
+                   test_virtual_clock);
+
+  g_test_add_func ("/gsm-state-machine/shared-definition",
+                   test_shared_definition);
+
+  g_test_add_func ("/gsm-state-machine/enum-conditional-eq",
+                   test_enum_conditional_eq);
+
+  g_test_add_func ("/gsm-state-machine/enum-conditional-leq",
+                   test_enum_conditional_leq);
+
+  g_test_add_func ("/gsm-state-machine/enum-conditional-geq",
+                   test_enum_conditional_geq);
+
+  g_test_add_func ("/gsm-state-machine/enum-conditional-sparse",
+                   test_enum_conditional_sparse);
+
+  g_test_add_func ("/gsm-state-machine/incremental-conditions",
+                   test_incremental_conditions);
+
+  g_test_add_func ("/gsm-state-machine/many-conditions",
+                   test_many_conditions);
+
+  g_test_add_func ("/gsm-state-machine/post",
+                   test_post);
+
+  g_test_add_func ("/gsm-state-machine/post-threads",
+                   test_post_threads);
 
   g_test_run ();
 }
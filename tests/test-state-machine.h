@@ -21,9 +21,46 @@
 
 #pragma once
 
+#include "gsm-state-machine.h"
+
 typedef enum {
   TEST_STATE_INIT,
   TEST_STATE_A,
   TEST_STATE_B,
 } TestStateMachine;
 
+/* Has gaps between the values */
+typedef enum {
+  TEST_SPARSE_LOW = 1,
+  TEST_SPARSE_MID = 5,
+  TEST_SPARSE_HIGH = 20,
+} TestSparse;
+
+#include "test-enum-types.h"
+
+/* INIT -> A once bool-in is set or int-in reaches 50 (with a hysteresis
+ * of 10), A -> B on "go" and B -> INIT after 100ms. Used by the tests that
+ * compare the other engines against GsmStateMachine. */
+static inline GsmStateMachine*
+test_create_template (void)
+{
+  GsmStateMachine *sm;
+
+  sm = gsm_state_machine_new (TEST_TYPE_STATE_MACHINE);
+
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_boolean ("bool-in", "BoolIn", "A test input boolean", FALSE, 0));
+  gsm_state_machine_add_input (sm,
+                               g_param_spec_int ("int-in", "IntIn", "A test input int", 0, 100, 0, 0));
+  gsm_state_machine_create_default_condition (sm, "bool-in", GSM_CONDITION_TYPE_EQ);
+  gsm_state_machine_create_threshold_condition (sm, "int-in", (const GStrv) (const gchar*[]) { "50", NULL },
+                                                GSM_CONDITION_TYPE_GEQ, 10.0);
+  gsm_state_machine_add_event (sm, "go");
+
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "bool-in", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_INIT, TEST_STATE_A, "!bool-in", ">=int-in::50", NULL);
+  gsm_state_machine_add_edge (sm, TEST_STATE_A, TEST_STATE_B, "go", NULL);
+  gsm_state_machine_add_timeout_edge (sm, TEST_STATE_B, TEST_STATE_INIT, 100, NULL);
+
+  return sm;
+}